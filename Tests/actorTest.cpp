@@ -0,0 +1,614 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+// a unit test made using the Catch framework in catch.hpp / tests.cpp.
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "catch.hpp"
+#include "madronalib.h"
+#include "tests.h"
+
+using namespace ml;
+using namespace std::chrono;
+
+namespace actorTest
+{
+
+struct CountingActor : public Actor
+{
+  std::atomic<int> messagesReceived{0};
+  std::atomic<int> valueSum{0};
+  Stats<double> latencyStats;
+  time_point<high_resolution_clock> lastSendTime;
+
+  ~CountingActor() { stop(); }
+
+  void onMessage(Message m) override
+  {
+    auto latency = duration_cast<microseconds>(high_resolution_clock::now() - lastSendTime);
+    latencyStats.accumulate(latency.count());
+    valueSum += m.value.getIntValue();
+    messagesReceived++;
+  }
+};
+
+template <typename Pred>
+bool waitFor(Pred p, milliseconds timeout)
+{
+  auto start = high_resolution_clock::now();
+  while (!p())
+  {
+    if (high_resolution_clock::now() - start > timeout) return false;
+    std::this_thread::sleep_for(microseconds(100));
+  }
+  return true;
+}
+
+TEST_CASE("madronalib/core/actor/event-driven", "[actor]")
+{
+  CountingActor actor;
+  actor.startEventDriven();
+
+  // send single messages and wait for each one to arrive.
+  constexpr int kSingleMessages{100};
+  for (int i = 0; i < kSingleMessages; ++i)
+  {
+    actor.lastSendTime = high_resolution_clock::now();
+    actor.enqueueMessage(Message("test", i));
+    REQUIRE(waitFor([&]() { return actor.messagesReceived == i + 1; }, milliseconds(1000)));
+  }
+  REQUIRE(actor.valueSum == kSingleMessages * (kSingleMessages - 1) / 2);
+
+  // latency should be well below a typical polling interval. The bound here is
+  // loose so as not to fail on loaded CI machines.
+  REQUIRE(actor.latencyStats.median() < 16000);
+
+  actor.stop();
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/actor/event-driven/latency", "[.][benchmark]")
+{
+  CountingActor actor;
+  actor.startEventDriven();
+  constexpr int kMessages{1000};
+  for (int i = 0; i < kMessages; ++i)
+  {
+    actor.lastSendTime = high_resolution_clock::now();
+    actor.enqueueMessage(Message("test", i));
+    REQUIRE(waitFor([&]() { return actor.messagesReceived == i + 1; }, milliseconds(1000)));
+  }
+  actor.stop();
+  std::cout << "event-driven latency: median " << actor.latencyStats.median() << "us, max "
+            << actor.latencyStats.max() << "us\n";
+}
+
+TEST_CASE("madronalib/core/actor/coalesce", "[actor]")
+{
+  CountingActor actor;
+  actor.startEventDriven(microseconds(500));
+
+  // a burst of messages should all be handled.
+  constexpr int kBurstSize{100};
+  for (int i = 0; i < kBurstSize; ++i)
+  {
+    actor.enqueueMessage(Message("test", 1));
+  }
+  REQUIRE(waitFor([&]() { return actor.messagesReceived == kBurstSize; }, milliseconds(1000)));
+
+  // stopping and restarting should not lose messages.
+  actor.stop();
+  actor.enqueueMessage(Message("test", 1));
+  actor.startEventDriven();
+  actor.enqueueMessage(Message("test", 1));
+  REQUIRE(waitFor([&]() { return actor.messagesReceived == kBurstSize + 2; }, milliseconds(1000)));
+}
+
+// checks that its onMessage() is never entered by two threads at once, and optionally
+// forwards each message to another Actor.
+struct SerialActor : public Actor
+{
+  std::atomic<bool> inMessage{false};
+  std::atomic<int> overlaps{0};
+  std::atomic<int> messagesReceived{0};
+  SerialActor* pForwardTo{nullptr};
+
+  ~SerialActor() { stop(); }
+
+  void onMessage(Message m) override
+  {
+    if (inMessage.exchange(true)) overlaps++;
+    messagesReceived++;
+    if (pForwardTo) pForwardTo->enqueueMessage(m);
+    inMessage = false;
+  }
+};
+
+TEST_CASE("madronalib/core/actor/switch-modes", "[actor]")
+{
+  // switching from event-driven to timer mode while messages are arriving should
+  // leave only the timer handling the mailbox.
+  SharedResourcePointer<Timers> timers;
+  timers->start();
+  SerialActor actor;
+  actor.startEventDriven();
+  constexpr int kMessages{2000};
+  std::thread sender([&]() {
+    for (int i = 0; i < kMessages; ++i)
+    {
+      actor.enqueueMessage(Message("test", i));
+
+      // don't let the queue fill up.
+      while (actor.messagesReceived < i - 64)
+      {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::this_thread::sleep_for(milliseconds(2));
+  actor.start(1);
+  sender.join();
+  REQUIRE(waitFor([&]() { return actor.messagesReceived == kMessages; }, milliseconds(5000)));
+  REQUIRE(actor.overlaps == 0);
+  actor.stop();
+}
+
+TEST_CASE("madronalib/core/actor/scheduler", "[actor][scheduler]")
+{
+  ActorScheduler scheduler;
+  scheduler.start(4);
+  REQUIRE(scheduler.getNumThreads() == 4);
+
+  constexpr int kNumActors{200};
+  constexpr int kMessagesPerActor{50};
+  std::vector<std::unique_ptr<SerialActor> > actors;
+  for (int i = 0; i < kNumActors; ++i)
+  {
+    actors.emplace_back(std::unique_ptr<SerialActor>(new SerialActor));
+  }
+
+  // the first half of the actors forward their messages to the second half.
+  for (int i = 0; i < kNumActors / 2; ++i)
+  {
+    actors[i]->pForwardTo = actors[i + kNumActors / 2].get();
+  }
+
+  for (auto& a : actors)
+  {
+    a->startOnScheduler(scheduler, 4);
+  }
+
+  // send messages to the first half in rounds small enough not to fill the queues.
+  for (int j = 0; j < kMessagesPerActor; ++j)
+  {
+    for (int i = 0; i < kNumActors / 2; ++i)
+    {
+      actors[i]->enqueueMessage(Message("test", j));
+    }
+    REQUIRE(waitFor(
+        [&]() {
+          for (int i = kNumActors / 2; i < kNumActors; ++i)
+          {
+            if (actors[i]->messagesReceived < j + 1) return false;
+          }
+          return true;
+        },
+        milliseconds(5000)));
+  }
+
+  int totalOverlaps{0};
+  int totalReceived{0};
+  for (auto& a : actors)
+  {
+    totalOverlaps += a->overlaps;
+    totalReceived += a->messagesReceived;
+  }
+  REQUIRE(totalOverlaps == 0);
+  REQUIRE(totalReceived == kNumActors * kMessagesPerActor);
+
+  // stopping actors while the scheduler runs should be safe.
+  for (auto& a : actors)
+  {
+    a->stop();
+  }
+  scheduler.stop();
+}
+
+// stops itself after a given number of messages.
+struct SelfStoppingActor : public Actor
+{
+  std::atomic<int> messagesReceived{0};
+  int stopAfter{0};
+
+  ~SelfStoppingActor() { stop(); }
+
+  size_t messagesWaiting() { return getMessagesAvailable(); }
+
+  void onMessage(Message m) override
+  {
+    if (++messagesReceived == stopAfter) stop();
+  }
+};
+
+TEST_CASE("madronalib/core/actor/scheduler/self-stop", "[actor][scheduler]")
+{
+  ActorScheduler scheduler;
+  scheduler.start(2);
+
+  SelfStoppingActor a;
+  a.stopAfter = 3;
+  a.startOnScheduler(scheduler, 8);
+  for (int i = 0; i < 6; ++i)
+  {
+    a.enqueueMessage(Message("test", i));
+  }
+
+  // stop() from inside onMessage() returns, and no more messages are handled.
+  REQUIRE(waitFor([&]() { return a.messagesReceived == 3; }, milliseconds(5000)));
+  std::this_thread::sleep_for(milliseconds(20));
+  REQUIRE(a.messagesReceived == 3);
+  REQUIRE(a.messagesWaiting() == 3);
+
+  scheduler.stop();
+}
+
+TEST_CASE("madronalib/core/actor/registry", "[actor][registry]")
+{
+  CountingActor a, b;
+  a.startEventDriven();
+  b.startEventDriven();
+
+  // an ActorRef follows changes to the registry.
+  ActorRef ref("test/actor");
+  REQUIRE(!ref.sendMessage(Message("test", 1)));
+  registerActor("test/actor", &a);
+  REQUIRE(ref.sendMessage(Message("test", 1)));
+  registerActor("test/actor", &b);
+  REQUIRE(ref.sendMessage(Message("test", 1)));
+  removeActor(&b);
+  REQUIRE(!ref.sendMessage(Message("test", 1)));
+  REQUIRE(waitFor([&]() { return a.messagesReceived == 1 && b.messagesReceived == 1; },
+                  milliseconds(1000)));
+
+  // send from several threads while the registry is changed from another.
+  constexpr int kSenders{4};
+  constexpr int kMessagesPerSender{4000};
+  const char* names[kSenders]{"receivers/a", "receivers/b", "receivers/c", "receivers/d"};
+  CountingActor receivers[kSenders];
+  for (int i = 0; i < kSenders; ++i)
+  {
+    receivers[i].startEventDriven();
+    registerActor(names[i], &receivers[i]);
+  }
+
+  std::atomic<bool> churning{true};
+  std::thread churnThread([&]() {
+    while (churning)
+    {
+      registerActor("churn/actor", &a);
+      removeActor(&a);
+    }
+  });
+
+  std::vector<std::thread> senders;
+  for (int i = 0; i < kSenders; ++i)
+  {
+    senders.emplace_back([&, i]() {
+      ActorRef ref(names[i]);
+      for (int j = 0; j < kMessagesPerSender; ++j)
+      {
+        // alternate between the cached and uncached ways of sending.
+        if (j & 1)
+        {
+          ref.sendMessage(Message("test", 1));
+        }
+        else
+        {
+          sendMessageToActor(names[i], Message("test", 1));
+        }
+
+        // don't let the queue fill up.
+        while (receivers[i].messagesReceived < j - 64)
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& t : senders)
+  {
+    t.join();
+  }
+  churning = false;
+  churnThread.join();
+
+  for (int i = 0; i < kSenders; ++i)
+  {
+    REQUIRE(waitFor([&]() { return receivers[i].messagesReceived == kMessagesPerSender; },
+                    milliseconds(5000)));
+    removeActor(&receivers[i]);
+  }
+  removeActor(&a);
+
+  // sends to a missing Actor are dropped.
+  ActorRef missingRef("test/missing/actor");
+  sendMessageToActor("test/missing/actor", Message());
+  REQUIRE(!missingRef.sendMessage(Message()));
+}
+
+// run with the tag [benchmark] to see the results. Compare the time taken by
+// cached and uncached sends to a non-existent Actor, which measures the lookup alone.
+TEST_CASE("madronalib/core/actor/registry/lookup", "[.][benchmark]")
+{
+  constexpr int kLookups{100000};
+  ActorRef missingRef("test/missing/actor");
+  auto startTime = high_resolution_clock::now();
+  for (int i = 0; i < kLookups; ++i)
+  {
+    sendMessageToActor("test/missing/actor", Message());
+  }
+  auto lookupTime = duration_cast<nanoseconds>(high_resolution_clock::now() - startTime);
+  startTime = high_resolution_clock::now();
+  int sent{0};
+  for (int i = 0; i < kLookups; ++i)
+  {
+    if (missingRef.sendMessage(Message())) sent++;
+  }
+  auto cachedTime = duration_cast<nanoseconds>(high_resolution_clock::now() - startTime);
+  REQUIRE(sent == 0);
+  std::cout << "send lookup: " << lookupTime.count() / kLookups
+            << "ns, cached: " << cachedTime.count() / kLookups << "ns\n";
+}
+
+// records each message so that the order and values can be checked.
+struct RecordingActor : public Actor
+{
+  std::vector<Message> received;
+  std::atomic<int> messagesReceived{0};
+  std::atomic<int> fullQueueCount{0};
+  microseconds handlerTime{0};
+
+  ~RecordingActor() { stop(); }
+
+  void onFullQueue() override { fullQueueCount++; }
+
+  void onMessage(Message m) override
+  {
+    if (handlerTime > microseconds(0)) std::this_thread::sleep_for(handlerTime);
+    received.push_back(m);
+    messagesReceived++;
+  }
+};
+
+TEST_CASE("madronalib/core/actor/mailbox", "[actor][mailbox]")
+{
+  // the Actors are not started until their queues are full.
+  constexpr int kMessages{300};
+  {
+    RecordingActor a;
+    auto capacity = a.getMailboxMetrics().capacity;
+    for (int i = 0; i < kMessages; ++i)
+    {
+      a.enqueueMessage(Message("test", i));
+    }
+    auto metrics = a.getMailboxMetrics();
+    REQUIRE(metrics.enqueued == capacity);
+    REQUIRE(metrics.dropped == kMessages - capacity);
+    REQUIRE(metrics.highWaterMark == capacity);
+    REQUIRE(a.fullQueueCount == kMessages - capacity);
+
+    a.startEventDriven();
+    REQUIRE(waitFor([&]() { return a.messagesReceived == capacity; }, milliseconds(1000)));
+    REQUIRE(a.received.back().value.getIntValue() == capacity - 1);
+    REQUIRE(a.getMailboxMetrics().handled == capacity);
+  }
+
+  {
+    RecordingActor a;
+    a.setMailboxPolicy(MailboxPolicy::kDropOldest);
+    auto capacity = a.getMailboxMetrics().capacity;
+    for (int i = 0; i < kMessages; ++i)
+    {
+      a.enqueueMessage(Message("test", i));
+    }
+    REQUIRE(a.getMailboxMetrics().dropped == kMessages - capacity);
+    REQUIRE(a.fullQueueCount == 0);
+
+    a.startEventDriven();
+    REQUIRE(waitFor([&]() { return a.messagesReceived == capacity; }, milliseconds(1000)));
+    REQUIRE(a.received.front().value.getIntValue() == kMessages - capacity);
+    REQUIRE(a.received.back().value.getIntValue() == kMessages - 1);
+  }
+
+  {
+    // fill the queue with messages to two addresses, then keep sending to one of them.
+    RecordingActor a;
+    a.setMailboxPolicy(MailboxPolicy::kCoalesce);
+    auto capacity = a.getMailboxMetrics().capacity;
+    for (int i = 0; i < kMessages; ++i)
+    {
+      a.enqueueMessage(Message((i & 1) ? "x" : "y", i));
+    }
+    for (int i = 0; i < kMessages; ++i)
+    {
+      a.enqueueMessage(Message("x", 1000 + i));
+    }
+    auto metrics = a.getMailboxMetrics();
+    REQUIRE(metrics.dropped == 0);
+    REQUIRE(metrics.coalesced == 2 * kMessages - capacity);
+
+    a.startEventDriven();
+    REQUIRE(waitFor([&]() { return a.messagesReceived == capacity; }, milliseconds(1000)));
+    Message lastX;
+    for (auto& m : a.received)
+    {
+      if (m.address == Path("x")) lastX = m;
+    }
+    REQUIRE(lastX.value.getIntValue() == 1000 + kMessages - 1);
+  }
+
+  {
+    // with a slow receiver, blocking loses nothing.
+    RecordingActor a;
+    a.setMailboxPolicy(MailboxPolicy::kBlock);
+    a.setLatencyTracking(true);
+    a.handlerTime = microseconds(10);
+    a.startEventDriven();
+    for (int i = 0; i < kMessages * 2; ++i)
+    {
+      a.enqueueMessage(Message("test", i));
+    }
+    REQUIRE(waitFor([&]() { return a.messagesReceived == kMessages * 2; }, milliseconds(5000)));
+    auto metrics = a.getMailboxMetrics();
+    REQUIRE(metrics.dropped == 0);
+    REQUIRE(metrics.handled == kMessages * 2);
+    REQUIRE(metrics.getLatencyPercentile(0.5) > microseconds(0));
+    REQUIRE(metrics.getLatencyPercentile(0.5) <= metrics.getLatencyPercentile(0.99));
+
+    // the dump contains each registered Actor. The registry exists only as long as
+    // something refers to it.
+    SharedResourcePointer<ActorRegistry> registry;
+    registerActor("test/blocking", &a);
+    std::ostringstream dump;
+    registry->dumpMetrics(dump);
+    REQUIRE(dump.str().find("test/blocking: depth 0/") != std::string::npos);
+    removeActor(&a);
+  }
+}
+
+// changes the registry from onMessage().
+struct RegisteringActor : public RecordingActor
+{
+  RecordingActor other;
+
+  void onMessage(Message m) override
+  {
+    registerActor("test/registering/other", &other);
+    removeActor(&other);
+    RecordingActor::onMessage(m);
+  }
+};
+
+TEST_CASE("madronalib/core/actor/mailbox/block-registry", "[actor][mailbox]")
+{
+  // a sender blocked on a full mailbox must not hold up a receiver that changes
+  // the registry.
+  constexpr int kMessages{1000};
+  SharedResourcePointer<ActorRegistry> registry;
+  RegisteringActor a;
+  a.setMailboxPolicy(MailboxPolicy::kBlock);
+  registerActor("test/registering", &a);
+  a.startEventDriven();
+
+  ActorRef ref("test/registering");
+  for (int i = 0; i < kMessages; ++i)
+  {
+    if (i & 1)
+    {
+      sendMessageToActor("test/registering", Message("test", i));
+    }
+    else
+    {
+      ref.sendMessage(Message("test", i));
+    }
+  }
+  REQUIRE(waitFor([&]() { return a.messagesReceived == kMessages; }, milliseconds(10000)));
+  REQUIRE(a.getMailboxMetrics().dropped == 0);
+
+  removeActor(&a);
+  a.stop();
+}
+
+TEST_CASE("madronalib/core/actor/coalescing", "[actor][mailbox][coalescing]")
+{
+  {
+    // messages are handled in the order their addresses first arrived, with the
+    // latest values.
+    RecordingActor a;
+    a.setMailboxCoalescing(true);
+    const char* addresses[]{"a", "b", "a", "c", "b", "a"};
+    for (int i = 0; i < 6; ++i)
+    {
+      a.enqueueMessage(Message(addresses[i], i));
+    }
+    REQUIRE(a.getMailboxMetrics().depth == 3);
+    a.startEventDriven();
+    REQUIRE(waitFor([&]() { return a.messagesReceived == 3; }, milliseconds(1000)));
+    REQUIRE(a.received[0].address == Path("a"));
+    REQUIRE(a.received[0].value == Value(5));
+    REQUIRE(a.received[1].address == Path("b"));
+    REQUIRE(a.received[1].value == Value(4));
+    REQUIRE(a.received[2].address == Path("c"));
+    REQUIRE(a.received[2].value == Value(3));
+    auto metrics = a.getMailboxMetrics();
+    REQUIRE(metrics.enqueued == 3);
+    REQUIRE(metrics.coalesced == 3);
+  }
+
+  {
+    // compare a Mailbox against a simple model while pushing to more addresses
+    // than it can hold, and popping at random.
+    Mailbox box(64);
+    box.setCoalescing(true);
+    const size_t capacity = box.getMetrics().capacity;
+    std::vector<Message> model;
+    int errors{0};
+    std::mt19937 rng(1);
+    constexpr int kAddresses{100};
+    std::vector<Path> paths;
+    for (int i = 0; i < kAddresses; ++i)
+    {
+      paths.push_back(Path(Symbol("param"), Symbol(TextFragment(textUtils::naturalNumberToText(i)))));
+    }
+
+    for (int i = 0; i < 20000; ++i)
+    {
+      if (rng() % 3)
+      {
+        Message m(paths[rng() % kAddresses], i);
+        auto it = std::find_if(model.begin(), model.end(),
+                               [&](const Message& w) { return w.address == m.address; });
+        bool expected = true;
+        if (it != model.end())
+        {
+          it->value = m.value;
+        }
+        else if (model.size() < capacity)
+        {
+          model.push_back(m);
+        }
+        else
+        {
+          expected = false;
+        }
+        if (box.push(std::move(m), []() { return false; }) != expected) errors++;
+      }
+      else
+      {
+        Message m;
+        bool popped = box.pop(m);
+        if (popped != !model.empty()) errors++;
+        if (popped)
+        {
+          if (m.address != model.front().address) errors++;
+          if (m.value != model.front().value) errors++;
+          model.erase(model.begin());
+        }
+      }
+      if (box.elementsAvailable() != model.size()) errors++;
+      if ((i % 100 == 0) && (box.getMetrics().depth != model.size())) errors++;
+    }
+    REQUIRE(errors == 0);
+  }
+}
+
+}  // namespace actorTest
@@ -337,3 +337,60 @@ TEST_CASE("madronalib/core/projections", "[projections]")
   }
 }
 
+
+TEST_CASE("madronalib/core/projections/typed", "[projections]")
+{
+  Interval normalRange{0, 1};
+  Interval freqRange{20, 20000};
+
+  // typed projections, composed at compile time, and the equivalent Projections.
+  auto typedToReal = compose(
+      AddProjection(1.f), IntervalMapProjection(normalRange, freqRange, LogProjection(freqRange)));
+  auto typedToNormal = IntervalMapProjection(freqRange, normalRange, ExpProjection(freqRange));
+  Projection toReal =
+      compose(projections::add(1.f),
+              projections::intervalMap(normalRange, freqRange, projections::log(freqRange)));
+  Projection toNormal =
+      projections::intervalMap(freqRange, normalRange, projections::exp(freqRange));
+  auto typedBisquared = compose(BisquaredProjection(), LinearProjection(normalRange, {-1, 1}));
+  Projection bisquared =
+      compose(projections::bisquared, projections::linear(normalRange, {-1, 1}));
+
+  // the typed projections convert to Projections at the boundary.
+  Projection erased = typedToReal;
+
+  for (int i = 0; i <= 10; ++i)
+  {
+    float x = i / 10.f;
+    float y = toReal(x);
+    REQUIRE(fabs(typedToReal(x) - y) < y * 1e-5f);
+    REQUIRE(fabs(erased(x) - y) < y * 1e-5f);
+    REQUIRE(fabs(typedToNormal(y - 1.f) - x) < 1e-5f);
+    REQUIRE(fabs(typedBisquared(x) - bisquared(x)) < 1e-6f);
+  }
+
+  // on DSPVectors, each projection runs on SIMD vectors.
+  DSPVector x{columnIndex() / (kFloatsPerDSPVector - 1.f)};
+  DSPVector y = typedToReal(x);
+  DSPVector z = typedToNormal(y - DSPVector(1.f));
+  VectorProjection vectorToReal = typedToReal;
+  DSPVector w = vectorToReal(x);
+  float maxError{0.f}, maxRoundTripError{0.f};
+  for (int i = 0; i < kFloatsPerDSPVector; ++i)
+  {
+    float yi = toReal(x[i]);
+    maxError = std::max(maxError, fabsf(y[i] - yi) / yi);
+    maxError = std::max(maxError, fabsf(w[i] - yi) / yi);
+    maxRoundTripError = std::max(maxRoundTripError, fabsf(z[i] - x[i]));
+  }
+  REQUIRE(maxError < 1e-4f);
+  REQUIRE(maxRoundTripError < 1e-4f);
+
+  // and other projections compose the same way.
+  auto shape = compose(SmoothstepProjection(), compose(FlipProjection(), ClipProjection()));
+  DSPVector s = shape(x * 2.f - DSPVector(0.5f));
+  for (int i = 0; i < kFloatsPerDSPVector; ++i)
+  {
+    REQUIRE(nearlyEqual(s[i], shape(x[i] * 2.f - 0.5f)));
+  }
+}
@@ -5,10 +5,16 @@
 // a unit test made using the Catch framework in catch.hpp / tests.cpp.
 
 #include <chrono>
+#include <memory>
+#include <numeric>
 using namespace std::chrono;
 
 #include <thread>
 
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
 #include "catch.hpp"
 #include "madronalib.h"
 
@@ -124,4 +130,183 @@ TEST_CASE("madronalib/core/queue/available", "[queue][available]")
   REQUIRE(testQueue.elementsAvailable() == testQueue.size() - 1);
 }
 
+TEST_CASE("madronalib/core/queue/batch", "[queue][batch]")
+{
+  Queue< int > testQueue(10);
+  REQUIRE(testQueue.size() == 16);
+
+  std::vector< int > input(20);
+  std::iota(input.begin(), input.end(), 0);
+
+  // only size - 1 elements fit
+  REQUIRE(testQueue.pushN(input.data(), input.size()) == 15);
+  REQUIRE(testQueue.pushN(input.data(), 1) == 0);
+  REQUIRE(!testQueue.emplace(1));
+
+  std::vector< int > output(20);
+  REQUIRE(testQueue.popN(output.data(), 10) == 10);
+  REQUIRE(output[9] == 9);
+
+  // write across the end of the buffer
+  REQUIRE(testQueue.pushN(input.data() + 15, 5) == 5);
+  REQUIRE(testQueue.emplace(20));
+  REQUIRE(testQueue.elementsAvailable() == 11);
+
+  // read across the end of the buffer
+  REQUIRE(testQueue.popN(output.data() + 10, 20) == 11);
+  REQUIRE(testQueue.wasEmpty());
+  for (int i = 0; i < 21; ++i)
+  {
+    REQUIRE(output[i] == i);
+  }
+}
+
+TEST_CASE("madronalib/core/queue/move", "[queue][move]")
+{
+  // move-only elements
+  Queue< std::unique_ptr< int > > ptrQueue(4);
+  REQUIRE(ptrQueue.push(std::unique_ptr< int >(new int(1))));
+  REQUIRE(ptrQueue.emplace(new int(2)));
+
+  auto p3 = std::unique_ptr< int >(new int(3));
+  REQUIRE(ptrQueue.push(std::move(p3)));
+  REQUIRE(!p3);
+
+  std::unique_ptr< int > out;
+  REQUIRE(ptrQueue.pop(out));
+  REQUIRE(*out == 1);
+  out = ptrQueue.pop();
+  REQUIRE(*out == 2);
+  REQUIRE(ptrQueue.pop(out));
+  REQUIRE(*out == 3);
+  REQUIRE(!ptrQueue.pop(out));
+
+  // when the queue is full, the pushed item should be left alone
+  Queue< std::unique_ptr< int > > smallQueue(1);
+  REQUIRE(smallQueue.push(std::unique_ptr< int >(new int(4))));
+  auto p5 = std::unique_ptr< int >(new int(5));
+  REQUIRE(!smallQueue.push(std::move(p5)));
+  REQUIRE(*p5 == 5);
+}
+
+// try to run the thread on the given core so that producer and consumer are not
+// sharing one. Only implemented on Linux for now.
+inline void pinThreadToCore(std::thread& t, int core)
+{
+#if defined(__linux__)
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cpuSet);
+  pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &cpuSet);
+#endif
+}
+
+// send kMessages ints through a Queue from one thread to another, using batches of
+// the given size or single push / pop if batchSize is 1. Returns the elapsed time
+// in seconds.
+double timeQueueThroughput(size_t batchSize, size_t kMessages, uint64_t& receivedSum)
+{
+  Queue< int > q(1024);
+  std::vector< int > sendBuf(batchSize);
+  std::vector< int > recvBuf(batchSize);
+  std::atomic< bool > ready{false};
+  receivedSum = 0;
+
+  auto producer = [&]() {
+    while (!ready) std::this_thread::yield();
+    size_t sent = 0;
+    while (sent < kMessages)
+    {
+      if (batchSize == 1)
+      {
+        if (q.push(static_cast< int >(sent)))
+          sent++;
+        else
+          std::this_thread::yield();
+      }
+      else
+      {
+        size_t n = std::min(batchSize, kMessages - sent);
+        for (size_t i = 0; i < n; ++i) sendBuf[i] = static_cast< int >(sent + i);
+        size_t pushed = 0;
+        while (pushed < n)
+        {
+          size_t k = q.pushN(sendBuf.data() + pushed, n - pushed);
+          if (!k) std::this_thread::yield();
+          pushed += k;
+        }
+        sent += n;
+      }
+    }
+  };
+
+  auto consumer = [&]() {
+    while (!ready) std::this_thread::yield();
+    size_t received = 0;
+    while (received < kMessages)
+    {
+      if (batchSize == 1)
+      {
+        int v;
+        if (q.pop(v))
+        {
+          receivedSum += v;
+          received++;
+        }
+        else
+        {
+          std::this_thread::yield();
+        }
+      }
+      else
+      {
+        size_t n = q.popN(recvBuf.data(), batchSize);
+        if (!n) std::this_thread::yield();
+        for (size_t i = 0; i < n; ++i) receivedSum += recvBuf[i];
+        received += n;
+      }
+    }
+  };
+
+  std::thread producerThread(producer);
+  std::thread consumerThread(consumer);
+  pinThreadToCore(producerThread, 0);
+  pinThreadToCore(consumerThread, 1);
+
+  auto start = high_resolution_clock::now();
+  ready = true;
+  producerThread.join();
+  consumerThread.join();
+  auto end = high_resolution_clock::now();
+  return duration_cast< nanoseconds >(end - start).count() * 1e-9;
+}
+
+TEST_CASE("madronalib/core/queue/threads/batch", "[queue][threads]")
+{
+  constexpr size_t kMessages{1 << 16};
+  const uint64_t expectedSum = uint64_t(kMessages) * (kMessages - 1) / 2;
+
+  for (size_t batchSize : {1, 16, 64})
+  {
+    uint64_t receivedSum;
+    timeQueueThroughput(batchSize, kMessages, receivedSum);
+    REQUIRE(receivedSum == expectedSum);
+  }
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/queue/throughput", "[.][benchmark]")
+{
+  constexpr size_t kMessages{1 << 22};
+  const uint64_t expectedSum = uint64_t(kMessages) * (kMessages - 1) / 2;
+
+  for (size_t batchSize : {1, 16, 64})
+  {
+    uint64_t receivedSum;
+    double secs = timeQueueThroughput(batchSize, kMessages, receivedSum);
+    REQUIRE(receivedSum == expectedSum);
+    std::cout << "queue batch " << batchSize << ": " << kMessages / secs << " messages/s\n";
+  }
+}
+
 }  // namespace queueTest
@@ -4,11 +4,14 @@
 
 // a unit test made using the Catch framework in catch.hpp / tests.cpp.
 
+#include <atomic>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <map>
 #include <numeric>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -80,23 +83,123 @@ TEST_CASE("madronalib/core/symbol/threads", "[symbol][threads]")
   REQUIRE(theSymbolTable().getSize() == kThreadTestSize + 1);
 }
 
+TEST_CASE("madronalib/core/symbol/stress", "[symbol][threads][stress]")
+{
+  // each thread makes the same symbols in a different order, checking the text of
+  // each one and reading back symbols it made earlier, while the other threads are
+  // adding to the table. Every name must end up with exactly one ID.
+  theSymbolTable().clear();
+  constexpr int kThreads{8};
+  constexpr int kNames{20000};
+  std::vector<std::string> names;
+  for (int i = 0; i < kNames; ++i)
+  {
+    names.push_back("stress" + std::to_string(i));
+  }
+
+  std::vector<std::vector<SymbolID> > ids(kThreads, std::vector<SymbolID>(kNames));
+  std::atomic<int> errors{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t)
+  {
+    threads.push_back(std::thread([&, t]() {
+      for (int j = 0; j < kNames; ++j)
+      {
+        int i = (j + t * kNames / kThreads) % kNames;
+        Symbol sym(names[i].c_str());
+        ids[t][i] = sym.getID();
+        if (strcmp(sym.getUTF8Ptr(), names[i].c_str())) errors++;
+
+        int earlier = (i + kNames - 1) % kNames;
+        if (j > 0)
+        {
+          Symbol earlierSym(names[earlier].c_str());
+          if (earlierSym.getID() != ids[t][earlier]) errors++;
+          if (strcmp(earlierSym.getUTF8Ptr(), names[earlier].c_str())) errors++;
+        }
+      }
+    }));
+  }
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+
+  REQUIRE(errors == 0);
+  for (int t = 1; t < kThreads; ++t)
+  {
+    REQUIRE(ids[t] == ids[0]);
+  }
+  REQUIRE(theSymbolTable().getSize() == kNames + 1);
+  REQUIRE(theSymbolTable().audit());
+}
+
+// run with the tag [benchmark] to see the results. Lookups of existing symbols
+// don't lock, so the throughput should scale with the number of threads.
+TEST_CASE("madronalib/core/symbol/lookups", "[.][benchmark]")
+{
+  theSymbolTable().clear();
+  constexpr int kThreads{8};
+  constexpr int kNames{20000};
+  std::vector<std::string> names;
+  for (int i = 0; i < kNames; ++i)
+  {
+    names.push_back("lookup" + std::to_string(i));
+    Symbol(names.back().c_str());
+  }
+
+  constexpr int kLookups{200000};
+  auto lookupExisting = [&](int offset) {
+    size_t sum{0};
+    for (int i = 0; i < kLookups; ++i)
+    {
+      sum += Symbol(names[(i + offset) % kNames].c_str()).getID();
+    }
+    return sum;
+  };
+
+  auto start = now();
+  size_t sum = lookupExisting(0);
+  std::chrono::duration<double> singleElapsed = now() - start;
+
+  std::vector<size_t> sums(kThreads);
+  std::vector<std::thread> threads;
+  start = now();
+  for (int t = 0; t < kThreads; ++t)
+  {
+    threads.push_back(std::thread([&, t]() { sums[t] = lookupExisting(0); }));
+  }
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+  std::chrono::duration<double> multiElapsed = now() - start;
+
+  for (auto s : sums)
+  {
+    REQUIRE(s == sum);
+  }
+  std::cout << "symbol lookups/s: 1 thread: " << kLookups / singleElapsed.count() << ", "
+            << kThreads << " threads: " << kThreads * kLookups / multiElapsed.count() << "\n";
+}
+
 TEST_CASE("madronalib/core/collision", "[collision]")
 {
-  // nothing is checked here - these are two pairs of colliding symbols for
-  // reference with 12-bit hash:
+  // these are two pairs of colliding symbols with the former 12-bit hash:
   Symbol a("KP");
   Symbol aa("BAZ");
   Symbol b("KL");
   Symbol bb("mse");
-  // 16-bit hash:
-  Symbol c("FB");
-  Symbol cc("hombfbmohqqhombf");
+  REQUIRE(a != aa);
+  REQUIRE(b != bb);
+  REQUIRE(hash(a) != hash(aa));
+  REQUIRE(hash(b) != hash(bb));
 }
 
 template <size_t N>
-constexpr int hashTest1(const char (&sym)[N])
+constexpr uint64_t hashTest1(const char (&sym)[N])
 {
-  return krHash1<N>(sym);
+  return hash(sym);
 }
 
 TEST_CASE("madronalib/core/hashes", "[hashes]")
@@ -105,22 +208,164 @@ TEST_CASE("madronalib/core/hashes", "[hashes]")
   const char* str1("hello");
   const char* str2(u8"محمد بن سعيد");
 
-  constexpr int a1 = hashTest1("hello");
-  constexpr int a2 = hashTest1(u8"محمد بن سعيد");
+  constexpr uint64_t a1 = hashTest1("hello");
+  constexpr uint64_t a2 = hashTest1(u8"محمد بن سعيد");
+  constexpr HashedCharArray a3("hello");
+  static_assert(a3.len == 5, "literal length should not include the terminator");
 
-  int b1 = krHash0(str1, strlen(str1));
-  int b2 = krHash0(str2, strlen(str2));
+  uint64_t b1 = fnvHash(str1);
+  uint64_t b2 = fnvHash(str2, strlen(str2));
 
   REQUIRE(a1 == b1);
   REQUIRE(a2 == b2);
-  
-  
-  auto h = hash(Symbol());
-  //std::cout << "hash of null symbol: " << h << "\n";
+  REQUIRE(a3.hash == b1);
+  REQUIRE(HashedCharArray(str1).hash == b1);
+
+  // Symbols have the same hashes as their text.
+  REQUIRE(hash(Symbol("hello")) == a1);
+  REQUIRE(hash(Symbol()) == hash(""));
+  REQUIRE(Symbol("hello").getHashFromTable() == a1);
+}
+
+struct SymbolScaleTimes
+{
+  std::chrono::duration<double> create;
+  std::chrono::duration<double> lookup;
+};
+
+// make tableSize symbols in an empty table, then look up random ones.
+static SymbolScaleTimes runSymbolScale(size_t tableSize, size_t lookups)
+{
+  theSymbolTable().clear();
+  RandomScalarSource randSource;
+  std::vector<TextFragment> names;
+  names.reserve(tableSize);
+  for (size_t i = 0; i < tableSize; ++i)
+  {
+    names.emplace_back(textUtils::naturalNumberToText(i));
+  }
+
+  SymbolScaleTimes times;
+  std::vector<Symbol> symbols;
+  symbols.reserve(tableSize);
+  auto start = now();
+  for (const auto& name : names)
+  {
+    symbols.emplace_back(name.getText());
+  }
+  times.create = now() - start;
+  REQUIRE(theSymbolTable().getSize() == tableSize + 1);
+
+  std::vector<size_t> order(lookups);
+  for (auto& i : order)
+  {
+    i = static_cast<size_t>(randSource.getUInt32() % tableSize);
+  }
+
+  size_t errors{0};
+  start = now();
+  for (size_t i : order)
+  {
+    if (Symbol(names[i].getText()) != symbols[i]) errors++;
+  }
+  times.lookup = now() - start;
+  REQUIRE(errors == 0);
+  REQUIRE(theSymbolTable().audit());
+
+  symbols.clear();
+  theSymbolTable().clear();
+  return times;
+}
+
+TEST_CASE("madronalib/core/symbol/scale", "[symbol][scale]")
+{
+  // the table grows without rehashing everything at once, and lookups still
+  // find every symbol as it gets large.
+  for (size_t tableSize : {10000, 100000, 1000000})
+  {
+    runSymbolScale(tableSize, 1000000);
+  }
+}
+
+// run with the tag [benchmark] to see the results. Lookups should stay fast as
+// the table gets large.
+TEST_CASE("madronalib/core/symbol/scale/times", "[.][benchmark]")
+{
+  constexpr size_t kLookups = 1000000;
+  for (size_t tableSize : {10000, 100000, 1000000})
+  {
+    auto times = runSymbolScale(tableSize, kLookups);
+    std::cout << tableSize << " symbols: created in " << times.create.count() << "s, "
+              << kLookups / times.lookup.count() << " lookups/s\n";
+  }
 }
 
 const char letters[24] = "abcdefghjklmnopqrstuvw";
 
+TEST_CASE("madronalib/core/symbol/image", "[symbol][image]")
+{
+  theSymbolTable().clear();
+  std::vector<TextFragment> names;
+  for (int i = 0; i < 10000; ++i)
+  {
+    names.emplace_back(TextFragment("param/", textUtils::naturalNumberToText(i)));
+  }
+
+  // a long name that doesn't fit in a TextFragment's local storage.
+  names.emplace_back(TextFragment(letters, letters, letters, letters));
+
+  std::vector<SymbolID> ids;
+  for (const auto& name : names)
+  {
+    ids.push_back(Symbol(name.getText()).getID());
+  }
+  auto image = theSymbolTable().saveImage();
+  REQUIRE(!image.empty());
+
+  auto checkRestoredSymbols = [&]() {
+    REQUIRE(theSymbolTable().getSize() == names.size() + 1);
+    size_t errors{0};
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+      Symbol s(names[i].getText());
+      if (s.getID() != ids[i]) errors++;
+      if (s.getTextFragment() != names[i]) errors++;
+    }
+    REQUIRE(errors == 0);
+    REQUIRE(theSymbolTable().audit());
+    REQUIRE(Symbol() == Symbol(""));
+  };
+
+  // restore from memory.
+  theSymbolTable().clear();
+  REQUIRE(theSymbolTable().restoreImage(image.data(), image.size()));
+  checkRestoredSymbols();
+
+  // restore from a file.
+  const char* filePath = "symbolTest.img";
+  REQUIRE(theSymbolTable().saveImage(filePath));
+  theSymbolTable().clear();
+  REQUIRE(theSymbolTable().restoreImage(filePath));
+  checkRestoredSymbols();
+  std::remove(filePath);
+
+  // new symbols can be added after restoring.
+  Symbol newSym("not/in/the/image");
+  REQUIRE(newSym.getID() == names.size() + 1);
+
+  // bad images are rejected and leave the table unchanged.
+  size_t sizeBefore = theSymbolTable().getSize();
+  REQUIRE(!theSymbolTable().restoreImage(image.data(), image.size() - 1));
+  auto badImage = image;
+  badImage[0] = 'X';
+  REQUIRE(!theSymbolTable().restoreImage(badImage.data(), badImage.size()));
+  REQUIRE(!theSymbolTable().restoreImage("no/such/file.img"));
+  REQUIRE(theSymbolTable().getSize() == sizeBefore);
+
+  theSymbolTable().clear();
+}
+
+
 TEST_CASE("madronalib/core/symbol/maps", "[symbol]")
 {
   const int kMapSize = 100;
@@ -386,7 +631,7 @@ TEST_CASE("madronalib/core/symbol/path", "[symbol][path]")
                         b.getTextFragment());
   };
   TextFragment pa = std::accumulate(++p.begin(), p.end(),
-                                    (*p.begin()).getTextFragment(), accumTest);
+                                    TextFragment((*p.begin()).getTextFragment()), accumTest);
 
   Path a{"a"};
   Path b{"b"};
@@ -403,3 +648,75 @@ TEST_CASE("madronalib/core/symbol/path", "[symbol][path]")
   REQUIRE(!p.beginsWith(q));
   
 }
+
+TEST_CASE("madronalib/core/symbol/pathID", "[symbol][path][pathID]")
+{
+  // equal Paths have equal IDs, and the Paths are recovered.
+  Path p("hello/world/a/b/c");
+  PathID id(p);
+  REQUIRE(id == PathID(Path("hello/world/a/b/c")));
+  REQUIRE(id != PathID(Path("hello/world/a/b")));
+  REQUIRE(id.getPath() == p);
+  REQUIRE(id.getSize() == 5);
+  REQUIRE(!PathID());
+  REQUIRE(PathID().getPath() == Path());
+  REQUIRE(PathID(Path("hello/world")).getPath() == Path("hello/world"));
+
+  // a Path on either side is compared as a PathID.
+  REQUIRE(id == p);
+  REQUIRE(p == id);
+
+  // Paths with shared beginnings share nodes but not IDs.
+  PathID c1(Path("x/y/z"));
+  PathID c2(Path("x/y/w"));
+  REQUIRE(c1 != c2);
+  REQUIRE(c1.getPath() == Path("x/y/z"));
+  REQUIRE(c2.getPath() == Path("x/y/w"));
+
+  // find() looks up Paths without adding them.
+  REQUIRE(PathID::find(Path("x/y/z")) == c1);
+  REQUIRE(PathID::find(Path()) == PathID());
+  size_t tableSize = thePathTable().getSize();
+  REQUIRE(!PathID::find(Path("x/y/not/added")));
+  REQUIRE(!PathID::find(Path("not/added")));
+  REQUIRE(thePathTable().getSize() == tableSize);
+
+  // many Paths added from several threads at once get consistent IDs.
+  constexpr int kThreads = 4;
+  constexpr int kPaths = 20000;
+  std::vector<std::vector<PathID> > ids(kThreads, std::vector<PathID>(kPaths));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t)
+  {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < kPaths; ++i)
+      {
+        ids[t][i] = PathID(Path(Path("ids"), Path(textUtils::naturalNumberToText(i % 100)),
+                                Path(textUtils::naturalNumberToText(i))));
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  int errors{0};
+  for (int i = 0; i < kPaths; ++i)
+  {
+    for (int t = 1; t < kThreads; ++t)
+    {
+      if (ids[t][i] != ids[0][i]) errors++;
+    }
+    Path expected(Path("ids"), Path(textUtils::naturalNumberToText(i % 100)),
+                  Path(textUtils::naturalNumberToText(i)));
+    if (ids[0][i].getPath() != expected) errors++;
+  }
+  REQUIRE(errors == 0);
+
+  // Messages and Trees can use PathIDs.
+  Message m(id, 3.f);
+  REQUIRE(m.address == p);
+  REQUIRE(m.getAddressPath() == p);
+  Tree<Value> t;
+  t[p] = 4.f;
+  REQUIRE(t[m.address] == Value(4.f));
+  t[PathID(Path("hello/there"))] = 5.f;
+  REQUIRE(t["hello/there"] == Value(5.f));
+}
@@ -4,9 +4,12 @@
 
 // a unit test made using the Catch framework in catch.hpp / tests.cpp.
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <numeric>
 #include <thread>
@@ -20,6 +23,15 @@
 
 using namespace ml;
 
+// a xorshift generator, so that the random inputs are the same on every run.
+static uint32_t nextRandom(uint32_t& seed)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
 TEST_CASE("madronalib/core/text", "[text]")
 {
   const char* kobayashi("\xE5\xB0\x8F\xE6\x9E\x97\x20\xE5\xB0\x8A");
@@ -67,3 +79,620 @@ TEST_CASE("madronalib/core/text", "[text]")
   REQUIRE(textUtils::stripExtension(footxt) == "foo");
   REQUIRE(textUtils::getExtension(footxt) == "txt");
 }
+
+TEST_CASE("madronalib/core/text/utf8", "[text][utf8]")
+{
+  const char* kobayashi("\xE5\xB0\x8F\xE6\x9E\x97\x20\xE5\xB0\x8A");
+
+  // long enough that both the block and the remainder code paths are used.
+  TextFragment ascii("the quick brown fox jumps over the lazy dog/0123456789");
+  TextFragment mixed("preset/", kobayashi, "/the quick brown fox/\xF0\x9F\x8E\xB9/end");
+
+  for (const auto& t : {ascii, mixed})
+  {
+    // the iterator and the code point count agree with the utf library.
+    auto codePoints = textToCodePoints(t);
+    REQUIRE(t.lengthInCodePoints() == codePoints.size());
+    REQUIRE(codePointsToText(codePoints) == t);
+    REQUIRE(validateUTF8(t.getText(), t.lengthInBytes()));
+
+    // the text utilities give the same results with and without the ASCII fast
+    // paths.
+    auto slash = std::find(codePoints.begin(), codePoints.end(), '/') - codePoints.begin();
+    REQUIRE(textUtils::findFirst(t, '/') == slash);
+    REQUIRE(textUtils::findFirst(t, 'Z') == -1);
+    REQUIRE(textUtils::subText(t, 2, 12) ==
+            codePointsToText(std::vector<CodePoint>(codePoints.begin() + 2,
+                                                    codePoints.begin() + 12)));
+    auto upper = textUtils::map(t, [](CodePoint c) { return (c == 'o') ? CodePoint('O') : c; });
+    REQUIRE(upper.lengthInCodePoints() == codePoints.size());
+    REQUIRE(textUtils::findFirst(upper, 'o') == -1);
+  }
+
+  REQUIRE(isASCII(ascii.getText(), ascii.lengthInBytes()));
+  REQUIRE(!isASCII(mixed.getText(), mixed.lengthInBytes()));
+  REQUIRE(textUtils::findLast(ascii, 'o') == 41);
+  REQUIRE(textUtils::split(ascii, ' ').size() == 9);
+  REQUIRE(textUtils::split(mixed, '/').size() == 5);
+  REQUIRE(textUtils::split(mixed, '/')[1] == TextFragment(kobayashi));
+
+  // invalid UTF-8: a lone continuation byte, an overlong encoding, a surrogate,
+  // a code point above U+10FFFF, and a truncated sequence at the end.
+  std::vector<std::string> invalid{"abc\x80", "\xC0\xAF", "ab\xED\xA0\x80" "cd",
+                                   "\xF4\x90\x80\x80", "0123456789abcdef\xE5\xB0"};
+  for (const auto& s : invalid)
+  {
+    REQUIRE(!validateUTF8(s.data(), s.size()));
+  }
+
+  // iterating a view that ends with a truncated sequence stops at the end of the
+  // view, even though the text continues with the rest of the sequence.
+  const char* truncatedText("ab\xE5\xB0\x8F");
+  TextView truncated(truncatedText, 4);
+  std::vector<CodePoint> truncatedCodePoints;
+  auto it = truncated.begin();
+  for (; it != truncated.end(); ++it)
+  {
+    truncatedCodePoints.push_back(*it);
+  }
+  REQUIRE(it.getPosition() == truncatedText + 4);
+  REQUIRE(truncatedCodePoints == (std::vector<CodePoint>{'a', 'b', 0xE5}));
+  REQUIRE(truncated.lengthInCodePoints() == 3);
+  TextView tail = textUtils::subText(truncated, 1, 10);
+  REQUIRE(tail.getText() == truncatedText + 1);
+  REQUIRE(tail.lengthInBytes() == 3);
+}
+
+TEST_CASE("madronalib/core/text/view", "[text][view]")
+{
+  const char* kobayashi("\xE5\xB0\x8F\xE6\x9E\x97\x20\xE5\xB0\x8A");
+  TextFragment path("  presets/", kobayashi, "/bass.mlpreset \t");
+  TextView pathView(path);
+  auto inPath = [&](TextView v) {
+    return (v.getText() >= path.getText()) &&
+           (v.getText() + v.lengthInBytes() <= path.getText() + path.lengthInBytes());
+  };
+
+  // the view utilities return views of the original text with the same contents
+  // as the TextFragment utilities.
+  TextView stripped = textUtils::stripWhitespaceAtEnds(pathView);
+  REQUIRE(inPath(stripped));
+  REQUIRE(stripped == textUtils::stripWhitespaceAtEnds(path));
+
+  TextView name = textUtils::getShortFileName(stripped);
+  REQUIRE(inPath(name));
+  REQUIRE(name == "bass.mlpreset");
+  REQUIRE(textUtils::getExtension(name) == "mlpreset");
+  REQUIRE(textUtils::stripExtension(name) == "bass");
+  REQUIRE(textUtils::getPath(stripped) == textUtils::getPath(TextFragment(stripped)));
+  REQUIRE(textUtils::subText(stripped, 8, 12) == TextFragment(kobayashi));
+
+  auto pieces = textUtils::split(stripped, '/');
+  auto fragmentPieces = textUtils::split(TextFragment(stripped), '/');
+  REQUIRE(pieces.size() == 3);
+  for (size_t i = 0; i < pieces.size(); ++i)
+  {
+    REQUIRE(inPath(pieces[i]));
+    REQUIRE(pieces[i] == fragmentPieces[i]);
+  }
+
+  TextFragment items("1/2/4/8/16");
+  auto itemViews = textUtils::split(TextView(items), '/');
+  REQUIRE(textUtils::textToNaturalNumber(itemViews[4]) == 16);
+}
+
+TEST_CASE("madronalib/core/text/numbers", "[text][numbers]")
+{
+  uint32_t seed = 0x12345678;
+  auto bitsOf = [](float f) {
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+  };
+  auto roundTrips = [&](float f) {
+    char buf[textUtils::kMaxFloatTextLength];
+    char* pEnd = textUtils::writeFloatNumber(f, buf);
+    float g{0};
+    bool readAll = (textUtils::readFloatNumber(buf, pEnd, g) == pEnd);
+    bool inLength = (pEnd - buf <= static_cast<ptrdiff_t>(textUtils::kMaxFloatTextLength));
+    return readAll && inLength && (bitsOf(f) == bitsOf(g));
+  };
+
+  // edge cases round trip exactly.
+  std::vector<float> edges{0.f,
+                           -0.f,
+                           1.f,
+                           -1.f,
+                           0.1f,
+                           1e-5f,
+                           123456789.f,
+                           1e9f,
+                           16777216.f,
+                           std::numeric_limits<float>::min(),
+                           std::numeric_limits<float>::denorm_min(),
+                           std::numeric_limits<float>::max(),
+                           -std::numeric_limits<float>::max(),
+                           std::numeric_limits<float>::infinity(),
+                           -std::numeric_limits<float>::infinity()};
+  for (float f : edges)
+  {
+    REQUIRE(roundTrips(f));
+  }
+  REQUIRE(std::isnan(textUtils::textToFloatNumber(textUtils::floatNumberToText(NAN))));
+
+  // random bit patterns round trip exactly.
+  int failures{0};
+  for (int i = 0; i < 200000; ++i)
+  {
+    uint32_t u = nextRandom(seed);
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    if (std::isnan(f)) continue;
+    if (!roundTrips(f)) failures++;
+  }
+  REQUIRE(failures == 0);
+
+  // the text is the shortest that round trips.
+  int longer{0};
+  for (int i = 0; i < 10000; ++i)
+  {
+    uint32_t u = nextRandom(seed) & 0x7fffffff;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    if (!std::isfinite(f) || (f == 0.f)) continue;
+    char buf[textUtils::kMaxFloatTextLength];
+    char* pEnd = textUtils::writeFloatNumber(f, buf);
+    int digits = static_cast<int>(std::count_if(buf, pEnd, [](char c) { return isdigit(c); }));
+    const char* pE = std::find(buf, pEnd, 'e');
+    if (pE != pEnd) digits -= static_cast<int>(pEnd - pE - 2);
+    int shortest = 1;
+    char printed[32];
+    for (; shortest < 9; ++shortest)
+    {
+      snprintf(printed, sizeof(printed), "%.*g", shortest, f);
+      if (strtof(printed, nullptr) == f) break;
+    }
+    // leading and trailing zeros in decimal notation are not significant.
+    std::string s(buf, pEnd);
+    if (pE == pEnd)
+    {
+      s.erase(std::remove(s.begin(), s.end(), '.'), s.end());
+      s.erase(0, s.find_first_not_of('0'));
+      s.erase(s.find_last_not_of('0') + 1);
+      digits = static_cast<int>(s.size());
+    }
+    if (digits > shortest) longer++;
+  }
+  REQUIRE(longer == 0);
+
+  // parsing matches strtof.
+  int mismatches{0};
+  for (int i = 0; i < 100000; ++i)
+  {
+    char text[32];
+    int digits = 1 + nextRandom(seed) % 12;
+    int exponent = static_cast<int>(nextRandom(seed) % 90) - 50;
+    uint64_t mantissa = 0;
+    for (int j = 0; j < digits; ++j)
+    {
+      mantissa = mantissa * 10 + nextRandom(seed) % 10;
+    }
+    snprintf(text, sizeof(text), "%llue%d", static_cast<unsigned long long>(mantissa), exponent);
+    float f = textUtils::textToFloatNumber(TextView(text, strlen(text)));
+    if (bitsOf(f) != bitsOf(strtof(text, nullptr))) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+
+  // batch conversion.
+  constexpr size_t kBatchSize = 1000;
+  std::vector<float> src(kBatchSize), dest(kBatchSize + 1);
+  for (auto& f : src)
+  {
+    f = (nextRandom(seed) % 2000000) * 0.001f - 1000.f;
+  }
+  std::vector<char> batchText(kBatchSize * (textUtils::kMaxFloatTextLength + 1));
+  char* pEnd = textUtils::floatNumbersToText(src.data(), kBatchSize, batchText.data());
+  TextView batchView(batchText.data(), pEnd - batchText.data());
+  REQUIRE(textUtils::textToFloatNumbers(batchView, dest.data(), dest.size()) == kBatchSize);
+  REQUIRE(std::equal(src.begin(), src.end(), dest.begin()));
+  REQUIRE(textUtils::textToFloatNumbers(TextView("1, -2.5,3e2", 11), dest.data(), 2) == 2);
+  REQUIRE(dest[1] == -2.5f);
+
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/text/numbers/throughput", "[.][benchmark]")
+{
+  constexpr size_t kBatchSize = 1000;
+  std::vector<float> src(kBatchSize), dest(kBatchSize + 1);
+  uint32_t seed = 0x12345678;
+  for (auto& f : src)
+  {
+    f = (nextRandom(seed) % 2000000) * 0.001f - 1000.f;
+  }
+  std::vector<char> batchText(kBatchSize * (textUtils::kMaxFloatTextLength + 1));
+
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t totalFloats{0};
+  for (int i = 0; i < 100; ++i)
+  {
+    char* pEnd = textUtils::floatNumbersToText(src.data(), kBatchSize, batchText.data());
+    TextView batchView(batchText.data(), pEnd - batchText.data());
+    totalFloats += textUtils::textToFloatNumbers(batchView, dest.data(), dest.size());
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = end - start;
+  REQUIRE(totalFloats == 100 * kBatchSize);
+  std::cout << totalFloats / elapsed.count() << " float round trips per second\n";
+}
+
+namespace base64Reference
+{
+// the previous byte-at-a-time implementation, for comparison.
+static constexpr char kTable[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/="};
+
+std::vector<char> encode(const std::vector<uint8_t>& in)
+{
+  std::vector<char> out;
+  int val = 0, valb = -6;
+  for (uint8_t c : in)
+  {
+    val = (val << 8) + c;
+    valb += 8;
+    while (valb >= 0)
+    {
+      out.push_back(kTable[(val >> valb) & 0x3F]);
+      valb -= 6;
+    }
+  }
+  if (valb > -6) out.push_back(kTable[((val << 8) >> (valb + 8)) & 0x3F]);
+  while (out.size() % 4) out.push_back('=');
+  return out;
+}
+
+std::vector<uint8_t> decode(const std::vector<char>& in)
+{
+  std::vector<int> T(256, -1);
+  for (int i = 0; i < 64; i++) T[kTable[i]] = i;
+  std::vector<uint8_t> out;
+  int val = 0, valb = -8;
+  for (uint8_t c : in)
+  {
+    if (T[c] == -1) break;
+    val = (val << 6) + T[c];
+    valb += 6;
+    if (valb >= 0)
+    {
+      out.push_back(char((val >> valb) & 0xFF));
+      valb -= 8;
+    }
+  }
+  return out;
+}
+}  // namespace base64Reference
+
+TEST_CASE("madronalib/core/text/base64", "[text][base64]")
+{
+  uint32_t seed = 0x9e3779b9;
+  auto randomBytes = [&](size_t n) {
+    std::vector<uint8_t> v(n);
+    for (auto& b : v) b = static_cast<uint8_t>(nextRandom(seed));
+    return v;
+  };
+
+  // all sizes up to a few SIMD blocks match the reference.
+  for (size_t n = 0; n < 300; ++n)
+  {
+    auto data = randomBytes(n);
+    auto expected = base64Reference::encode(data);
+    std::vector<char> text(textUtils::base64EncodedLength(n));
+    char* pTextEnd = textUtils::base64Encode(data.data(), n, text.data());
+    REQUIRE(std::vector<char>(text.data(), pTextEnd) == expected);
+
+    std::vector<uint8_t> decoded(textUtils::base64MaxDecodedLength(text.size()));
+    uint8_t* pEnd = textUtils::base64Decode(text.data(), text.size(), decoded.data());
+    REQUIRE(std::vector<uint8_t>(decoded.data(), pEnd) == data);
+  }
+  REQUIRE(textUtils::base64Encode(std::vector<uint8_t>{'h', 'i', '!', '?'}) == "aGkhPw==");
+  REQUIRE(textUtils::base64Decode(TextFragment("aGkhPw==")).size() == 4);
+
+  // streaming in random chunk sizes gives the same results.
+  auto data = randomBytes(100000);
+  auto expected = base64Reference::encode(data);
+  std::vector<char> text(textUtils::base64EncodedLength(data.size()));
+  textUtils::Base64Encoder encoder;
+  char* pText = text.data();
+  for (size_t i = 0; i < data.size();)
+  {
+    size_t chunk = std::min(size_t(nextRandom(seed) % 200), data.size() - i);
+    pText = encoder.write(data.data() + i, chunk, pText);
+    i += chunk;
+  }
+  pText = encoder.finish(pText);
+  REQUIRE(std::vector<char>(text.data(), pText) == expected);
+
+  std::vector<uint8_t> decoded(textUtils::base64MaxDecodedLength(text.size()));
+  textUtils::Base64Decoder decoder;
+  uint8_t* pDecoded = decoded.data();
+  for (size_t i = 0; i < text.size();)
+  {
+    size_t chunk = std::min(size_t(nextRandom(seed) % 200), text.size() - i);
+    pDecoded = decoder.write(text.data() + i, chunk, pDecoded);
+    i += chunk;
+  }
+  pDecoded = decoder.finish(pDecoded);
+  REQUIRE(decoder.isDone());
+  REQUIRE(std::vector<uint8_t>(decoded.data(), pDecoded) == data);
+
+  // whitespace is skipped, and decoding stops at other chars.
+  std::vector<char> wrapped;
+  for (size_t i = 0; i < text.size(); ++i)
+  {
+    if (i && (i % 76 == 0)) wrapped.push_back('\n');
+    wrapped.push_back(text[i]);
+  }
+  pDecoded = textUtils::base64Decode(wrapped.data(), wrapped.size(), decoded.data());
+  REQUIRE(std::vector<uint8_t>(decoded.data(), pDecoded) == data);
+
+  text[4000] = '*';
+  pDecoded = textUtils::base64Decode(text.data(), text.size(), decoded.data());
+  REQUIRE(pDecoded - decoded.data() == 3000);
+  REQUIRE(std::equal(decoded.data(), pDecoded, data.begin()));
+  text[4000] = expected[4000];
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/text/base64/throughput", "[.][benchmark]")
+{
+  uint32_t seed = 0x9e3779b9;
+  std::vector<uint8_t> data(1 << 20);
+  for (auto& b : data)
+  {
+    b = static_cast<uint8_t>(nextRandom(seed));
+  }
+  std::vector<char> text(textUtils::base64EncodedLength(data.size()));
+  std::vector<uint8_t> decoded(textUtils::base64MaxDecodedLength(text.size()));
+
+  // throughput compared to the previous implementation.
+  constexpr int kPasses{10};
+  auto start = std::chrono::high_resolution_clock::now();
+  size_t referenceBytes{0};
+  for (int i = 0; i < kPasses; ++i)
+  {
+    referenceBytes += base64Reference::decode(base64Reference::encode(data)).size();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> referenceTime = end - start;
+
+  start = std::chrono::high_resolution_clock::now();
+  size_t bytes{0};
+  for (int i = 0; i < kPasses; ++i)
+  {
+    char* pText = textUtils::base64Encode(data.data(), data.size(), text.data());
+    bytes += textUtils::base64Decode(text.data(), pText - text.data(), decoded.data()) -
+             decoded.data();
+  }
+  end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> time = end - start;
+  REQUIRE(bytes == referenceBytes);
+  REQUIRE(std::equal(data.begin(), data.end(), decoded.begin()));
+
+  constexpr double kMB = 1 << 20;
+  std::cout << "base64 round trip: " << bytes / referenceTime.count() / kMB << " MB/s before, "
+            << bytes / time.count() / kMB << " MB/s now\n";
+}
+
+TEST_CASE("madronalib/core/text/aes", "[text][aes]")
+{
+  auto fromHex = [](const char* hex) {
+    std::vector<uint8_t> v;
+    for (; hex[0] && hex[1]; hex += 2)
+    {
+      v.push_back(static_cast<uint8_t>(std::stoi(std::string(hex, 2), nullptr, 16)));
+    }
+    return v;
+  };
+
+  // test vectors from NIST SP 800-38A, F.2.5.
+  auto key = fromHex("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4");
+  auto iv = fromHex("000102030405060708090a0b0c0d0e0f");
+  auto plaintext = fromHex(
+      "6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+      "30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710");
+  auto ciphertext = fromHex(
+      "f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"
+      "39f23369a9d9bacfa530e26304231461b2eb05e2c39be9fcda6c19078c6a9d1b");
+
+  std::vector<uint8_t> data(plaintext);
+  data.resize(textUtils::AES256CBCEncodedLength(plaintext.size()));
+  REQUIRE(textUtils::AES256CBCEncodeInPlace(data.data(), plaintext.size(), key.data(),
+                                            iv.data()) == data.size());
+  REQUIRE(std::equal(ciphertext.begin(), ciphertext.end(), data.begin()));
+  REQUIRE(textUtils::AES256CBCDecodeInPlace(data.data(), data.size(), key.data(), iv.data()) ==
+          plaintext.size());
+  REQUIRE(std::equal(plaintext.begin(), plaintext.end(), data.begin()));
+
+  // the vector functions round trip all sizes.
+  uint32_t seed = 0x2545f491;
+  std::vector<uint8_t> longIV(32, 'a');
+  for (size_t n = 1; n < 100; ++n)
+  {
+    std::vector<uint8_t> v(n);
+    for (auto& b : v) b = static_cast<uint8_t>(nextRandom(seed));
+    auto encoded = textUtils::AES256CBCEncode(v, key, longIV);
+    REQUIRE(encoded.size() == textUtils::AES256CBCEncodedLength(n));
+    REQUIRE(textUtils::AES256CBCDecode(encoded, key, longIV) == v);
+  }
+
+  // streaming in random chunk sizes gives the same results.
+  std::vector<uint8_t> content(100000);
+  for (auto& b : content) b = static_cast<uint8_t>(nextRandom(seed));
+  std::vector<uint8_t> encrypted(textUtils::AES256CBCEncodedLength(content.size()));
+  textUtils::AES256CBCEncoder encoder(key.data(), iv.data());
+  std::vector<uint8_t> chunk(256 + 15);
+  uint8_t* pEncrypted = encrypted.data();
+  for (size_t i = 0; i < content.size();)
+  {
+    size_t n = std::min(size_t(nextRandom(seed) % 256), content.size() - i);
+    uint8_t* pEnd = encoder.write(content.data() + i, n, chunk.data());
+    pEncrypted = std::copy(chunk.data(), pEnd, pEncrypted);
+    i += n;
+  }
+  pEncrypted = encoder.finish(pEncrypted);
+  REQUIRE(pEncrypted == encrypted.data() + encrypted.size());
+
+  std::vector<uint8_t> oneShot(content);
+  oneShot.resize(encrypted.size());
+  textUtils::AES256CBCEncodeInPlace(oneShot.data(), content.size(), key.data(), iv.data());
+  REQUIRE(oneShot == encrypted);
+
+  std::vector<uint8_t> decrypted(encrypted.size());
+  textUtils::AES256CBCDecoder decoder(key.data(), iv.data());
+  uint8_t* pDecrypted = decrypted.data();
+  for (size_t i = 0; i < encrypted.size();)
+  {
+    size_t n = std::min(size_t(nextRandom(seed) % 256), encrypted.size() - i);
+    uint8_t* pEnd = decoder.write(encrypted.data() + i, n, chunk.data());
+    pDecrypted = std::copy(chunk.data(), pEnd, pDecrypted);
+    i += n;
+  }
+  pDecrypted = decoder.finish(pDecrypted);
+  decrypted.resize(pDecrypted - decrypted.data());
+  REQUIRE(decrypted == content);
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/text/aes/throughput", "[.][benchmark]")
+{
+  std::vector<uint8_t> key(32), iv(16);
+  std::iota(key.begin(), key.end(), uint8_t(0));
+  std::iota(iv.begin(), iv.end(), uint8_t(0x80));
+  uint32_t seed = 0x2545f491;
+  std::vector<uint8_t> content(1 << 20);
+  for (auto& b : content)
+  {
+    b = static_cast<uint8_t>(nextRandom(seed));
+  }
+  std::vector<uint8_t> data(content);
+  data.resize(textUtils::AES256CBCEncodedLength(content.size()));
+  textUtils::AES256CBCEncodeInPlace(data.data(), content.size(), key.data(), iv.data());
+
+  // each pass decrypts the data, then encrypts it again for the next pass.
+  constexpr int kPasses{10};
+  std::chrono::duration<double> decryptTime{0}, encryptTime{0};
+  size_t bytes{0};
+  for (int i = 0; i < kPasses; ++i)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    bytes += textUtils::AES256CBCDecodeInPlace(data.data(), data.size(), key.data(), iv.data());
+    auto middle = std::chrono::high_resolution_clock::now();
+    textUtils::AES256CBCEncodeInPlace(data.data(), content.size(), key.data(), iv.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    decryptTime += middle - start;
+    encryptTime += end - middle;
+  }
+  REQUIRE(bytes == kPasses * content.size());
+  REQUIRE(textUtils::AES256CBCDecodeInPlace(data.data(), data.size(), key.data(), iv.data()) ==
+          content.size());
+  REQUIRE(std::equal(content.begin(), content.end(), data.begin()));
+
+  constexpr double kMB = 1 << 20;
+  std::cout << "AES256 CBC: " << bytes / decryptTime.count() / kMB << " MB/s decrypted, "
+            << bytes / encryptTime.count() / kMB << " MB/s encrypted\n";
+}
+
+// random names made of pieces that sort differently by code point and by collation.
+static std::vector<TextFragment> makeCollationTestNames(size_t n, uint32_t& seed)
+{
+  const std::vector<const char*> pieces{"a", "B", "b", "Z", "z", "0", "9", " ", "-", "_",
+                                        "\xC3\xA9", "\xC3\x89", "\xC3\xBC", "\xE5\xB0\x8F",
+                                        "\xE6\x9E\x97", "\xF0\x9F\x8E\xB9"};
+  std::vector<TextFragment> names;
+  for (size_t i = 0; i < n; ++i)
+  {
+    std::string s;
+    size_t length = 1 + nextRandom(seed) % 12;
+    for (size_t j = 0; j < length; ++j)
+    {
+      s += pieces[nextRandom(seed) % pieces.size()];
+    }
+    names.emplace_back(s.c_str());
+  }
+  return names;
+}
+
+TEST_CASE("madronalib/core/text/collation", "[text][collation]")
+{
+  uint32_t seed = 0x6b43a9b5;
+  auto names = makeCollationTestNames(20000, seed);
+
+  // keys compare like collate().
+  std::vector<uint8_t> keyA(64), keyB(64);
+  int mismatches{0};
+  for (int i = 0; i < 10000; ++i)
+  {
+    const TextFragment& a = names[nextRandom(seed) % names.size()];
+    const TextFragment& b = names[nextRandom(seed) % names.size()];
+    uint8_t* pEndA = textUtils::writeCollationKey(a, keyA.data());
+    uint8_t* pEndB = textUtils::writeCollationKey(b, keyB.data());
+    bool keyLess = std::lexicographical_compare(keyA.data(), pEndA, keyB.data(), pEndB);
+    if (keyLess != textUtils::collate(a, b)) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+
+  // sorting by keys, in one or more threads, gives the same order as collate().
+  auto byCollate(names);
+  std::sort(byCollate.begin(), byCollate.end(),
+            [](const TextFragment& a, const TextFragment& b) { return textUtils::collate(a, b); });
+  auto byKeys(names);
+  textUtils::sortByCollation(byKeys);
+  auto byKeysInThreads(names);
+  textUtils::sortByCollation(byKeysInThreads, 4);
+  REQUIRE(byKeys == byCollate);
+  REQUIRE(byKeysInThreads == byCollate);
+
+  // views compare like fragments, and Symbols are compared without copying their text.
+  REQUIRE(textUtils::collate(TextView("a", 1), TextView("B", 1)));
+  REQUIRE(!textUtils::collate(TextView("ab", 2), TextView("a", 1)));
+  REQUIRE(textUtils::SymbolCollator()(Symbol("a long symbol name 1"), Symbol("A long symbol name 2")));
+  REQUIRE(textUtils::stripFinalNumber(Symbol("a long symbol name 123")) ==
+          Symbol("a long symbol name "));
+  REQUIRE(textUtils::getFinalNumber(Symbol("a long symbol name 123")) == 123);
+
+  std::vector<Symbol> symbols{"b", "A", "a", "\xE5\xB0\x8F", "B"};
+  textUtils::sortByCollation(symbols);
+  std::vector<Symbol> expected{"a", "A", "b", "B", "\xE5\xB0\x8F"};
+  REQUIRE(symbols == expected);
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/text/collation/sort", "[.][benchmark]")
+{
+  uint32_t seed = 0x6b43a9b5;
+  auto names = makeCollationTestNames(200000, seed);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  auto byCollate(names);
+  std::sort(byCollate.begin(), byCollate.end(),
+            [](const TextFragment& a, const TextFragment& b) { return textUtils::collate(a, b); });
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> collateTime = end - start;
+
+  start = std::chrono::high_resolution_clock::now();
+  auto byKeys(names);
+  textUtils::sortByCollation(byKeys);
+  end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> keyTime = end - start;
+
+  start = std::chrono::high_resolution_clock::now();
+  auto byKeysInThreads(names);
+  textUtils::sortByCollation(byKeysInThreads, 4);
+  end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> threadedKeyTime = end - start;
+
+  REQUIRE(byKeys == byCollate);
+  REQUIRE(byKeysInThreads == byCollate);
+  std::cout << "sorting " << names.size() << " names: collate " << collateTime.count()
+            << "s, keys " << keyTime.count() << "s, keys in 4 threads "
+            << threadedKeyTime.count() << "s\n";
+}
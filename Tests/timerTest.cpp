@@ -4,9 +4,11 @@
 
 // a unit test made using the Catch framework in catch.hpp / tests.cpp.
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -114,3 +116,169 @@ TEST_CASE("madronalib/core/timer/basic", "[timer][basic]")
   system("pause");
 #endif
 }
+
+TEST_CASE("madronalib/core/timer/wheel", "[timer][wheel]")
+{
+  SharedResourcePointer<ml::Timers> t;
+  t->start();
+
+  // timers long enough to be put in the upper levels of the wheel and cascaded
+  // down should never be called early.
+  constexpr int kTimers{8};
+  std::atomic<int> called{0};
+  std::atomic<int> early{0};
+  std::vector<std::unique_ptr<Timer> > v;
+  for (int i = 0; i < kTimers; ++i)
+  {
+    v.emplace_back(std::unique_ptr<Timer>(new Timer));
+    auto period = milliseconds(100 + 50 * i);
+    auto startTime = steady_clock::now();
+    v[i]->callOnce(
+        [&, period, startTime]() {
+          if (steady_clock::now() - startTime < period) early++;
+          called++;
+        },
+        period);
+  }
+
+  // a timer that stops itself after three calls, and one that deletes itself.
+  int selfStopCount{0};
+  Timer selfStopper;
+  selfStopper.start(
+      [&]() {
+        if (++selfStopCount == 3) selfStopper.stop();
+      },
+      milliseconds(5));
+  std::unique_ptr<Timer> pSelfDeleter(new Timer);
+  pSelfDeleter->callNTimes([&]() { pSelfDeleter.reset(); }, milliseconds(5), 10);
+
+  auto deadline = steady_clock::now() + seconds(5);
+  while ((called < kTimers) && (steady_clock::now() < deadline))
+  {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  REQUIRE(called == kTimers);
+  REQUIRE(early == 0);
+  REQUIRE(!selfStopper.isActive());
+  REQUIRE(selfStopCount == 3);
+  REQUIRE(pSelfDeleter == nullptr);
+
+  // stopping a timer before it expires means it is never called.
+  bool stoppedCalled{false};
+  Timer stopped;
+  stopped.callOnce([&]() { stoppedCalled = true; }, milliseconds(20));
+  stopped.stop();
+  std::this_thread::sleep_for(milliseconds(50));
+  REQUIRE(!stoppedCalled);
+}
+
+TEST_CASE("madronalib/core/timer/threads", "[timer][threads]")
+{
+  SharedResourcePointer<ml::Timers> t;
+  t->start();
+
+  // a slow callback.
+  std::atomic<bool> inCallback{false};
+  std::atomic<bool> callbackDone{false};
+  Timer slow;
+  slow.callOnce(
+      [&]() {
+        inCallback = true;
+        std::this_thread::sleep_for(milliseconds(200));
+        callbackDone = true;
+      },
+      milliseconds(5));
+  while (!inCallback) std::this_thread::yield();
+
+  // while it runs, other timers can be started and stopped without waiting for it.
+  auto startTime = steady_clock::now();
+  Timer other;
+  other.start([]() {}, milliseconds(10));
+  other.stop();
+  REQUIRE(steady_clock::now() - startTime < milliseconds(100));
+  REQUIRE(!callbackDone);
+
+  // stopping the slow timer waits for its callback to finish.
+  slow.stop();
+  REQUIRE(callbackDone);
+
+  // a timer in the upper levels of the wheel is called on time after the run
+  // thread sleeps through the ticks before it.
+  std::atomic<bool> longCalled{false};
+  Timer longTimer;
+  startTime = steady_clock::now();
+  longTimer.callOnce([&]() { longCalled = true; }, milliseconds(600));
+  while (!longCalled && (steady_clock::now() - startTime < seconds(5)))
+  {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  auto elapsed = steady_clock::now() - startTime;
+  REQUIRE(longCalled);
+  REQUIRE(elapsed >= milliseconds(600));
+  REQUIRE(elapsed < milliseconds(1000));
+}
+
+struct ManyTimersTimes
+{
+  nanoseconds insert;
+  nanoseconds tick;
+  nanoseconds stop;
+};
+
+// start and stop kTimers timers with periods long enough that none will be
+// called, ticking kTicks times in between.
+static ManyTimersTimes runManyTimers(int kTimers, int kTicks)
+{
+  SharedResourcePointer<ml::Timers> t;
+  t->start();
+  size_t initialSize = t->getSize();
+
+  std::vector<std::unique_ptr<Timer> > v;
+  v.reserve(kTimers);
+  for (int i = 0; i < kTimers; ++i)
+  {
+    v.emplace_back(std::unique_ptr<Timer>(new Timer));
+  }
+
+  ManyTimersTimes times;
+  auto startTime = steady_clock::now();
+  for (int i = 0; i < kTimers; ++i)
+  {
+    v[i]->start([]() {}, seconds(100) + milliseconds(i));
+  }
+  times.insert = duration_cast<nanoseconds>(steady_clock::now() - startTime);
+  REQUIRE(t->getSize() == initialSize + kTimers);
+
+  startTime = steady_clock::now();
+  for (int i = 0; i < kTicks; ++i)
+  {
+    t->tick();
+    std::this_thread::sleep_for(t->getResolution());
+  }
+  times.tick = duration_cast<nanoseconds>(steady_clock::now() - startTime);
+
+  startTime = steady_clock::now();
+  for (int i = 0; i < kTimers; ++i)
+  {
+    v[i]->stop();
+  }
+  times.stop = duration_cast<nanoseconds>(steady_clock::now() - startTime);
+  REQUIRE(t->getSize() == initialSize);
+  return times;
+}
+
+TEST_CASE("madronalib/core/timer/many", "[timer][many]") { runManyTimers(100000, 100); }
+
+// run with the tag [benchmark] to see the results. Ticking should not depend
+// on the number of active timers.
+TEST_CASE("madronalib/core/timer/many/times", "[.][benchmark]")
+{
+  constexpr int kTicks{100};
+  for (int timers : {1000, 100000})
+  {
+    auto times = runManyTimers(timers, kTicks);
+    std::cout << timers << " timers: insert " << times.insert.count() / timers << "ns, stop "
+              << times.stop.count() / timers << "ns, " << kTicks << " ticks + sleeps "
+              << duration_cast<milliseconds>(times.tick).count() << "ms\n";
+  }
+}
@@ -4,6 +4,7 @@
 
 // a unit test made using the Catch framework in catch.hpp / tests.cpp.
 
+#include <chrono>
 #include <iostream>
 #include <limits>
 #include <map>
@@ -13,6 +14,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "MLParameterTable.h"
+#include "MLParameters.h"
 #include "MLSerialization.h"
 #include "MLTextUtils.h"
 #include "MLTree.h"
@@ -342,7 +345,489 @@ TEST_CASE("madronalib/core/tree", "[tree]")
   REQUIRE(floatTree["purple"] == 0.f);
   floatTree["pink"] = 1.f;
   REQUIRE(floatTree["pink"] == 1.f);
-  
+
+  // erase a node with its children, and the empty nodes above it
+  Tree< Value > eraseTree;
+  eraseTree["a/b/c"] = 1;
+  eraseTree["a/b/d"] = 2;
+  eraseTree["a/e"] = 3;
+  eraseTree["f/g/h"] = 4;
+  eraseTree.erase("a/b/c");
+  REQUIRE(eraseTree.size() == 3);
+  REQUIRE(!treeNodeExists(eraseTree, "a/b/c"));
+  REQUIRE(eraseTree["a/b/d"] == 2);
+  eraseTree.erase("a/b");
+  REQUIRE(!treeNodeExists(eraseTree, "a/b"));
+  REQUIRE(eraseTree["a/e"] == 3);
+  eraseTree.erase("f/g/h");
+  REQUIRE(!treeNodeExists(eraseTree, "f"));
+  eraseTree.erase("not/there");
+  REQUIRE(eraseTree.size() == 1);
+  eraseTree.erase(Path());
+  REQUIRE(eraseTree.size() == 0);
+}
+
+TEST_CASE("madronalib/core/tree/persistent", "[tree]")
+{
+  PersistentTree< Value > a;
+  REQUIRE(a.size() == 0);
+  REQUIRE(a.begin() == a.end());
+  REQUIRE(a["x"] == Value());
+
+  a.add("synth/osc/freq", 440.f);
+  a.add("synth/osc/wave", "saw");
+  a.add("synth/filter/cutoff", 1000.f);
+  REQUIRE(a.size() == 3);
+
+  // a copy is a snapshot that later changes do not affect.
+  auto b = a;
+  a.add("synth/osc/freq", 220.f);
+  REQUIRE(a["synth/osc/freq"] == 220.f);
+  REQUIRE(b["synth/osc/freq"] == 440.f);
+  REQUIRE(a != b);
+
+  // unchanged subtrees are shared between versions.
+  REQUIRE(a.getConstNode("synth/filter") == b.getConstNode("synth/filter"));
+  REQUIRE(a.getConstNode("synth/osc") != b.getConstNode("synth/osc"));
+
+  // iteration matches a Tree with the same contents.
+  Tree< Value > t;
+  t["synth/osc/freq"] = 220.f;
+  t["synth/osc/wave"] = "saw";
+  t["synth/filter/cutoff"] = 1000.f;
+  std::vector< Path > persistentPaths, treePaths;
+  for (auto it = a.begin(); it != a.end(); ++it)
+  {
+    persistentPaths.push_back(it.getCurrentNodePath());
+  }
+  for (auto it = t.begin(); it != t.end(); ++it)
+  {
+    treePaths.push_back(it.getCurrentNodePath());
+  }
+  REQUIRE(persistentPaths == treePaths);
+
+  // erasing removes empty parents, and leaves other versions alone.
+  auto c = a;
+  c.erase("synth/filter/cutoff");
+  REQUIRE(c.getConstNode("synth/filter") == nullptr);
+  REQUIRE(c.size() == 2);
+  REQUIRE(a.size() == 3);
+  c.erase("not/there");
+  REQUIRE(c.size() == 2);
+
+  // readers of a PublishedTree always see a complete version. Here the writer
+  // keeps the values at "x" and "y" equal in each version it publishes.
+  PublishedTree< Value > published;
+  constexpr int kVersions{2000};
+  std::atomic< bool > done{false};
+  int inconsistentReads{0};
+  std::atomic< int > reads{0};
+  std::thread reader([&]() {
+    while (!done)
+    {
+      auto snapshot = published.read();
+      if ((*snapshot)["x"] != (*snapshot)["y"]) inconsistentReads++;
+      reads++;
+    }
+  });
+  // make sure the reader runs during the updates, even on a single core.
+  while (!reads)
+  {
+    std::this_thread::yield();
+  }
+  for (int i = 1; i <= kVersions; ++i)
+  {
+    published.update([&](PersistentTree< Value >& tree) {
+      tree.add("x", i);
+      tree.add("y", i);
+    });
+    std::this_thread::yield();
+  }
+  done = true;
+  reader.join();
+  REQUIRE(inconsistentReads == 0);
+  REQUIRE(reads > 0);
+  published.collect();
+  REQUIRE(published.read()->operator[]("y") == kVersions);
+  REQUIRE(published.get()["x"] == kVersions);
+}
+
+TEST_CASE("madronalib/core/tree/handles", "[tree]")
+{
+  Tree< Value > t;
+  t["osc/freq"] = 440.f;
+  auto freq = t.getHandle("osc/freq");
+  REQUIRE(*freq == 440.f);
+
+  // handles see changes to their values, and survive adding other nodes.
+  for (int i = 0; i < 100; ++i)
+  {
+    t.add(Path{"osc", Symbol(textUtils::naturalNumberToText(i))}, i);
+  }
+  t["osc/freq"] = 220.f;
+  REQUIRE(*freq == 220.f);
+  *freq = 110.f;
+  REQUIRE(t["osc/freq"] == 110.f);
+
+  // getting a handle adds a node if needed, like operator[].
+  auto gain = t.getHandle(PathID("amp/gain"));
+  REQUIRE(gain);
+  REQUIRE(*gain == Value());
+  REQUIRE(treeNodeExists(t, "amp/gain"));
+
+  // cached PathID lookups find the same nodes as uncached ones.
+  t.setCaching(true);
+  PathID freqID("osc/freq");
+  REQUIRE(t.getNode(freqID) == freq.getNode());
+  REQUIRE(t.getNode(freqID) == freq.getNode());
+  REQUIRE(t[freqID] == 110.f);
+  REQUIRE(t.getNode(PathID("not/there")) == nullptr);
+  t["not/there"] = 1.f;
+  REQUIRE(t.getNode(PathID("not/there")) == t.getNode("not/there"));
+
+  // erasing clears the cache.
+  t.erase("osc");
+  REQUIRE(t.getNode(freqID) == nullptr);
+  REQUIRE(t[freqID] == Value());
+  t["osc/freq"] = 55.f;
+  REQUIRE(t[freqID] == 55.f);
+
+  // a copy caches its own nodes.
+  auto tCopy = t;
+  REQUIRE(tCopy.getCaching());
+  REQUIRE(tCopy.getNode(freqID) != t.getNode(freqID));
+  REQUIRE(tCopy[freqID] == 55.f);
+
+  // parameter reads through handles.
+  ParameterDescriptionList params;
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "freq"}, {"range", {20.f, 20000.f}}, {"log", true}}));
+  ParameterTree paramTree;
+  buildParameterTree(params, paramTree);
+  setDefaults(paramTree);
+  auto realFreq = paramTree.getRealValueHandle("freq");
+  auto normFreq = paramTree.getNormalizedValueHandle("freq");
+  paramTree.setFromNormalizedValue("freq", 1.f);
+  REQUIRE(paramTree.getRealFloatValue("freq") == Approx(20000.f));
+  REQUIRE(realFreq->getFloatValue() == Approx(20000.f));
+  paramTree.setFromRealValue("freq", 20.f);
+  REQUIRE(fabs(normFreq->getFloatValue()) < 1e-6f);
+  REQUIRE(realFreq->getFloatValue() == 20.f);
+}
+
+TEST_CASE("madronalib/core/parameters/table", "[parameters]")
+{
+  ParameterDescriptionList params;
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "linear"}, {"range", {-1.f, 3.f}}, {"plaindefault", 0.f}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "log"}, {"range", {20.f, 20000.f}}, {"log", true}, {"offset", 1.f}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "bisquare"}, {"range", {-10.f, 10.f}}, {"bisquare", true}, {"default", 0.75f}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "voices"}, {"units", "list"}, {"listitems", "1/2/4/8/16"},
+    {"use_list_values_as_int", true}, {"integer_values", true}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "wave"}, {"units", "list"}, {"num_items", 4}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "steps"}, {"range", {0.f, 8.f}}, {"integer_values", true}}));
+
+  ParameterTree paramTree;
+  buildParameterTree(params, paramTree);
+  setDefaults(paramTree);
+  ParameterTable table(params);
+
+  REQUIRE(table.size() == params.size());
+  REQUIRE(table.getID("log") == 1);
+  REQUIRE(table.getName(3) == Path("voices"));
+  size_t pathTableSize = thePathTable().getSize();
+  REQUIRE(table.getID("not/there") == ParameterTable::kNoParameter);
+  REQUIRE(table.getID("log/not/there") == ParameterTable::kNoParameter);
+  REQUIRE(thePathTable().getSize() == pathTableSize);
+
+  // defaults and conversions match those of the ParameterTree.
+  int mismatches{0};
+  for (size_t id = 0; id < table.size(); ++id)
+  {
+    Path pname = table.getName(id);
+    if (table.getNormalizedFloatValue(id) != Approx(paramTree.getNormalizedFloatValue(pname)))
+      mismatches++;
+    for (float x = 0.f; x <= 1.f; x += 1.f / 64)
+    {
+      float treeRealFloat = paramTree.convertNormalizedToRealValue(pname, x).getFloatValue();
+      float real = table.convertNormalizedToReal(id, x);
+      if (real != Approx(treeRealFloat).epsilon(1e-5)) mismatches++;
+      float treeNormalized = paramTree.convertRealToNormalizedFloatValue(pname, treeRealFloat);
+      if (fabs(table.convertRealToNormalized(id, real) - treeNormalized) > 1e-5f) mismatches++;
+    }
+  }
+  REQUIRE(mismatches == 0);
+
+  // get and set by ID
+  size_t voicesID = table.getID("voices");
+  table.setFromNormalizedValue(voicesID, 0.5f);
+  REQUIRE(table.getRealValue(voicesID) == Value(4));
+  paramTree.setFromNormalizedValue("voices", 0.5f);
+  REQUIRE(table.getRealValue(voicesID) == paramTree.getRealValue("voices"));
+  size_t stepsID = table.getID("steps");
+  table.setFromNormalizedValue(stepsID, 0.3f);
+  paramTree.setFromNormalizedValue("steps", 0.3f);
+  REQUIRE(table.getRealValue(stepsID) == Value(2));
+  REQUIRE(table.getRealValue(stepsID) == paramTree.getRealValue("steps"));
+  table.setFromRealValue(voicesID, 16.f);
+  REQUIRE(table.getNormalizedFloatValue(voicesID) == 1.f);
+  size_t wave = table.getID("wave");
+  table.setFromNormalizedValue(wave, 1.f);
+  REQUIRE(table.getRealFloatValue(wave) == 3.f);
+
+  // batch conversion matches conversion of each parameter.
+  std::vector< float > normalized{0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f};
+  std::vector< float > real(normalized.size());
+  table.setFromNormalizedValues(normalized.data());
+  table.convertNormalizedToReal(normalized.data(), real.data());
+  for (size_t id = 0; id < table.size(); ++id)
+  {
+    if (real[id] != table.convertNormalizedToReal(id, normalized[id])) mismatches++;
+    if (table.getRealFloatValue(id) != real[id]) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+
+  // set from a Tree of values.
+  Tree< Value > realValues;
+  realValues["linear"] = 1.f;
+  realValues["not/there"] = 1.f;
+  table.setFromRealValues(realValues);
+  REQUIRE(table.getNormalizedFloatValue(0) == 0.5f);
+}
+
+TEST_CASE("madronalib/core/parameters/projections", "[parameters][projections]")
+{
+  // log, bisquare and linear parameters, each with an offset, which only log
+  // projections use.
+  ParameterDescriptionList params;
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "log"}, {"range", {20.f, 20000.f}}, {"log", true}, {"offset", 1.f}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "bisquare"}, {"range", {-10.f, 10.f}}, {"bisquare", true}, {"offset", 2.f}}));
+  params.push_back(ml::make_unique< ParameterDescription >(WithValues{
+    {"name", "linear"}, {"range", {-1.f, 3.f}}, {"offset", 3.f}}));
+  ParameterTree paramTree;
+  buildParameterTree(params, paramTree);
+  ParameterTable table(params);
+
+  // the ParameterTree's projections are composed at compile time, so each call
+  // is a single indirect call.
+  using LogToReal = ComposedProjection< AddProjection, IntervalMapProjection< LogProjection > >;
+  using LogToNormalized =
+      ComposedProjection< IntervalMapProjection< ExpProjection >, AddProjection >;
+  using BisquareToReal = ComposedProjection< BisquaredProjection, LinearProjection >;
+  using BisquareToNormalized = ComposedProjection< LinearProjection, InvBisquaredProjection >;
+  REQUIRE(paramTree.projections["log"].normalizedToReal.target< LogToReal >());
+  REQUIRE(paramTree.projections["log"].realToNormalized.target< LogToNormalized >());
+  REQUIRE(paramTree.projections["bisquare"].normalizedToReal.target< BisquareToReal >());
+  REQUIRE(paramTree.projections["bisquare"].realToNormalized.target< BisquareToNormalized >());
+  REQUIRE(paramTree.projections["linear"].normalizedToReal.target< LinearProjection >());
+  REQUIRE(paramTree.projections["linear"].realToNormalized.target< LinearProjection >());
+
+  // the conversions match those of the ParameterTable.
+  int mismatches{0};
+  for (size_t id = 0; id < table.size(); ++id)
+  {
+    Path pname = table.getName(id);
+    for (float x = 0.f; x <= 1.f; x += 1.f / 64)
+    {
+      float treeReal = paramTree.convertNormalizedToRealFloatValue(pname, x);
+      float real = table.convertNormalizedToReal(id, x);
+      if (real != Approx(treeReal).epsilon(1e-5)) mismatches++;
+      float treeNormalized = paramTree.convertRealToNormalizedFloatValue(pname, treeReal);
+      if (fabs(table.convertRealToNormalized(id, real) - treeNormalized) > 1e-5f) mismatches++;
+      if (fabs(treeNormalized - x) > 1e-4f) mismatches++;
+    }
+  }
+  REQUIRE(mismatches == 0);
+}
+
+// the paths of a parameter tree with 10k leaves: 100 modules of 100 parameters each.
+static std::vector<Path> makeParameterPaths(std::vector<Symbol>& moduleNames)
+{
+  constexpr int kModules{100};
+  constexpr int kParams{100};
+  ml::textUtils::NameMaker moduleNamer;
+  for (int i = 0; i < kModules; ++i)
+  {
+    moduleNames.push_back(moduleNamer.nextName());
+  }
+  std::vector<Path> paths;
+  for (int i = 0; i < kModules; ++i)
+  {
+    ml::textUtils::NameMaker paramNamer;
+    for (int j = 0; j < kParams; ++j)
+    {
+      paths.push_back(Path{moduleNames[i], Symbol(paramNamer.nextName())});
+    }
+  }
+  return paths;
+}
+
+TEST_CASE("madronalib/core/tree/flat", "[tree]")
+{
+  std::vector<Symbol> moduleNames;
+  auto paths = makeParameterPaths(moduleNames);
+
+  Tree<Value> mapTree;
+  FlatTree<Value> flatTree;
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    mapTree.add(paths[i], Value(static_cast<float>(i)));
+    flatTree.add(paths[i], Value(static_cast<float>(i)));
+  }
+  REQUIRE(flatTree.size() == paths.size());
+
+  // lookups and iteration should match those of a Tree.
+  int mismatches{0};
+  for (auto& p : paths)
+  {
+    if (mapTree[p] != flatTree[p]) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+
+  auto itMap = mapTree.begin();
+  auto itFlat = flatTree.begin();
+  for (; (itMap != mapTree.end()) && (itFlat != flatTree.end()); ++itMap, ++itFlat)
+  {
+    if (itMap.getCurrentNodePath() != itFlat.getCurrentNodePath()) mismatches++;
+    if (itMap.getCurrentDepth() != itFlat.getCurrentDepth()) mismatches++;
+    if (*itMap != *itFlat) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+  REQUIRE(itMap == mapTree.end());
+  REQUIRE(itFlat == flatTree.end());
+
+  // missing paths and intermediate nodes
+  const FlatTree<Value>& constFlatTree = flatTree;
+  REQUIRE(constFlatTree["not/there"] == Value());
+  REQUIRE(constFlatTree.getConstNode("not/there") == nullptr);
+  auto pModule = constFlatTree.getConstNode(Path{moduleNames[0]});
+  REQUIRE(pModule != nullptr);
+  REQUIRE(!pModule->hasValue());
+  REQUIRE(!pModule->isLeaf());
+  REQUIRE(pModule->getConstNode(Path{"B"})->getValue() == Value(1.f));
+
+  // node pointers stay valid as the tree grows.
+  auto pFirst = flatTree.getNode(paths[0]);
+  flatTree["more/nodes/here"] = 1.f;
+  flatTree.add(PathID("more/nodes/there"), 2.f);
+  REQUIRE(flatTree.getNode(paths[0]) == pFirst);
+  REQUIRE(flatTree[PathID("more/nodes/there")] == Value(2.f));
+
+  // copies are deep.
+  auto flatCopy = flatTree;
+  REQUIRE(flatCopy == flatTree);
+  flatCopy["more/nodes/here"] = 3.f;
+  REQUIRE(flatCopy != flatTree);
+  REQUIRE(flatTree["more/nodes/here"] == Value(1.f));
+
+  // moving leaves the source empty and usable.
+  auto flatMoved = std::move(flatCopy);
+  REQUIRE(flatMoved["more/nodes/here"] == Value(3.f));
+  REQUIRE(flatCopy.size() == 0);
+  REQUIRE(flatCopy.begin() == flatCopy.end());
+  flatCopy["a/b"] = 4.f;
+  REQUIRE(flatCopy["a/b"] == Value(4.f));
+  flatCopy = std::move(flatMoved);
+  REQUIRE(flatCopy["more/nodes/here"] == Value(3.f));
+  REQUIRE(flatCopy["a/b"] == Value());
+  REQUIRE(flatMoved.size() == 0);
+
+  // an empty tree can be read, copied and compared.
+  const FlatTree<Value> emptyTree;
+  REQUIRE(emptyTree.size() == 0);
+  REQUIRE(!emptyTree.hasValue());
+  REQUIRE(emptyTree["a/b"] == Value());
+  REQUIRE(emptyTree.getConstNode("a/b") == nullptr);
+  REQUIRE(emptyTree.begin() == emptyTree.end());
+  FlatTree<Value> emptyCopy{emptyTree};
+  REQUIRE(emptyCopy == emptyTree);
+  REQUIRE(emptyCopy.size() == 0);
+}
+
+TEST_CASE("madronalib/core/tree/flat/wide", "[tree]")
+{
+  // a node with many children, added in no particular order.
+  constexpr size_t kChildren{2000};
+  std::vector<Path> paths;
+  ml::textUtils::NameMaker namer;
+  for (size_t i = 0; i < kChildren; ++i)
+  {
+    paths.push_back(Path{"wide", Symbol(namer.nextName())});
+  }
+  std::vector<size_t> order(kChildren);
+  for (size_t i = 0; i < kChildren; ++i)
+  {
+    order[i] = (i * 997) % kChildren;
+  }
+
+  FlatTree<Value> flatTree;
+  for (size_t i : order)
+  {
+    flatTree.add(paths[i], Value(static_cast<float>(i)));
+  }
+  REQUIRE(flatTree.size() == kChildren);
+
+  // every child is found, in the tree and in a copy of it.
+  auto flatCopy = flatTree;
+  int mismatches{0};
+  for (size_t i = 0; i < kChildren; ++i)
+  {
+    if (flatTree[paths[i]] != Value(static_cast<float>(i))) mismatches++;
+    if (flatCopy[paths[i]] != Value(static_cast<float>(i))) mismatches++;
+  }
+  REQUIRE(mismatches == 0);
+  REQUIRE(flatTree.getConstNode("wide/not_there") == nullptr);
+  REQUIRE(flatCopy == flatTree);
+}
+
+// run with the tag [benchmark] to see the results.
+TEST_CASE("madronalib/core/tree/flat/lookup", "[.][benchmark]")
+{
+  std::vector<Symbol> moduleNames;
+  auto paths = makeParameterPaths(moduleNames);
+  Tree<Value> mapTree;
+  FlatTree<Value> flatTree;
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    mapTree.add(paths[i], Value(static_cast<float>(i)));
+    flatTree.add(paths[i], Value(static_cast<float>(i)));
+  }
+
+  constexpr int kPasses{20};
+  float mapSum{0}, flatSum{0};
+  auto startTime = std::chrono::high_resolution_clock::now();
+  for (int n = 0; n < kPasses; ++n)
+  {
+    for (auto& p : paths)
+    {
+      mapSum += mapTree[p].getFloatValue();
+    }
+  }
+  auto mapTime = std::chrono::high_resolution_clock::now() - startTime;
+  startTime = std::chrono::high_resolution_clock::now();
+  for (int n = 0; n < kPasses; ++n)
+  {
+    for (auto& p : paths)
+    {
+      flatSum += flatTree[p].getFloatValue();
+    }
+  }
+  auto flatTime = std::chrono::high_resolution_clock::now() - startTime;
+  REQUIRE(mapSum == flatSum);
+
+  auto lookups = kPasses * paths.size();
+  std::cout << "Tree lookup: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(mapTime).count() / lookups
+            << "ns, FlatTree lookup: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(flatTime).count() / lookups
+            << "ns\n";
 }
 
 TEST_CASE("madronalib/core/serialization", "[serialization]")
@@ -0,0 +1,137 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+// a unit test made using the Catch framework in catch.hpp / tests.cpp.
+
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "catch.hpp"
+#include "madronalib.h"
+
+using namespace ml;
+
+TEST_CASE("madronalib/core/value/size", "[value]")
+{
+  // all types share one small buffer.
+  REQUIRE(sizeof(Value) <= 64);
+}
+
+TEST_CASE("madronalib/core/value/types", "[value]")
+{
+  Value u;
+  REQUIRE(!u);
+  REQUIRE(u.getType() == Value::kUndefinedValue);
+
+  Value f(3.f);
+  REQUIRE(f.getFloatValue() == 3.f);
+  REQUIRE(f.getTextValue() == Text());
+
+  Value l(uint32_t(7));
+  REQUIRE(l.getUnsignedLongValue() == 7);
+  REQUIRE(l.getFloatValue() == 0.f);
+
+  Value i(Interval{1.f, 2.f});
+  REQUIRE((i.getIntervalValue() == Interval{1.f, 2.f}));
+
+  Value shortText("hello");
+  REQUIRE(shortText.getTextValue() == "hello");
+
+  TextFragment longText(
+      "a text that is much too long to fit into the local storage of a Value, so it will "
+      "be stored on the heap instead.");
+  Value t(longText);
+  REQUIRE(t.getTextValue() == longText);
+  REQUIRE(t != shortText);
+
+  Value m{1.f, 2.f, 3.f};
+  REQUIRE(m.getType() == Value::kMatrixValue);
+  REQUIRE(m.getMatrixValue()[2] == 3.f);
+
+  std::vector<uint8_t> blobData(1000);
+  for (int n = 0; n < blobData.size(); ++n) blobData[n] = n & 0xFF;
+  Value b(blobData.data(), blobData.size());
+  REQUIRE(b.getBlobSize() == 1000);
+  REQUIRE(static_cast<const uint8_t*>(b.getBlobValue())[999] == (999 & 0xFF));
+
+  // changing type releases the old data
+  t = 4.f;
+  REQUIRE(t.getFloatValue() == 4.f);
+  REQUIRE(t.getTextValue() == Text());
+}
+
+TEST_CASE("madronalib/core/value/copy", "[value]")
+{
+  TextFragment longText(
+      "another text that is much too long to fit into the local storage of a Value, "
+      "so it will be stored on the heap.");
+
+  Value a(longText);
+  Value b(a);
+  REQUIRE(a == b);
+
+  // setting one copy leaves the other alone
+  b = Value("x");
+  REQUIRE(a.getTextValue() == longText);
+  REQUIRE(b.getTextValue() == "x");
+
+  // copies of large payloads share their data
+  std::vector<uint8_t> blobData(1000);
+  Value blobA(blobData.data(), blobData.size());
+  Value blobB(blobA);
+  REQUIRE(blobA.getBlobValue() == blobB.getBlobValue());
+
+  // writing to a shared blob copies it first
+  static_cast<uint8_t*>(blobB.getMutableBlobValue())[0] = 1;
+  REQUIRE(blobA.getBlobValue() != blobB.getBlobValue());
+  REQUIRE(static_cast<const uint8_t*>(blobA.getBlobValue())[0] == 0);
+  REQUIRE(static_cast<const uint8_t*>(blobB.getBlobValue())[0] == 1);
+
+  // and an unshared one is written in place
+  const void* pBlob = blobB.getBlobValue();
+  static_cast<uint8_t*>(blobB.getMutableBlobValue())[1] = 2;
+  REQUIRE(blobB.getBlobValue() == pBlob);
+
+  Value m1{1.f, 2.f, 3.f, 4.f};
+  Value m2 = m1;
+  REQUIRE(&m1.getMatrixValue() == &m2.getMatrixValue());
+  m2.setValue(Matrix{5.f, 6.f, 7.f, 8.f});
+  REQUIRE(m1.getMatrixValue()[0] == 1.f);
+  REQUIRE(m2.getMatrixValue()[0] == 5.f);
+
+  // an unshared matrix is modified in place
+  const Matrix* pMatrix = &m2.getMatrixValue();
+  m2.setValue(Matrix{9.f, 10.f, 11.f, 12.f});
+  REQUIRE(&m2.getMatrixValue() == pMatrix);
+  REQUIRE(m2.getMatrixValue()[0] == 9.f);
+}
+
+TEST_CASE("madronalib/core/value/move", "[value]")
+{
+  TextFragment longText(
+      "yet another text that is much too long to fit into the local storage of a Value, "
+      "so it will be stored on the heap.");
+
+  Value a(longText);
+  Value b(std::move(a));
+  REQUIRE(b.getTextValue() == longText);
+  REQUIRE(!a);
+
+  Value c;
+  c = std::move(b);
+  REQUIRE(c.getTextValue() == longText);
+  REQUIRE(!b);
+
+  Value d("short");
+  Value e(std::move(d));
+  REQUIRE(e.getTextValue() == "short");
+
+  std::vector<Value> values;
+  for (int i = 0; i < 100; ++i)
+  {
+    values.emplace_back(longText);
+  }
+  REQUIRE(values[99].getTextValue() == longText);
+}
@@ -97,7 +97,7 @@ int main()
 	{
 		const char * letters("abcd");
 		
-		uint32_t hashTest = krHash0(letters, strlen(letters));	
+		uint64_t hashTest = fnvHash(letters);
 		
 		std::cout << std::hex << hashTest << std::dec << "\n";
 		
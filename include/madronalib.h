@@ -5,10 +5,14 @@
 #pragma once
 
 #include "MLActor.h"
+#include "MLActorScheduler.h"
 #include "MLClock.h"
 #include "MLEventsToSignals.h"
+#include "MLFlatTree.h"
+#include "MLMailbox.h"
 #include "MLMemoryUtils.h"
 #include "MLPath.h"
+#include "MLPersistentTree.h"
 #include "MLPlatform.h"
 #include "MLPropertyTree.h"
 #include "MLQueue.h"
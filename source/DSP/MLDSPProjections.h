@@ -8,6 +8,7 @@
 #include <iostream>
 #include <vector>
 
+#include "MLDSPOps.h"
 #include "MLDSPScalarMath.h"
 
 namespace ml
@@ -266,6 +267,206 @@ inline void printTable(const Projection& p, std::string pName, Interval domain,
 
 }  // namespace projections
 
+// ----------------------------------------------------------------
+// Compile-time projections
+//
+// A Projection is a std::function, so each call is an indirect call that can't
+// be inlined, and a composed Projection makes one indirect call for each of its
+// parts. The projection classes below are ordinary functors instead, and
+// composing them makes a new type, so a whole composition can be inlined into a
+// single loop. Each class defines apply() for floats and SIMD vectors, and
+// ProjectionBase uses those to define operator() for floats, SIMD vectors and
+// DSPVectorArrays.
+//
+// Type erasure is only needed at the boundary: any projection class converts to
+// a Projection, making one indirect call per float, or to a VectorProjection,
+// making one indirect call per DSPVector.
+//
+// example:
+//   auto toFreq = IntervalMapProjection{Interval{0, 1}, Interval{20, 20000},
+//                                       LogProjection{Interval{20, 20000}}};
+//   DSPVector freqs = toFreq(modulation);
+
+using VectorProjection = std::function<DSPVector(const DSPVector&)>;
+
+template <class P>
+struct ProjectionBase
+{
+  inline float operator()(float x) const { return derived().apply(x); }
+  inline SIMDVectorFloat operator()(SIMDVectorFloat x) const { return derived().apply(x); }
+
+  template <size_t ROWS>
+  inline DSPVectorArray<ROWS> operator()(const DSPVectorArray<ROWS>& vx) const
+  {
+    DSPVectorArray<ROWS> vy;
+    const float* px = vx.getConstBuffer();
+    float* py = vy.getBuffer();
+    for (size_t n = 0; n < kSIMDVectorsPerDSPVector * ROWS; ++n)
+    {
+      vecStore(py, derived().apply(vecLoad(px)));
+      px += kFloatsPerSIMDVector;
+      py += kFloatsPerSIMDVector;
+    }
+    return vy;
+  }
+
+ private:
+  const P& derived() const { return static_cast<const P&>(*this); }
+};
+
+struct UnityProjection : ProjectionBase<UnityProjection>
+{
+  float apply(float x) const { return x; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return x; }
+};
+
+struct ConstantProjection : ProjectionBase<ConstantProjection>
+{
+  float k;
+  explicit ConstantProjection(float c) : k(c) {}
+  float apply(float x) const { return k; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecSet1(k); }
+};
+
+struct SquaredProjection : ProjectionBase<SquaredProjection>
+{
+  float apply(float x) const { return x * x; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecMul(x, x); }
+};
+
+struct FlipProjection : ProjectionBase<FlipProjection>
+{
+  float apply(float x) const { return 1 - x; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecSub(vecSet1(1.f), x); }
+};
+
+struct ClipProjection : ProjectionBase<ClipProjection>
+{
+  float apply(float x) const { return ml::clamp(x, 0.f, 1.f); }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    return vecClamp(x, vecSet1(0.f), vecSet1(1.f));
+  }
+};
+
+struct SmoothstepProjection : ProjectionBase<SmoothstepProjection>
+{
+  float apply(float x) const { return 3 * x * x - 2 * x * x * x; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    // x * x * (3 - 2x)
+    return vecMul(vecMul(x, x), vecSub(vecSet1(3.f), vecMul(vecSet1(2.f), x)));
+  }
+};
+
+// x^2, but inverted for x < 0.
+struct BisquaredProjection : ProjectionBase<BisquaredProjection>
+{
+  float apply(float x) const { return fabs(x) * x; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecMul(vecAbs(x), x); }
+};
+
+// inverse of BisquaredProjection.
+struct InvBisquaredProjection : ProjectionBase<InvBisquaredProjection>
+{
+  float apply(float x) const { return sqrtf(fabs(x)) * sign(x); }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecMul(vecSqrt(vecAbs(x)), vecSign(x)); }
+};
+
+struct AddProjection : ProjectionBase<AddProjection>
+{
+  float f;
+  explicit AddProjection(float a) : f(a) {}
+  float apply(float x) const { return x + f; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return vecAdd(x, vecSet1(f)); }
+};
+
+// linear projection mapping an interval to another interval.
+struct LinearProjection : ProjectionBase<LinearProjection>
+{
+  float m, c;
+  LinearProjection(const Interval a, const Interval b)
+      : m((b.mX2 - b.mX1) / (a.mX2 - a.mX1)), c(b.mX1 - m * a.mX1)
+  {
+  }
+  float apply(float x) const { return m * x + c; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    return vecAdd(vecMul(vecSet1(m), x), vecSet1(c));
+  }
+};
+
+// like projections::log, a projection from [0, 1] to a logarithmic curve on
+// [a, b] scaled back to [0, 1]. works for positive a, b with a < b only.
+struct LogProjection : ProjectionBase<LogProjection>
+{
+  float scale, logRatio;
+  explicit LogProjection(Interval m)
+      : scale(m.mX1 / (m.mX2 - m.mX1)), logRatio(logf(m.mX2 / m.mX1))
+  {
+  }
+  float apply(float x) const { return scale * (expf(x * logRatio) - 1); }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    return vecMul(vecSet1(scale), vecSub(vecExp(vecMul(x, vecSet1(logRatio))), vecSet1(1.f)));
+  }
+};
+
+// the inverse of LogProjection.
+struct ExpProjection : ProjectionBase<ExpProjection>
+{
+  float scale, logRatioR;
+  explicit ExpProjection(Interval m)
+      : scale((m.mX2 - m.mX1) / m.mX1), logRatioR(1.f / logf(m.mX2 / m.mX1))
+  {
+  }
+  float apply(float x) const { return logf(x * scale + 1) * logRatioR; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    return vecMul(vecLog(vecAdd(vecMul(x, vecSet1(scale)), vecSet1(1.f))), vecSet1(logRatioR));
+  }
+};
+
+// a projection mapping an interval to another interval with an intermediate
+// shaping projection on [0, 1].
+template <class P>
+struct IntervalMapProjection : ProjectionBase<IntervalMapProjection<P> >
+{
+  float scaleA, offsetA, scaleB, offsetB;
+  P shape;
+  IntervalMapProjection(const Interval a, const Interval b, P c)
+      : scaleA(1 / (a.mX2 - a.mX1)),
+        offsetA((-a.mX1) / (a.mX2 - a.mX1)),
+        scaleB(b.mX2 - b.mX1),
+        offsetB(b.mX1),
+        shape(c)
+  {
+  }
+  float apply(float x) const { return shape.apply(x * scaleA + offsetA) * scaleB + offsetB; }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const
+  {
+    SIMDVectorFloat y = shape.apply(vecAdd(vecMul(x, vecSet1(scaleA)), vecSet1(offsetA)));
+    return vecAdd(vecMul(y, vecSet1(scaleB)), vecSet1(offsetB));
+  }
+};
+
+// the composition a(b(x)).
+template <class A, class B>
+struct ComposedProjection : ProjectionBase<ComposedProjection<A, B> >
+{
+  A a;
+  B b;
+  ComposedProjection(A pa, B pb) : a(pa), b(pb) {}
+  float apply(float x) const { return a.apply(b.apply(x)); }
+  SIMDVectorFloat apply(SIMDVectorFloat x) const { return a.apply(b.apply(x)); }
+};
+
+template <class A, class B>
+inline ComposedProjection<A, B> compose(const ProjectionBase<A>& a, const ProjectionBase<B>& b)
+{
+  return ComposedProjection<A, B>(static_cast<const A&>(a), static_cast<const B&>(b));
+}
+
 inline std::ostream& operator<<(std::ostream& out, const ml::Interval& m)
 {
   std::cout << "[" << m.mX1 << "–" << m.mX2 << "]";
@@ -4,27 +4,203 @@
 
 #include "MLActor.h"
 
+#include <algorithm>
+
+#include "MLActorScheduler.h"
+
 using namespace ml;
 
-Actor* ActorRegistry::getActor(Path actorName) { return _actors[actorName]; }
+Actor* ActorRegistry::getActor(Path actorName)
+{
+  ReadLock lock(*this);
+  return lock.getActor(actorName);
+}
 
-void ActorRegistry::doRegister(Path actorName, Actor* a) { _actors[actorName] = a; }
+void ActorRegistry::doRegister(Path actorName, Actor* a)
+{
+  std::unique_lock<std::mutex> lock(_writeMutex);
+  auto pNewSnapshot = new Snapshot(*_snapshot.load());
+  pNewSnapshot->actors.add(actorName, a);
+  publish(pNewSnapshot);
+}
 
 void ActorRegistry::doRemove(Actor* actorToRemove)
 {
-  // get exclusive access to the Tree
-  std::unique_lock<std::mutex> lock(_listMutex);
+  std::unique_lock<std::mutex> lock(_writeMutex);
+  auto pNewSnapshot = new Snapshot(*_snapshot.load());
 
   // remove the Actor
-  for (auto it = _actors.begin(); it != _actors.end(); ++it)
+  auto& actors = pNewSnapshot->actors;
+  for (auto it = actors.begin(); it != actors.end(); ++it)
   {
     Actor* pa = *it;
     if (pa == actorToRemove)
     {
       const Path p = it.getCurrentNodePath();
-      _actors[p] = nullptr;
+      actors[p] = nullptr;
+    }
+  }
+  actorToRemove->_beingRemoved = true;
+  publish(pNewSnapshot);
+
+  // no new sender can find the Actor now. Wait for those that found it before,
+  // which give up if they are blocked on its mailbox.
+  while (actorToRemove->_sendersInProgress.load() > 0)
+  {
+    std::this_thread::yield();
+  }
+  actorToRemove->_beingRemoved = false;
+}
+
+void ActorRegistry::publish(Snapshot* pNewSnapshot)
+{
+  pNewSnapshot->generation = _snapshot.load()->generation + 1;
+  Snapshot* pOldSnapshot = _snapshot.exchange(pNewSnapshot);
+
+  // wait for the readers in each slot to finish. A reader that counts itself after
+  // we have checked its slot must load the snapshot after the exchange above, so it
+  // can only see the new snapshot.
+  for (int i = 0; i < 2; ++i)
+  {
+    unsigned phase = _readPhase.fetch_add(1) & 1;
+    while (_readers[phase].load() > 0)
+    {
+      std::this_thread::yield();
+    }
+  }
+  delete pOldSnapshot;
+}
+
+void ActorRegistry::dump()
+{
+  ReadLock lock(*this);
+  lock._pSnapshot->actors.dump();
+}
+
+void ActorRegistry::dumpMetrics(std::ostream& out)
+{
+  ReadLock lock(*this);
+  auto& actors = lock._pSnapshot->actors;
+  for (auto it = actors.begin(); it != actors.end(); ++it)
+  {
+    if (Actor* pActor = *it)
+    {
+      out << it.getCurrentNodePath() << ": " << pActor->getMailboxMetrics() << "\n";
+    }
+  }
+}
+
+void ActorRegistry::startMetricsDump(milliseconds interval)
+{
+  _metricsTimer.start([this]() { dumpMetrics(std::cout); }, interval);
+}
+
+void ActorRegistry::stopMetricsDump() { _metricsTimer.stop(); }
+
+// Actor
+
+void Actor::startEventDriven(microseconds coalesceTime)
+{
+  if (_threadRunning) return;
+  detachFromScheduler();
+  _queueTimer.stop();
+  _threadRunning = true;
+  _messageThread = std::thread{[=]() { runMessageThread(coalesceTime); }};
+}
+
+void Actor::startOnScheduler(ActorScheduler& scheduler, size_t maxMessagesPerTurn)
+{
+  stop();
+  _maxMessagesPerTurn = std::max(maxMessagesPerTurn, size_t(1));
+  _scheduler = &scheduler;
+
+  // handle any messages that arrived before we started.
+  scheduleIfNeeded();
+}
+
+void Actor::scheduleIfNeeded()
+{
+  ActorScheduler* pScheduler = _scheduler.load();
+  if (!pScheduler) return;
+
+  // only the caller that changes _scheduled from false to true schedules the Actor.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if ((getMessagesAvailable() > 0) && !_scheduled.exchange(true))
+  {
+    pScheduler->schedule(this);
+  }
+}
+
+void Actor::detachFromScheduler()
+{
+  ActorScheduler* pScheduler = _scheduler.exchange(nullptr);
+
+  // if we are stopping ourselves from onMessage(), the turn in progress is our own.
+  // With _scheduler cleared, the worker won't put us back in a deque when it ends.
+  if (ActorScheduler::getCurrentActor() == this) return;
+
+  // a worker may be running a turn, and may put us back in a deque before it finishes.
+  // Keep removing ourselves until no turn is in progress and we are not waiting. This
+  // also waits for the end of a turn in which we stopped ourselves.
+  while (true)
+  {
+    if (pScheduler) pScheduler->remove(this);
+    if ((_turnsInProgress.load() == 0) && !_scheduled.load()) break;
+    std::this_thread::yield();
+  }
+}
+
+void Actor::stop()
+{
+  detachFromScheduler();
+  _queueTimer.stop();
+  if (_messageThread.joinable())
+  {
+    {
+      std::unique_lock<std::mutex> lock(_wakeMutex);
+      _threadRunning = false;
     }
+    _wakeCondition.notify_one();
+    _messageThread.join();
   }
 }
 
-void ActorRegistry::dump() { _actors.dump(); }
+void Actor::runMessageThread(microseconds coalesceTime)
+{
+  while (_threadRunning)
+  {
+    {
+      // announce that we are about to wait, then check the queue. A producer pushes and
+      // then checks _threadWaiting, so with both sides using sequentially consistent
+      // operations one of us is guaranteed to see the other and no wakeup is lost.
+      std::unique_lock<std::mutex> lock(_wakeMutex);
+      _threadWaiting.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      _wakeCondition.wait(
+          lock, [&]() { return !_threadRunning || _mailbox.elementsAvailable() > 0; });
+      _threadWaiting.store(false);
+    }
+
+    if (!_threadRunning) break;
+
+    if (coalesceTime > microseconds(0))
+    {
+      std::this_thread::sleep_for(coalesceTime);
+    }
+    handleMessagesInQueue();
+  }
+}
+
+void Actor::wakeMessageThread()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_threadWaiting.load())
+  {
+    // taking the lock ensures the consumer is either before its check of the queue
+    // or blocked in wait(), so the notification can't be missed.
+    {
+      std::unique_lock<std::mutex> lock(_wakeMutex);
+    }
+    _wakeCondition.notify_one();
+  }
+}
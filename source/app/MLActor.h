@@ -4,8 +4,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "MLMailbox.h"
 #include "MLMessage.h"
-#include "MLQueue.h"
 #include "MLTimer.h"
 
 // An Actor handles incoming messages using its own queue and timer.
@@ -17,34 +23,128 @@ namespace ml
 {
 
 class Actor;
+class ActorScheduler;
+
+// The registry is read far more often than it is changed, so it is kept as an
+// immutable snapshot that writers replace. Readers never wait: they announce
+// themselves in a reader count, then use the current snapshot. A writer copies
+// the snapshot, changes the copy, publishes it and then waits until no reader
+// can still be using the old one before deleting it.
+
 class ActorRegistry
 {
-  Tree<Actor*> _actors;
-  std::mutex _listMutex;
+  struct Snapshot
+  {
+    Tree<Actor*> actors;
+    uint64_t generation{0};
+  };
+
+  std::atomic<Snapshot*> _snapshot{new Snapshot};
+
+  // readers are counted in one of two slots. Each writer flips the phase so that
+  // new readers use the other slot, which keeps a steady stream of readers from
+  // holding up writers forever.
+  std::atomic<int> _readers[2]{};
+  std::atomic<unsigned> _readPhase{0};
+  std::mutex _writeMutex;
+
+  void publish(Snapshot* pNewSnapshot);
 
  public:
   ActorRegistry() = default;
-  ~ActorRegistry() = default;
+  ~ActorRegistry() { delete _snapshot.load(); }
+
+  // A read-side critical section. While a ReadLock exists, the snapshot it refers
+  // to stays valid, and any Actor registered in it will not be removed from the
+  // registry, because doRegister() and doRemove() wait for all ReadLocks that
+  // might see the old snapshot to be destroyed. So a ReadLock must be held only
+  // briefly: in particular, not while waiting for an Actor's mailbox.
+  class ReadLock
+  {
+    ActorRegistry& _registry;
+    unsigned _phase;
+    const Snapshot* _pSnapshot;
+
+    friend class ActorRegistry;
+
+   public:
+    explicit ReadLock(ActorRegistry& r) : _registry(r), _phase(r._readPhase.load() & 1)
+    {
+      _registry._readers[_phase]++;
+      _pSnapshot = _registry._snapshot.load();
+    }
+    ~ReadLock() { _registry._readers[_phase]--; }
+
+    ReadLock(ReadLock const&) = delete;
+    ReadLock& operator=(ReadLock const&) = delete;
+
+    Actor* getActor(Path actorName) const { return _pSnapshot->actors[actorName]; }
+
+    // the generation changes each time the registry is modified.
+    uint64_t getGeneration() const { return _pSnapshot->generation; }
+  };
 
   Actor* getActor(Path actorName);
   void doRegister(Path actorName, Actor* a);
   void doRemove(Actor* actorToRemove);
 
   void dump();
+
+  // write the mailbox metrics of each registered Actor.
+  void dumpMetrics(std::ostream& out);
+
+  // dump the metrics to std::cout at the given interval, using a Timer.
+  void startMetricsDump(milliseconds interval);
+  void stopMetricsDump();
+
+ private:
+  Timer _metricsTimer;
 };
 
 class Actor
 {
   friend ActorRegistry;
+  friend ActorScheduler;
+  friend class ActorRef;
+  friend void sendMessageToActor(Path actorName, Message m);
 
   static constexpr size_t kMessageQueueSize{128};
   static constexpr size_t kDefaultMessageInterval{1000 / 60};
+  static constexpr size_t kDefaultMessagesPerTurn{16};
 
-  Queue<Message> _messageQueue{kMessageQueueSize};
+  Mailbox _mailbox{kMessageQueueSize};
   Timer _queueTimer;
 
+  // event-driven mode: a thread owned by the Actor sleeps until woken by enqueueMessage().
+  std::thread _messageThread;
+  std::mutex _wakeMutex;
+  std::condition_variable _wakeCondition;
+  std::atomic<bool> _threadRunning{false};
+  std::atomic<bool> _threadWaiting{false};
+
+  void runMessageThread(microseconds coalesceTime);
+  void wakeMessageThread();
+
+  // scheduler mode: _scheduled is true while the Actor is waiting in one of the
+  // scheduler's deques or being run by a worker.
+  std::atomic<ActorScheduler*> _scheduler{nullptr};
+  std::atomic<bool> _scheduled{false};
+  std::atomic<int> _turnsInProgress{0};
+  size_t _maxMessagesPerTurn{kDefaultMessagesPerTurn};
+
+  void scheduleIfNeeded();
+  void detachFromScheduler();
+
+  // senders that found this Actor in the registry and are enqueueing a message
+  // after releasing their ReadLock. doRemove() waits for them to finish, and sets
+  // _beingRemoved so that any blocked on a full mailbox give up.
+  std::atomic<int> _sendersInProgress{0};
+  std::atomic<bool> _beingRemoved{false};
+
+  bool isRunning() { return _queueTimer.isActive() || _threadRunning || _scheduler.load(); }
+
  protected:
-  size_t getMessagesAvailable() { return _messageQueue.elementsAvailable(); }
+  size_t getMessagesAvailable() { return _mailbox.elementsAvailable(); }
 
   // handle all the messages in the queue immediately.
   void handleMessagesInQueue()
@@ -52,20 +152,52 @@ class Actor
     // TEMP this was called by tick, and then (this) was null!
     // trying to call PluginController::onMessage
 
-    while (Message m = _messageQueue.pop())
+    // pop each message into the same slot so that nothing is copied on the way out.
+    Message m;
+    while (_mailbox.pop(m) && m)
     {
-      onMessage(m);
+      onMessage(std::move(m));
+    }
+  }
+
+  // handle at most maxMessages messages from the queue, stopping early if the Actor
+  // is detached from its scheduler.
+  void handleMessagesInQueue(size_t maxMessages)
+  {
+    Message m;
+    for (size_t i = 0; i < maxMessages; ++i)
+    {
+      if (!_scheduler.load()) break;
+      if (!(_mailbox.pop(m) && m)) break;
+      onMessage(std::move(m));
     }
   }
 
  public:
   Actor() = default;
-  virtual ~Actor() = default;
+
+  // subclasses should call stop() in their destructors, so that no messages are
+  // handled while they are being destroyed.
+  virtual ~Actor() { stop(); }
 
   // Actors can override onFullQueue to specify what action to take when
-  // the message queue is full.
+  // a message is dropped because the message queue is full.
   virtual void onFullQueue() {}
 
+  // set what happens to new messages when the queue is full. This should be done
+  // before the Actor is started. With MailboxPolicy::kBlock, an Actor must not
+  // send messages to itself.
+  void setMailboxPolicy(MailboxPolicy p) { _mailbox.setPolicy(p); }
+
+  // when coalescing, a new message replaces the value of any waiting message with
+  // the same address. This should be set before the Actor is started.
+  void setMailboxCoalescing(bool b) { _mailbox.setCoalescing(b); }
+
+  // timestamp each message so that the latencies of handled messages are measured.
+  void setLatencyTracking(bool b) { _mailbox.setLatencyTracking(b); }
+
+  MailboxMetrics getMailboxMetrics() { return _mailbox.getMetrics(); }
+
   // To make it clear that Actor is not a subclass of MessageReceiver, the virtual
   // handler method has a different name.
   virtual void onMessage(Message m) = 0;
@@ -76,28 +208,45 @@ class Actor
   Actor& operator=(Actor const&) = delete;  // Copy assign
   Actor& operator=(Actor&&) = delete;       // Move assign
 
+  // start polling the queue with a Timer. Messages are handled in the Timers thread
+  // after a delay of up to the given interval.
   void start(size_t interval = kDefaultMessageInterval)
   {
-    // we currently attempt to handle all the messages in the queue.
+    // the mailbox has a single consumer, so stop any other way of handling messages
+    // first. We currently attempt to handle all the messages in the queue.
     // in the future we may want to do just a few at a time instead.
+    stop();
     _queueTimer.start([=]() { handleMessagesInQueue(); }, milliseconds(interval));
   }
 
-  void stop() { _queueTimer.stop(); }
+  // start handling messages as soon as they arrive, in a thread owned by this Actor.
+  // If coalesceTime is nonzero, the Actor waits that long after being woken before
+  // handling the queue, so that bursts of messages are handled together.
+  void startEventDriven(microseconds coalesceTime = microseconds(0));
 
-  // enqueueMessage just pushes the message onto the queue.
+  // handle messages on the worker threads of the given scheduler, at most
+  // maxMessagesPerTurn at a time before letting other Actors run.
+  void startOnScheduler(ActorScheduler& scheduler,
+                        size_t maxMessagesPerTurn = kDefaultMessagesPerTurn);
+
+  void stop();
+
+  // enqueueMessage just moves the message onto the queue.
   void enqueueMessage(Message m)
   {
-    // queue returns true unless full.
-    if (!(_messageQueue.push(m)))
+    // the mailbox returns true unless the message was dropped. If the policy is to
+    // block, we wait only as long as something is handling our messages.
+    if (!_mailbox.push(std::move(m), [this]() { return isRunning() && !_beingRemoved; }))
     {
       onFullQueue();
     }
+    wakeMessageThread();
+    scheduleIfNeeded();
   }
 
   void enqueueMessageList(const MessageList& ml)
   {
-    for (auto m : ml)
+    for (const auto& m : ml)
     {
       enqueueMessage(m);
     }
@@ -130,10 +279,59 @@ inline void removeActor(Actor* actorToRemove)
 inline void sendMessageToActor(Path actorName, Message m)
 {
   SharedResourcePointer<ActorRegistry> registry;
-  if (Actor* pActor = registry->getActor(actorName))
+  Actor* pActor;
   {
-    pActor->enqueueMessage(m);
+    ActorRegistry::ReadLock lock(*registry);
+    pActor = lock.getActor(actorName);
+    if (!pActor) return;
+    pActor->_sendersInProgress++;
   }
+
+  // the message is enqueued after releasing the ReadLock, because with
+  // MailboxPolicy::kBlock we may wait for the receiver, which might change the
+  // registry. Counting ourselves keeps the receiver from being removed meanwhile.
+  pActor->enqueueMessage(std::move(m));
+  pActor->_sendersInProgress--;
 }
 
+// A cached handle to a named Actor. The Path is looked up only when the registry
+// has changed since the last message was sent, so frequent senders can skip the
+// lookup entirely. An ActorRef can be used by one thread at a time.
+class ActorRef
+{
+  SharedResourcePointer<ActorRegistry> _registry;
+  Path _actorName;
+  Actor* _pActor{nullptr};
+  uint64_t _generation{~uint64_t(0)};
+
+ public:
+  ActorRef() = default;
+  explicit ActorRef(Path actorName) : _actorName(actorName) {}
+
+  Path getName() const { return _actorName; }
+
+  // send the message if the named Actor exists, returning true if it was sent.
+  bool sendMessage(Message m)
+  {
+    Actor* pActor;
+    {
+      ActorRegistry::ReadLock lock(*_registry);
+      auto generation = lock.getGeneration();
+      if (generation != _generation)
+      {
+        _pActor = lock.getActor(_actorName);
+        _generation = generation;
+      }
+      pActor = _pActor;
+      if (!pActor) return false;
+      pActor->_sendersInProgress++;
+    }
+
+    // as in sendMessageToActor(), enqueue without holding the ReadLock.
+    pActor->enqueueMessage(std::move(m));
+    pActor->_sendersInProgress--;
+    return true;
+  }
+};
+
 }  // namespace ml
@@ -0,0 +1,203 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#include "MLActorScheduler.h"
+
+#include <algorithm>
+
+#include "MLActor.h"
+
+using namespace ml;
+
+namespace
+{
+// the scheduler and index of the worker running in the current thread, if any, and
+// the Actor whose turn it is running.
+thread_local ActorScheduler* tCurrentScheduler{nullptr};
+thread_local size_t tWorkerIndex{0};
+thread_local Actor* tCurrentActor{nullptr};
+}  // namespace
+
+Actor* ActorScheduler::getCurrentActor() { return tCurrentActor; }
+
+void ActorScheduler::start(size_t nThreads)
+{
+  if (_running) return;
+  if (nThreads == 0)
+  {
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  _workers.clear();
+  for (size_t i = 0; i < nThreads; ++i)
+  {
+    _workers.emplace_back(std::unique_ptr<Worker>(new Worker));
+  }
+
+  _running = true;
+  for (size_t i = 0; i < nThreads; ++i)
+  {
+    _workers[i]->thread = std::thread{[=]() { runWorker(i); }};
+  }
+}
+
+void ActorScheduler::stop()
+{
+  if (!_running) return;
+  {
+    std::unique_lock<std::mutex> lock(_sleepMutex);
+    _running = false;
+  }
+  _wakeCondition.notify_all();
+
+  for (auto& w : _workers)
+  {
+    w->thread.join();
+  }
+
+  // drop any Actors still waiting. Their messages stay in their queues.
+  for (auto& w : _workers)
+  {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    for (auto pActor : w->readyActors)
+    {
+      pActor->_scheduled = false;
+      _readyCount--;
+    }
+    w->readyActors.clear();
+  }
+}
+
+void ActorScheduler::schedule(Actor* pActor)
+{
+  if (!_running || _workers.empty())
+  {
+    // nowhere to run: the Actor will be scheduled again by its next message.
+    pActor->_scheduled = false;
+    return;
+  }
+
+  size_t workerIndex = (tCurrentScheduler == this)
+                           ? tWorkerIndex
+                           : _nextWorker.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+  pushActor(workerIndex, pActor);
+}
+
+void ActorScheduler::pushActor(size_t workerIndex, Actor* pActor)
+{
+  {
+    auto& w = *_workers[workerIndex];
+    std::unique_lock<std::mutex> lock(w.mutex);
+    w.readyActors.push_back(pActor);
+    _readyCount++;
+  }
+
+  // wake a sleeping worker, if any. See runWorker() for the other half of this.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (_sleepingWorkers.load() > 0)
+  {
+    {
+      std::unique_lock<std::mutex> lock(_sleepMutex);
+    }
+    _wakeCondition.notify_one();
+  }
+}
+
+void ActorScheduler::remove(Actor* pActor)
+{
+  for (auto& w : _workers)
+  {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    auto& q = w->readyActors;
+    auto it = std::find(q.begin(), q.end(), pActor);
+    if (it != q.end())
+    {
+      q.erase(it);
+      _readyCount--;
+      pActor->_scheduled = false;
+    }
+  }
+}
+
+Actor* ActorScheduler::takeActor(size_t workerIndex)
+{
+  const size_t n = _workers.size();
+
+  // our own deque first, then steal from the others.
+  for (size_t i = 0; i < n; ++i)
+  {
+    auto& w = *_workers[(workerIndex + i) % n];
+    std::unique_lock<std::mutex> lock(w.mutex);
+    if (!w.readyActors.empty())
+    {
+      Actor* pActor;
+      if (i == 0)
+      {
+        pActor = w.readyActors.front();
+        w.readyActors.pop_front();
+      }
+      else
+      {
+        pActor = w.readyActors.back();
+        w.readyActors.pop_back();
+      }
+      _readyCount--;
+
+      // mark the turn while still holding the lock, so that Actor::stop() can't miss it.
+      pActor->_turnsInProgress++;
+      return pActor;
+    }
+  }
+  return nullptr;
+}
+
+void ActorScheduler::runActor(Actor* pActor)
+{
+  if (pActor->_scheduler.load() == this)
+  {
+    tCurrentActor = pActor;
+    pActor->handleMessagesInQueue(pActor->_maxMessagesPerTurn);
+    tCurrentActor = nullptr;
+  }
+
+  // give up our claim on the Actor, then check for messages that arrived in the
+  // meantime. A sender either sees _scheduled == false and schedules the Actor itself,
+  // or we see its message here.
+  pActor->_scheduled.store(false);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if ((pActor->_scheduler.load() == this) && (pActor->getMessagesAvailable() > 0) &&
+      !pActor->_scheduled.exchange(true))
+  {
+    pushActor(tWorkerIndex, pActor);
+  }
+
+  // this must be the last access to the Actor in the turn.
+  pActor->_turnsInProgress--;
+}
+
+void ActorScheduler::runWorker(size_t workerIndex)
+{
+  tCurrentScheduler = this;
+  tWorkerIndex = workerIndex;
+
+  while (_running)
+  {
+    if (Actor* pActor = takeActor(workerIndex))
+    {
+      runActor(pActor);
+      continue;
+    }
+
+    // nothing to do: sleep until an Actor is scheduled. We announce that we are
+    // sleeping before checking _readyCount, and pushActor() counts the Actor before
+    // checking _sleepingWorkers, so one of us is guaranteed to see the other.
+    std::unique_lock<std::mutex> lock(_sleepMutex);
+    _sleepingWorkers++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    _wakeCondition.wait(lock, [&]() { return !_running || _readyCount.load() > 0; });
+    _sleepingWorkers--;
+  }
+
+  tCurrentScheduler = nullptr;
+}
@@ -0,0 +1,83 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ActorScheduler runs Actors that have messages waiting on a fixed pool of worker
+// threads, so that a slow Actor doesn't hold up all the others.
+//
+// Each worker has its own deque of ready Actors. Actors made ready from a worker
+// thread, for example by a message sent from another Actor's onMessage(), go onto that
+// worker's deque. Actors made ready from other threads are spread over the workers.
+// A worker takes Actors from the front of its own deque, and when that is empty it
+// steals from the back of the other workers' deques.
+//
+// An Actor is only ever in one deque or being run by one worker, so each Actor's
+// onMessage() is called serially. Each turn handles at most the Actor's
+// maxMessagesPerTurn messages, after which the Actor goes to the back of the deque if
+// it still has messages waiting.
+
+namespace ml
+{
+class Actor;
+
+class ActorScheduler
+{
+  friend class Actor;
+
+ public:
+  ActorScheduler() = default;
+  ~ActorScheduler() { stop(); }
+
+  ActorScheduler(ActorScheduler const&) = delete;
+  ActorScheduler& operator=(ActorScheduler const&) = delete;
+
+  // start the worker threads. If nThreads is 0, one thread per hardware thread is used.
+  // start() and stop() should not be called while Actors are being scheduled.
+  void start(size_t nThreads = 0);
+  void stop();
+
+  bool isRunning() const { return _running; }
+  size_t getNumThreads() const { return _workers.size(); }
+
+ private:
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Actor*> readyActors;
+    std::thread thread;
+  };
+
+  // called by Actors.
+  void schedule(Actor* pActor);
+  void remove(Actor* pActor);
+
+  // the Actor whose turn is running on the current thread, or nullptr.
+  static Actor* getCurrentActor();
+
+  void runWorker(size_t workerIndex);
+  Actor* takeActor(size_t workerIndex);
+  void runActor(Actor* pActor);
+  void pushActor(size_t workerIndex, Actor* pActor);
+
+  std::vector<std::unique_ptr<Worker> > _workers;
+  std::atomic<bool> _running{false};
+  std::atomic<size_t> _nextWorker{0};
+
+  // the number of Actors in all the deques, and the number of sleeping workers.
+  std::atomic<size_t> _readyCount{0};
+  std::atomic<size_t> _sleepingWorkers{0};
+  std::mutex _sleepMutex;
+  std::condition_variable _wakeCondition;
+};
+
+}  // namespace ml
@@ -258,13 +258,19 @@ void EventsToSignals::addEvent(const Event& e)
   _eventQueue.push(e);
 }
 
+void EventsToSignals::addEvent(Event&& e)
+{
+  _eventQueue.push(std::move(e));
+}
+
 void EventsToSignals::process()
 {
   for(auto& v : voices)
   {
     v.beginProcess(_sampleRate);
   }
-  while(Event e = _eventQueue.pop())
+  Event e;
+  while(_eventQueue.pop(e) && e)
   {
     processEvent(e);
   }
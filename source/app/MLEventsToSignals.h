@@ -158,6 +158,7 @@ public:
 
   // add an event to the queue.
   void addEvent(const Event& e);
+  void addEvent(Event&& e);
   
   // process all events in queue and generate output signals.
   void process();
@@ -0,0 +1,462 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "MLPath.h"
+#include "MLValue.h"
+
+// A FlatTree is a map from Paths to values with the same interface and iteration
+// order as Tree, stored in a way that is faster to look up. Instead of a std::map
+// at each node, the children of each node are kept in small vectors sorted by
+// the comparator. Nodes with only a few children are searched linearly, and
+// larger ones through an open addressing hash table. Nodes are allocated from
+// chunks owned by the tree, so they stay close together in memory and never
+// move: pointers returned by getNode() and add() remain valid until the tree is
+// cleared or destroyed. An empty tree allocates nothing.
+//
+// Unlike a Tree, whose nodes are Trees themselves, the nodes of a FlatTree are of
+// the class FlatTree::Node, which offers read access to the node and lookups
+// relative to it.
+
+namespace ml
+{
+template <class V, class C = std::less<Symbol> >
+class FlatTree
+{
+ public:
+  class Node;
+
+  class Node
+  {
+    friend class FlatTree<V, C>;
+
+   public:
+    bool hasValue() const { return _value != V(); }
+    const V& getValue() const { return _value; }
+    bool isLeaf() const { return _children.empty(); }
+
+    // find a node at the specified path relative to this one, or return nullptr.
+    const Node* getConstNode(Path path) const
+    {
+      auto pNode = this;
+      for (Symbol key : path)
+      {
+        pNode = pNode->findChild(key);
+        if (!pNode) return nullptr;
+      }
+      return pNode;
+    }
+
+   private:
+    // nodes with more children than this keep a hash index of them.
+    static constexpr size_t kMinIndexedChildren{8};
+
+    // return the index of the first child with a key not less than the given key.
+    size_t lowerBound(Symbol key) const
+    {
+      return std::lower_bound(_keys.begin(), _keys.end(), key, C()) - _keys.begin();
+    }
+
+    size_t getHomeSlot(Symbol key) const
+    {
+      // Fibonacci hashing of the symbol ID.
+      uint64_t h = key.getID();
+      return (h * 0x9E3779B97F4A7C15ull) >> (64 - _indexBits);
+    }
+
+    Node* findChild(Symbol key) const
+    {
+      if (_index.empty())
+      {
+        for (size_t i = 0; i < _keys.size(); ++i)
+        {
+          if (_keys[i] == key) return _children[i];
+        }
+        return nullptr;
+      }
+
+      // the index is at most half full, so probe sequences are short.
+      size_t mask = _index.size() - 1;
+      for (size_t slot = getHomeSlot(key); _index[slot]; slot = (slot + 1) & mask)
+      {
+        if (_index[slot]->_key == key) return _index[slot];
+      }
+      return nullptr;
+    }
+
+    void insertChild(size_t i, Node* pChild)
+    {
+      _keys.insert(_keys.begin() + i, pChild->_key);
+      _children.insert(_children.begin() + i, pChild);
+      if (_keys.size() <= kMinIndexedChildren) return;
+
+      // the index refers to the children themselves, which don't move, so a new
+      // child is simply added to it until it has to grow.
+      if (_keys.size() * 2 > _index.size())
+      {
+        rebuildIndex();
+      }
+      else
+      {
+        addToIndex(pChild);
+      }
+    }
+
+    void addToIndex(Node* pChild)
+    {
+      size_t mask = _index.size() - 1;
+      size_t slot = getHomeSlot(pChild->_key);
+      while (_index[slot])
+      {
+        slot = (slot + 1) & mask;
+      }
+      _index[slot] = pChild;
+    }
+
+    // make an index with room for twice as many children as there are now.
+    void rebuildIndex()
+    {
+      _indexBits = 1;
+      while ((size_t(1) << _indexBits) < _keys.size() * 4)
+      {
+        _indexBits++;
+      }
+      _index.assign(size_t(1) << _indexBits, nullptr);
+      for (Node* pChild : _children)
+      {
+        addToIndex(pChild);
+      }
+    }
+
+    // the node's own key, the keys of the children in sorted order, the child
+    // nodes in the same order, and for larger nodes an open addressing hash table
+    // of the children, where nullptr marks an empty slot.
+    Symbol _key;
+    V _value{};
+    std::vector<Symbol> _keys;
+    std::vector<Node*> _children;
+    std::vector<Node*> _index;
+    size_t _indexBits{0};
+  };
+
+  FlatTree() = default;
+  FlatTree(V val) { getRootForWriting()->_value = std::move(val); }
+
+  FlatTree(const FlatTree& b)
+  {
+    if (b._pRoot) copyNode(*b._pRoot, *getRootForWriting());
+  }
+  FlatTree& operator=(const FlatTree& b)
+  {
+    if (this != &b)
+    {
+      clear();
+      if (b._pRoot) copyNode(*b._pRoot, *getRootForWriting());
+    }
+    return *this;
+  }
+
+  // moving a FlatTree moves its chunks, so pointers to its nodes stay valid. The
+  // moved-from tree is left empty.
+  FlatTree(FlatTree&& b) noexcept
+      : _chunks(std::move(b._chunks)), _nodesInLastChunk(b._nodesInLastChunk), _pRoot(b._pRoot)
+  {
+    b.clear();
+  }
+
+  FlatTree& operator=(FlatTree&& b) noexcept
+  {
+    if (this != &b)
+    {
+      _chunks = std::move(b._chunks);
+      _nodesInLastChunk = b._nodesInLastChunk;
+      _pRoot = b._pRoot;
+      b.clear();
+    }
+    return *this;
+  }
+
+  void clear() noexcept
+  {
+    _chunks.clear();
+    _nodesInLastChunk = kNodesPerChunk;
+    _pRoot = nullptr;
+  }
+
+  void combine(const FlatTree<V, C>& b)
+  {
+    for (auto it = b.begin(); it != b.end(); ++it)
+    {
+      add(it.getCurrentNodePath(), *it);
+    }
+  }
+
+  bool hasValue() const { return getRoot()->hasValue(); }
+  const V& getValue() const { return getRoot()->_value; }
+  bool isLeaf() const { return getRoot()->isLeaf(); }
+
+  // find a tree node at the specified path.
+  // if successful, return a pointer to the node. If unsuccessful, return
+  // nullptr.
+  const Node* getConstNode(Path path) const { return getRoot()->getConstNode(path); }
+  Node* getNode(Path path) const { return const_cast<Node*>(getRoot()->getConstNode(path)); }
+  const Node* getConstNode(PathID id) const { return getConstNode(id.getPath()); }
+  Node* getNode(PathID id) const { return getNode(id.getPath()); }
+
+  // if the path exists, returns a reference to the value in the tree at the
+  // path. else, add a new default object of our value type V.
+  V& operator[](Path p)
+  {
+    auto pNode = _pRoot ? getNode(p) : nullptr;
+    return pNode ? pNode->_value : add(p, V())->_value;
+  }
+
+  // if the path exists, returns a const reference to the value in the tree at
+  // the path. Otherwise, reference to a null valued object is returned.
+  const V& operator[](Path p) const
+  {
+    static V nullValue{};
+    auto pNode = getConstNode(p);
+    return pNode ? pNode->_value : nullValue;
+  }
+
+  V& operator[](PathID id) { return operator[](id.getPath()); }
+  const V& operator[](PathID id) const { return operator[](id.getPath()); }
+
+  // compare two FlatTrees by value.
+  inline bool operator==(const FlatTree<V, C>& b) const
+  {
+    auto itA = begin();
+    auto itB = b.begin();
+    for (; (itA != end()) && (itB != b.end()); ++itA, ++itB)
+    {
+      if (itA.getCurrentNodeName() != itB.getCurrentNodeName()) return false;
+      if (*itA != *itB) return false;
+    }
+    return (itA == end()) && (itB == b.end());
+  }
+
+  inline bool operator!=(const FlatTree<V, C>& b) const { return !(operator==(b)); }
+
+  // write a value V to the tree such that getValue(path) will return V.
+  // add any intermediate nodes necessary in order to put it there.
+  // a pointer to the existing or new tree node is returned.
+  Node* add(Path path, V val)
+  {
+    Node* pNode = getRootForWriting();
+    for (Symbol key : path)
+    {
+      size_t i = pNode->lowerBound(key);
+      if ((i == pNode->_keys.size()) || C()(key, pNode->_keys[i]))
+      {
+        Node* pChild = newNode();
+        pChild->_key = key;
+        pNode->insertChild(i, pChild);
+      }
+      pNode = pNode->_children[i];
+    }
+    pNode->_value = std::move(val);
+    return pNode;
+  }
+
+  Node* add(PathID id, V val) { return add(id.getPath(), std::move(val)); }
+
+  // NOTE like Tree's, this iterator is only for simple begin(), end() loops.
+  // It visits each node with a value, parents before children and siblings in
+  // the order of the comparator.
+
+  class const_iterator
+  {
+    struct Frame
+    {
+      const Node* pParent;
+      size_t childIndex;
+    };
+    std::vector<Frame> _stack;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = const V;
+    using difference_type = int;
+    using pointer = const V*;
+    using reference = const V&;
+
+    const_iterator() {}
+    const_iterator(const Node* p, size_t childIndex) { _stack.push_back(Frame{p, childIndex}); }
+
+    bool operator==(const const_iterator& b) const
+    {
+      if (_stack.size() != b._stack.size()) return false;
+      if (_stack.empty()) return true;
+      return (_stack.back().pParent == b._stack.back().pParent) &&
+             (_stack.back().childIndex == b._stack.back().childIndex);
+    }
+
+    bool operator!=(const const_iterator& b) const { return !(*this == b); }
+
+    const V& operator*() const { return getCurrentNode()->_value; }
+
+    bool atEndOfMap() const
+    {
+      return _stack.back().childIndex == _stack.back().pParent->_children.size();
+    }
+
+    // advance to the next node that has a value
+    const const_iterator& operator++()
+    {
+      do
+      {
+        Frame& current = _stack.back();
+        if (!atEndOfMap())
+        {
+          const Node* pChild = getCurrentNode();
+          if (!pChild->isLeaf())
+          {
+            // down
+            _stack.push_back(Frame{pChild, 0});
+          }
+          else
+          {
+            // across
+            current.childIndex++;
+          }
+        }
+        else
+        {
+          if (_stack.size() > 1)
+          {
+            // up
+            _stack.pop_back();
+            _stack.back().childIndex++;
+          }
+          else
+          {
+            break;
+          }
+        }
+      } while (!currentNodeHasValue());
+      return *this;
+    }
+
+    bool currentNodeHasValue() const { return !atEndOfMap() && getCurrentNode()->hasValue(); }
+
+    // return the last symbol of the current node path.
+    Symbol getCurrentNodeName() const
+    {
+      const Frame& f = _stack.back();
+      return f.pParent->_keys[f.childIndex];
+    }
+
+    // return entire path to the current node.
+    Path getCurrentNodePath() const
+    {
+      Path p;
+      for (const Frame& f : _stack)
+      {
+        p = Path{p, f.pParent->_keys[f.childIndex]};
+      }
+      return p;
+    }
+
+    size_t getCurrentDepth() const { return _stack.size() - 1; }
+
+   private:
+    const Node* getCurrentNode() const
+    {
+      const Frame& f = _stack.back();
+      return f.pParent->_children[f.childIndex];
+    }
+  };
+
+  inline const_iterator begin() const
+  {
+    auto it = const_iterator(getRoot(), 0);
+    while (!it.currentNodeHasValue() && !it.atEndOfMap())
+    {
+      ++it;
+    }
+    return it;
+  }
+
+  inline const_iterator end() const
+  {
+    return const_iterator(getRoot(), getRoot()->_children.size());
+  }
+
+  inline void dump() const
+  {
+    for (auto it = begin(); it != end(); ++it)
+    {
+      std::cout << it.getCurrentNodePath() << " [" << *it << "] \n";
+    }
+  }
+
+  inline size_t size() const
+  {
+    size_t sum{hasValue()};
+    for (auto it = begin(); it != end(); ++it)
+    {
+      sum++;
+    }
+    return sum;
+  }
+
+ private:
+  static constexpr size_t kNodesPerChunk{256};
+
+  // an empty tree has no root node, and reads from it see this one instead.
+  static const Node* getEmptyNode()
+  {
+    static const Node emptyNode;
+    return &emptyNode;
+  }
+
+  const Node* getRoot() const { return _pRoot ? _pRoot : getEmptyNode(); }
+
+  Node* getRootForWriting()
+  {
+    if (!_pRoot) _pRoot = newNode();
+    return _pRoot;
+  }
+
+  Node* newNode()
+  {
+    if (_nodesInLastChunk == kNodesPerChunk)
+    {
+      _chunks.emplace_back(new Node[kNodesPerChunk]);
+      _nodesInLastChunk = 0;
+    }
+    return &_chunks.back()[_nodesInLastChunk++];
+  }
+
+  void copyNode(const Node& src, Node& dest)
+  {
+    dest._key = src._key;
+    dest._value = src._value;
+    dest._keys = src._keys;
+    dest._children.reserve(src._children.size());
+    for (const Node* pChild : src._children)
+    {
+      dest._children.push_back(newNode());
+      copyNode(*pChild, *dest._children.back());
+    }
+
+    // the index refers to the new children.
+    if (!src._index.empty()) dest.rebuildIndex();
+  }
+
+  std::vector<std::unique_ptr<Node[]> > _chunks;
+  size_t _nodesInLastChunk{kNodesPerChunk};
+  Node* _pRoot{nullptr};
+};
+
+}  // namespace ml
@@ -0,0 +1,219 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#include "MLMailbox.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace ml;
+
+// MailboxMetrics
+
+microseconds MailboxMetrics::getLatencyPercentile(double fraction) const
+{
+  uint64_t total{0};
+  for (auto n : latencyHistogram)
+  {
+    total += n;
+  }
+  if (!total) return microseconds(0);
+
+  uint64_t target = static_cast<uint64_t>(fraction * total);
+  uint64_t sum{0};
+  for (size_t i = 0; i < kLatencyBuckets; ++i)
+  {
+    sum += latencyHistogram[i];
+    if (sum > target) return microseconds(uint64_t(1) << i);
+  }
+  return microseconds(uint64_t(1) << (kLatencyBuckets - 1));
+}
+
+std::ostream& ml::operator<<(std::ostream& out, const MailboxMetrics& m)
+{
+  out << "depth " << m.depth << "/" << m.capacity << ", high " << m.highWaterMark;
+  out << ", enqueued " << m.enqueued << ", handled " << m.handled;
+  out << ", dropped " << m.dropped << ", coalesced " << m.coalesced;
+  auto flags = out.flags();
+  auto precision = out.precision();
+  out << ", " << std::fixed << std::setprecision(1) << m.messagesPerSecond << " msg/s";
+  out.flags(flags);
+  out.precision(precision);
+  if (auto p50 = m.getLatencyPercentile(0.5).count())
+  {
+    out << ", latency p50 < " << p50 << "us, p99 < " << m.getLatencyPercentile(0.99).count()
+        << "us";
+  }
+  return out;
+}
+
+// Mailbox
+
+MailboxMetrics Mailbox::getMetrics()
+{
+  MailboxMetrics m;
+  m.capacity = _capacity;
+  m.depth = elementsAvailable();
+  m.highWaterMark = _highWaterMark.load(std::memory_order_relaxed);
+  m.enqueued = _enqueued.load(std::memory_order_relaxed);
+  m.handled = _handled.load(std::memory_order_relaxed);
+  m.dropped = _dropped.load(std::memory_order_relaxed);
+  m.coalesced = _coalesced.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < MailboxMetrics::kLatencyBuckets; ++i)
+  {
+    m.latencyHistogram[i] = _latencyHistogram[i].load(std::memory_order_relaxed);
+  }
+
+  std::unique_lock<std::mutex> lock(_rateMutex);
+  auto now = steady_clock::now();
+  double seconds = duration_cast<duration<double> >(now - _previousRateTime).count();
+  if (seconds > 0.)
+  {
+    m.messagesPerSecond = (m.handled - _previousHandled) / seconds;
+  }
+  _previousRateTime = now;
+  _previousHandled = m.handled;
+  return m;
+}
+
+void Mailbox::setCoalescing(bool b)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (b && _waiting.empty())
+  {
+    // the index is at most half full, which keeps probe sequences short.
+    _waiting.resize(_capacity);
+    _waitingIndexBits = 1;
+    while ((size_t(1) << _waitingIndexBits) < _capacity * 2)
+    {
+      _waitingIndexBits++;
+    }
+    _waitingIndex.assign(size_t(1) << _waitingIndexBits, -1);
+  }
+  _coalescing = b;
+}
+
+Mailbox::PushResult Mailbox::pushDroppingOldest(Entry& e)
+{
+  Entry oldest;
+  if (_coalescing)
+  {
+    if (popCoalescing(oldest)) increment(_dropped);
+    return pushCoalescing(e);
+  }
+
+  // the consumer holds the mutex while popping, so we can pop here too.
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (_queue.pop(oldest)) increment(_dropped);
+  return _queue.push(std::move(e)) ? PushResult::kPushed : PushResult::kFull;
+}
+
+Mailbox::PushResult Mailbox::pushCoalescingWhenFull(Entry& e)
+{
+  // in coalescing mode, the push already failed to find a waiting message.
+  if (_coalescing) return PushResult::kFull;
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  PathID address = e.message.address;
+  if (Entry* pWaiting =
+          _queue.findLast([&](const Entry& w) { return w.message.address == address; }))
+  {
+    pWaiting->message.value = std::move(e.message.value);
+    pWaiting->message.flags = e.message.flags;
+    return PushResult::kCoalesced;
+  }
+  return PushResult::kFull;
+}
+
+size_t Mailbox::getHomeSlot(PathID address) const
+{
+  // Fibonacci hashing of the address ID.
+  uint64_t h = address.getID();
+  return (h * 0x9E3779B97F4A7C15ull) >> (64 - _waitingIndexBits);
+}
+
+// return the slot in the index that refers to the waiting entry with the given
+// address, or the empty slot where it would go.
+size_t Mailbox::findIndexSlot(PathID address) const
+{
+  size_t mask = _waitingIndex.size() - 1;
+  size_t slot = getHomeSlot(address);
+  while (_waitingIndex[slot] >= 0)
+  {
+    if (_waiting[_waitingIndex[slot]].message.address == address) break;
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void Mailbox::eraseIndexSlot(size_t slot)
+{
+  // with linear probing, entries after the erased one may need to move back so
+  // that they can still be found from their home slots.
+  size_t mask = _waitingIndex.size() - 1;
+  size_t next = slot;
+  while (true)
+  {
+    next = (next + 1) & mask;
+    if (_waitingIndex[next] < 0) break;
+    size_t home = getHomeSlot(_waiting[_waitingIndex[next]].message.address);
+    bool canStay = (slot <= next) ? ((home > slot) && (home <= next))
+                                  : ((home > slot) || (home <= next));
+    if (!canStay)
+    {
+      _waitingIndex[slot] = _waitingIndex[next];
+      slot = next;
+    }
+  }
+  _waitingIndex[slot] = -1;
+}
+
+Mailbox::PushResult Mailbox::pushCoalescing(Entry& e)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  size_t slot = findIndexSlot(e.message.address);
+  if (_waitingIndex[slot] >= 0)
+  {
+    Message& waiting = _waiting[_waitingIndex[slot]].message;
+    waiting.value = std::move(e.message.value);
+    waiting.flags = e.message.flags;
+    return PushResult::kCoalesced;
+  }
+
+  size_t count = _waitingCount.load(std::memory_order_relaxed);
+  if (count == _capacity) return PushResult::kFull;
+
+  size_t position = (_waitingStart + count) % _capacity;
+  _waiting[position] = std::move(e);
+  _waitingIndex[slot] = static_cast<int32_t>(position);
+  _waitingCount.store(count + 1);
+  return PushResult::kPushed;
+}
+
+bool Mailbox::popCoalescing(Entry& e)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  size_t count = _waitingCount.load(std::memory_order_relaxed);
+  if (!count) return false;
+
+  eraseIndexSlot(findIndexSlot(_waiting[_waitingStart].message.address));
+  e = std::move(_waiting[_waitingStart]);
+  _waitingStart = (_waitingStart + 1) % _capacity;
+  _waitingCount.store(count - 1);
+  return true;
+}
+
+void Mailbox::recordLatency(nanoseconds latency)
+{
+  // the bucket index is the number of bits in the latency in microseconds.
+  auto us = static_cast<uint64_t>(std::max(duration_cast<microseconds>(latency).count(),
+                                           microseconds::rep(0)));
+  size_t bucket{0};
+  while (us && (bucket < MailboxMetrics::kLatencyBuckets - 1))
+  {
+    us >>= 1;
+    bucket++;
+  }
+  increment(_latencyHistogram[bucket]);
+}
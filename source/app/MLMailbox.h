@@ -0,0 +1,255 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MLMessage.h"
+#include "MLQueue.h"
+
+// A Mailbox is the message queue of an Actor. It wraps a single-producer,
+// single-consumer Queue of Messages, adds a choice of what to do when the queue
+// is full, and keeps metrics so that queue sizes can be tuned. It can also
+// coalesce messages to the same address, for receivers such as parameter
+// controllers that only care about the latest value.
+//
+// The counters are cheap enough to be always on. Latency tracking requires a
+// timestamp for each message and is off by default.
+
+using namespace std::chrono;
+
+namespace ml
+{
+// What a Mailbox does with a new message when it is full.
+enum class MailboxPolicy
+{
+  kDropNewest,  // drop the new message. The default.
+  kBlock,       // wait for the receiver to make room.
+  kDropOldest,  // drop the oldest waiting message to make room.
+  kCoalesce     // replace the value of the newest waiting message with the same
+                // address, or if there is none drop the new message.
+};
+
+struct MailboxMetrics
+{
+  // latencyHistogram[0] counts messages handled less than 1 microsecond after
+  // being sent, and latencyHistogram[i] those handled in [2^(i-1), 2^i)
+  // microseconds. The last bucket also counts all slower messages.
+  static constexpr size_t kLatencyBuckets{24};
+
+  size_t capacity{0};
+  size_t depth{0};
+  size_t highWaterMark{0};
+  uint64_t enqueued{0};
+  uint64_t handled{0};
+  uint64_t dropped{0};
+  uint64_t coalesced{0};
+
+  // messages handled per second since the previous call to getMetrics().
+  double messagesPerSecond{0};
+
+  std::array<uint64_t, kLatencyBuckets> latencyHistogram{};
+
+  // return an upper bound on the latency of the given fraction of messages,
+  // or zero if no latencies have been recorded.
+  microseconds getLatencyPercentile(double fraction) const;
+};
+
+std::ostream& operator<<(std::ostream& out, const MailboxMetrics& m);
+
+class Mailbox
+{
+ public:
+  explicit Mailbox(size_t capacity) : _queue(capacity), _capacity(_queue.size() - 1) {}
+
+  Mailbox(Mailbox const&) = delete;
+  Mailbox& operator=(Mailbox const&) = delete;
+
+  // the policy should be set before any messages are sent.
+  void setPolicy(MailboxPolicy p) { _policy = p; }
+  MailboxPolicy getPolicy() const { return _policy; }
+
+  void setLatencyTracking(bool b) { _trackLatency = b; }
+
+  size_t elementsAvailable() const
+  {
+    return _coalescing ? _waitingCount.load() : _queue.elementsAvailable();
+  }
+
+  // In coalescing mode, a message to an address that already has a message waiting
+  // replaces the waiting message's value and flags, keeping its place in the queue.
+  // So messages to different addresses are still handled in the order in which
+  // they first arrived, but only the latest value for each address is handled.
+  // Coalescing uses a mutex, and should be set before any messages are sent.
+  void setCoalescing(bool b);
+  bool getCoalescing() const { return _coalescing; }
+
+  // push a message from the producer thread, returning true if it was added or
+  // coalesced and false if it was dropped. With MailboxPolicy::kBlock, while the
+  // Mailbox is full keepWaiting() is called repeatedly, and the message is dropped
+  // as soon as it returns false.
+  template <typename WaitFn>
+  bool push(Message&& m, WaitFn keepWaiting)
+  {
+    Entry e{std::move(m), _trackLatency ? steady_clock::now() : time_point<steady_clock>()};
+    auto result = tryPush(e);
+    if (result == PushResult::kFull)
+    {
+      switch (_policy.load())
+      {
+        case MailboxPolicy::kDropNewest:
+          break;
+
+        case MailboxPolicy::kBlock:
+          while (((result = tryPush(e)) == PushResult::kFull) && keepWaiting())
+          {
+            std::this_thread::yield();
+          }
+          break;
+
+        case MailboxPolicy::kDropOldest:
+          result = pushDroppingOldest(e);
+          break;
+
+        case MailboxPolicy::kCoalesce:
+          result = pushCoalescingWhenFull(e);
+          break;
+      }
+    }
+
+    switch (result)
+    {
+      case PushResult::kPushed:
+      {
+        increment(_enqueued);
+        size_t depth = elementsAvailable();
+        if (depth > _highWaterMark.load(std::memory_order_relaxed))
+        {
+          _highWaterMark.store(depth, std::memory_order_relaxed);
+        }
+        break;
+      }
+      case PushResult::kCoalesced:
+        increment(_coalesced);
+        break;
+      case PushResult::kFull:
+        increment(_dropped);
+        break;
+    }
+    return result != PushResult::kFull;
+  }
+
+  // pop the next message from the consumer thread.
+  bool pop(Message& m)
+  {
+    if (_coalescing)
+    {
+      if (!popCoalescing(_poppedEntry)) return false;
+    }
+    else
+    {
+      std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+      if (producerMayPop()) lock.lock();
+      if (!_queue.pop(_poppedEntry)) return false;
+    }
+    m = std::move(_poppedEntry.message);
+    increment(_handled);
+    if (_poppedEntry.sendTime != time_point<steady_clock>())
+    {
+      recordLatency(steady_clock::now() - _poppedEntry.sendTime);
+    }
+    return true;
+  }
+
+  MailboxMetrics getMetrics();
+
+ private:
+  struct Entry
+  {
+    Message message;
+    time_point<steady_clock> sendTime;
+  };
+
+  enum class PushResult
+  {
+    kPushed,
+    kCoalesced,
+    kFull
+  };
+
+  // try to push the entry, moving from it only if the result is not kFull.
+  PushResult tryPush(Entry& e)
+  {
+    if (_coalescing) return pushCoalescing(e);
+    return _queue.push(std::move(e)) ? PushResult::kPushed : PushResult::kFull;
+  }
+
+  PushResult pushDroppingOldest(Entry& e);
+  PushResult pushCoalescingWhenFull(Entry& e);
+
+  // coalescing mode: a ring of waiting entries in arrival order, and an open
+  // addressing hash table from addresses to positions in the ring.
+  PushResult pushCoalescing(Entry& e);
+  bool popCoalescing(Entry& e);
+  size_t getHomeSlot(PathID address) const;
+  size_t findIndexSlot(PathID address) const;
+  void eraseIndexSlot(size_t slot);
+
+  // each counter is written by only one of the producer or consumer, so it
+  // can be incremented without a read-modify-write operation.
+  static void increment(std::atomic<uint64_t>& counter)
+  {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  // with these policies the producer modifies the waiting messages in the Queue
+  // when it is full, so the consumer must hold the mutex while popping.
+  bool producerMayPop() const
+  {
+    auto p = _policy.load(std::memory_order_relaxed);
+    return (p == MailboxPolicy::kDropOldest) || (p == MailboxPolicy::kCoalesce);
+  }
+
+  void recordLatency(nanoseconds latency);
+
+  Queue<Entry> _queue;
+  const size_t _capacity;
+  std::atomic<MailboxPolicy> _policy{MailboxPolicy::kDropNewest};
+  std::atomic<bool> _trackLatency{false};
+  std::mutex _mutex;
+
+  // coalescing mode state, protected by _mutex.
+  std::atomic<bool> _coalescing{false};
+  std::vector<Entry> _waiting;
+  size_t _waitingStart{0};
+  std::atomic<size_t> _waitingCount{0};
+  std::vector<int32_t> _waitingIndex;
+  size_t _waitingIndexBits{0};
+
+  // used only by the consumer.
+  Entry _poppedEntry;
+
+  // metrics.
+  std::atomic<uint64_t> _enqueued{0};
+  std::atomic<uint64_t> _handled{0};
+  std::atomic<uint64_t> _dropped{0};
+  std::atomic<uint64_t> _coalesced{0};
+  std::atomic<size_t> _highWaterMark{0};
+  std::array<std::atomic<uint64_t>, MailboxMetrics::kLatencyBuckets> _latencyHistogram{};
+
+  // state for computing the rate of handled messages.
+  std::mutex _rateMutex;
+  time_point<steady_clock> _previousRateTime{steady_clock::now()};
+  uint64_t _previousHandled{0};
+};
+
+}  // namespace ml
@@ -10,17 +10,24 @@
 
 namespace ml
 {
+// The address of a Message is an interned PathID, so that Messages are cheap to
+// copy and their addresses quick to compare. Making a Message to an address that
+// has not been used before adds the address to the PathTable, which allocates.
+
 struct Message final
 {
   friend std::ostream& operator<<(std::ostream& out, const Message& r);
 
-  Path address{};
+  PathID address{};
   Value value{};
   uint32_t flags{0};
 
   Message(Path h = Path(), Value v = Value(), uint32_t f = 0) : address(h), value(v), flags(f) {}
+  Message(PathID h, Value v = Value(), uint32_t f = 0) : address(h), value(v), flags(f) {}
+
+  Path getAddressPath() const { return address.getPath(); }
 
-  explicit operator bool() const { return (address != Path()); }
+  explicit operator bool() const { return static_cast<bool>(address); }
 };
 
 enum flags
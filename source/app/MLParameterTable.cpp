@@ -0,0 +1,249 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#include "MLParameterTable.h"
+
+using namespace ml;
+
+void ParameterTable::compile(const ParameterDescriptionList& params)
+{
+  size_t n = params.size();
+  _names.assign(n, Path());
+  _IDsByName.clear();
+  _normalizedValues.assign(n, 0.f);
+  _realValues.assign(n, 0.f);
+  _defaultValues.assign(n, 0.f);
+  _types.assign(n, ProjectionType::kLinear);
+  _flags.assign(n, 0);
+  _start.assign(n, 0.f);
+  _end.assign(n, 1.f);
+  _scale.assign(n, 1.f);
+  _offset.assign(n, 0.f);
+  _logRatio.assign(n, 0.f);
+  _listStart.assign(n + 1, 0);
+  _listValues.clear();
+  for (auto& ids : _IDsByType)
+  {
+    ids.clear();
+  }
+  _integerIDs.clear();
+
+  for (size_t id = 0; id < n; ++id)
+  {
+    const ParameterDescription& p = *params[id];
+    _names[id] = Path(p.getTextProperty("name"));
+    if (_names[id]) _IDsByName[_names[id]] = id;
+
+    auto units = Symbol(p.getProperty("units").getTextValue());
+    Matrix range = p.getProperty("range").getMatrixValueWithDefault({0, 1});
+    _start[id] = range[0];
+    _end[id] = range[1];
+    _scale[id] = range[1] - range[0];
+    _offset[id] = p.getProperty("offset").getFloatValueWithDefault(0.f);
+
+    if (p.getBoolPropertyWithDefault("integer_values", false))
+    {
+      _flags[id] |= kIntegerValues;
+      _integerIDs.push_back(static_cast<uint32_t>(id));
+    }
+
+    if (units == "list")
+    {
+      // the item values are parsed here once, instead of on every conversion.
+      size_t nItems{0};
+      if (p.hasProperty("listitems"))
+      {
+        auto listItemsText = p.getTextProperty("listitems");
+        auto listItems = textUtils::split(TextView(listItemsText), '/');
+        nItems = listItems.size();
+        if (p.getBoolPropertyWithDefault("use_list_values_as_int", false))
+        {
+          _flags[id] |= kListValues;
+          for (auto item : listItems)
+          {
+            _listValues.push_back(static_cast<float>(textUtils::textToNaturalNumber(item)));
+          }
+        }
+      }
+      else if (p.hasProperty("num_items"))
+      {
+        nItems = p.getFloatProperty("num_items");
+      }
+      _types[id] = ProjectionType::kList;
+      _scale[id] = static_cast<float>(nItems);
+    }
+    else if (p.getProperty("log").getBoolValueWithDefault(false))
+    {
+      _types[id] = ProjectionType::kLog;
+      _logRatio[id] = logf(_end[id] / _start[id]);
+    }
+    else if (p.getProperty("bisquare").getBoolValueWithDefault(false))
+    {
+      _types[id] = ProjectionType::kBisquare;
+    }
+    _listStart[id + 1] = static_cast<uint32_t>(_listValues.size());
+    _IDsByType[static_cast<size_t>(_types[id])].push_back(static_cast<uint32_t>(id));
+
+    // defaults, as in getNormalizedDefaultValue(). Text and blob defaults are
+    // not float values, so they are left at 0.
+    if (p.hasProperty("default"))
+    {
+      Value defaultVal = p.getProperty("default");
+      if (defaultVal.isFloatType()) _defaultValues[id] = defaultVal.getFloatValue();
+    }
+    else if (p.hasProperty("plaindefault"))
+    {
+      _defaultValues[id] = convertRealToNormalized(id, p.getFloatProperty("plaindefault"));
+    }
+    else if (p.hasProperty("range"))
+    {
+      _defaultValues[id] = 0.5f;
+    }
+  }
+  setDefaults();
+}
+
+float ParameterTable::listItemToReal(size_t id, size_t item) const
+{
+  size_t i = _listStart[id] + item;
+  return (i < _listStart[id + 1]) ? _listValues[i] : 0.f;
+}
+
+float ParameterTable::convertNormalizedToReal(size_t id, float x) const
+{
+  float r{0.f};
+  switch (_types[id])
+  {
+    case ProjectionType::kLinear:
+      r = _scale[id] * x + _start[id];
+      break;
+    case ProjectionType::kLog:
+      r = _start[id] * expf(x * _logRatio[id]) + _offset[id];
+      break;
+    case ProjectionType::kBisquare:
+    {
+      float y = _scale[id] * x + _start[id];
+      r = fabsf(y) * y;
+      break;
+    }
+    case ProjectionType::kList:
+    {
+      float nItems = _scale[id];
+      float item = floorf(ml::clamp(x * nItems, 0.f, std::max(nItems - 1.f, 0.f)));
+      r = (_flags[id] & kListValues) ? listItemToReal(id, static_cast<size_t>(item)) : item;
+      break;
+    }
+  }
+  return (_flags[id] & kIntegerValues) ? static_cast<int>(r) : r;
+}
+
+float ParameterTable::convertRealToNormalized(size_t id, float x) const
+{
+  switch (_types[id])
+  {
+    case ProjectionType::kLinear:
+      return (x - _start[id]) / _scale[id];
+    case ProjectionType::kLog:
+      return logf((x - _offset[id]) / _start[id]) / _logRatio[id];
+    case ProjectionType::kBisquare:
+      return (sqrtf(fabsf(x)) * ml::sign(x) - _start[id]) / _scale[id];
+    case ProjectionType::kList:
+    {
+      float stepCount = _scale[id] - 1.f;
+      if (stepCount <= 0.f) return 0.f;
+      if (!(_flags[id] & kListValues)) return x / stepCount;
+
+      // find the item with the given value.
+      for (size_t i = _listStart[id]; i < _listStart[id + 1]; ++i)
+      {
+        if (_listValues[i] == x) return (i - _listStart[id]) / stepCount;
+      }
+      return 0.f;
+    }
+  }
+  return 0.f;
+}
+
+void ParameterTable::convertNormalizedToReal(const float* pNormalized, float* pReal) const
+{
+  // each type of projection is done in its own loop, without branches for the
+  // common types.
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kLinear)])
+  {
+    pReal[id] = _scale[id] * pNormalized[id] + _start[id];
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kLog)])
+  {
+    pReal[id] = _start[id] * expf(pNormalized[id] * _logRatio[id]) + _offset[id];
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kBisquare)])
+  {
+    float y = _scale[id] * pNormalized[id] + _start[id];
+    pReal[id] = fabsf(y) * y;
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kList)])
+  {
+    pReal[id] = convertNormalizedToReal(id, pNormalized[id]);
+  }
+  for (auto id : _integerIDs)
+  {
+    pReal[id] = static_cast<int>(pReal[id]);
+  }
+}
+
+void ParameterTable::convertRealToNormalized(const float* pReal, float* pNormalized) const
+{
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kLinear)])
+  {
+    pNormalized[id] = (pReal[id] - _start[id]) / _scale[id];
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kLog)])
+  {
+    pNormalized[id] = logf((pReal[id] - _offset[id]) / _start[id]) / _logRatio[id];
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kBisquare)])
+  {
+    pNormalized[id] = convertRealToNormalized(id, pReal[id]);
+  }
+  for (auto id : _IDsByType[static_cast<size_t>(ProjectionType::kList)])
+  {
+    pNormalized[id] = convertRealToNormalized(id, pReal[id]);
+  }
+}
+
+void ParameterTable::setFromNormalizedValues(const float* pNormalized)
+{
+  std::copy(pNormalized, pNormalized + size(), _normalizedValues.begin());
+  convertNormalizedToReal(_normalizedValues.data(), _realValues.data());
+}
+
+void ParameterTable::setFromRealValues(const float* pReal)
+{
+  std::copy(pReal, pReal + size(), _realValues.begin());
+  convertRealToNormalized(_realValues.data(), _normalizedValues.data());
+}
+
+void ParameterTable::setFromNormalizedValues(const Tree<Value>& t)
+{
+  for (auto it = t.begin(); it != t.end(); ++it)
+  {
+    size_t id = getID(it.getCurrentNodePath());
+    if ((id != kNoParameter) && ((*it).getType() == Value::kFloatValue))
+    {
+      setFromNormalizedValue(id, (*it).getFloatValue());
+    }
+  }
+}
+
+void ParameterTable::setFromRealValues(const Tree<Value>& t)
+{
+  for (auto it = t.begin(); it != t.end(); ++it)
+  {
+    size_t id = getID(it.getCurrentNodePath());
+    if ((id != kNoParameter) && ((*it).getType() == Value::kFloatValue))
+    {
+      setFromRealValue(id, (*it).getFloatValue());
+    }
+  }
+}
@@ -0,0 +1,147 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "MLParameters.h"
+
+// A ParameterTable is a compiled form of a ParameterDescriptionList. Each
+// parameter gets an integer ID, its index in the list, and everything needed to
+// get, set and convert its values is kept in arrays indexed by ID: the
+// normalized and real values, the projection type and its constants, and for
+// list parameters a table of item values. So getting and setting values by ID
+// are O(1), with no tree lookups or text parsing, and all the parameters can be
+// converted at once.
+//
+// The conversions match those of a ParameterTree built from the same list. A
+// ParameterTable holds float values only: parameters with text or blob values
+// get IDs, but their values should be kept elsewhere.
+
+namespace ml
+{
+class ParameterTable
+{
+ public:
+  static constexpr size_t kNoParameter{SIZE_MAX};
+
+  ParameterTable() = default;
+  explicit ParameterTable(const ParameterDescriptionList& params) { compile(params); }
+
+  // replace the contents of the table with the given parameters, with their values
+  // set to the defaults.
+  void compile(const ParameterDescriptionList& params);
+
+  size_t size() const { return _names.size(); }
+
+  // return the ID of the named parameter, or kNoParameter if there is none.
+  size_t getID(PathID pname) const
+  {
+    auto it = _IDsByName.find(pname);
+    return (it != _IDsByName.end()) ? it->second : kNoParameter;
+  }
+
+  // a Path is looked up without adding it to the PathTable, so that unknown
+  // names don't grow the table.
+  size_t getID(Path pname) const
+  {
+    PathID id = PathID::find(pname);
+    return id ? getID(id) : kNoParameter;
+  }
+
+  Path getName(size_t id) const { return _names[id]; }
+
+  float getNormalizedFloatValue(size_t id) const { return _normalizedValues[id]; }
+  float getRealFloatValue(size_t id) const { return _realValues[id]; }
+
+  // a Value has no separate integer type, so this holds the same float as
+  // getRealFloatValue(). As in a ParameterTree, the real values of parameters with
+  // the property "integer_values" are whole numbers when set from normalized
+  // values, and are stored as given when set from real values.
+  Value getRealValue(size_t id) const { return Value(_realValues[id]); }
+
+  void setFromNormalizedValue(size_t id, float val)
+  {
+    _normalizedValues[id] = val;
+    _realValues[id] = convertNormalizedToReal(id, val);
+  }
+
+  void setFromRealValue(size_t id, float val)
+  {
+    _normalizedValues[id] = convertRealToNormalized(id, val);
+    _realValues[id] = val;
+  }
+
+  float convertNormalizedToReal(size_t id, float x) const;
+  float convertRealToNormalized(size_t id, float x) const;
+
+  // batch operations on all the parameters. The arrays have size() elements.
+  void convertNormalizedToReal(const float* pNormalized, float* pReal) const;
+  void convertRealToNormalized(const float* pReal, float* pNormalized) const;
+  void setFromNormalizedValues(const float* pNormalized);
+  void setFromRealValues(const float* pReal);
+
+  // set the values of the parameters in the tree, ignoring any unknown names or
+  // non-float values.
+  void setFromNormalizedValues(const Tree<Value>& t);
+  void setFromRealValues(const Tree<Value>& t);
+
+  void setDefaults() { setFromNormalizedValues(_defaultValues.data()); }
+
+  const std::vector<float>& getNormalizedValues() const { return _normalizedValues; }
+  const std::vector<float>& getRealValues() const { return _realValues; }
+  float getNormalizedDefaultValue(size_t id) const { return _defaultValues[id]; }
+
+ private:
+  enum class ProjectionType : uint8_t
+  {
+    kLinear,
+    kLog,
+    kBisquare,
+    kList
+  };
+  static constexpr size_t kProjectionTypes{4};
+
+  enum Flags : uint8_t
+  {
+    kIntegerValues = 1,
+    kListValues = 2
+  };
+
+  float listItemToReal(size_t id, size_t item) const;
+
+  std::vector<Path> _names;
+  std::unordered_map<PathID, size_t> _IDsByName;
+
+  std::vector<float> _normalizedValues;
+  std::vector<float> _realValues;
+  std::vector<float> _defaultValues;
+
+  // projections. For linear, log and bisquare projections _start and _end are
+  // the ends of the range and _scale is their difference. For log projections
+  // _logRatio is log(end / start). For lists, _scale is the number of items.
+  std::vector<ProjectionType> _types;
+  std::vector<uint8_t> _flags;
+  std::vector<float> _start;
+  std::vector<float> _end;
+  std::vector<float> _scale;
+  std::vector<float> _offset;
+  std::vector<float> _logRatio;
+
+  // for list parameters with the property "use_list_values_as_int", the values
+  // of their items. The items of parameter i are at [_listStart[i],
+  // _listStart[i + 1]).
+  std::vector<uint32_t> _listStart;
+  std::vector<float> _listValues;
+
+  // the IDs of the parameters with each type of projection, and of those with
+  // integer values, for batch conversion.
+  std::vector<uint32_t> _IDsByType[kProjectionTypes];
+  std::vector<uint32_t> _integerIDs;
+};
+
+}  // namespace ml
@@ -40,8 +40,8 @@ inline ParameterProjection createParameterProjection(const ParameterDescription&
     if (p.hasProperty("listitems"))
     {
       // read and count list items
-      auto listItems = textUtils::split(p.getTextProperty("listitems"), '/');
-      nItems = listItems.size();
+      auto listItemsText = p.getTextProperty("listitems");
+      nItems = textUtils::split(TextView(listItemsText), '/').size();
     }
     else if (p.hasProperty("num_items"))
     {
@@ -62,23 +62,29 @@ inline ParameterProjection createParameterProjection(const ParameterDescription&
   }
   else
   {
+    // each projection is composed at compile time, so that calling it is only a
+    // single indirect call.
     if(bLog)
     {
-      b.normalizedToReal =
-      compose(projections::add(offset), projections::intervalMap(normalRange, plainRange, projections::log(plainRange)));
-      
-      b.realToNormalized =
-      compose(projections::intervalMap(plainRange, normalRange, projections::exp(plainRange)), projections::add(-offset));
+      b.normalizedToReal = compose(
+          AddProjection(offset),
+          IntervalMapProjection(normalRange, plainRange, LogProjection(plainRange)));
+
+      b.realToNormalized = compose(
+          IntervalMapProjection(plainRange, normalRange, ExpProjection(plainRange)),
+          AddProjection(-offset));
     }
     else if(bisquare)
     {
-      b.normalizedToReal = compose(projections::bisquared, projections::linear(normalRange, plainRange));
-      b.realToNormalized = compose(projections::linear(plainRange, normalRange), projections::invBisquared);
+      b.normalizedToReal =
+          compose(BisquaredProjection(), LinearProjection(normalRange, plainRange));
+      b.realToNormalized =
+          compose(LinearProjection(plainRange, normalRange), InvBisquaredProjection());
     }
     else
     {
-      b.normalizedToReal = projections::linear(normalRange, plainRange);
-      b.realToNormalized = projections::linear(plainRange, normalRange);
+      b.normalizedToReal = LinearProjection(normalRange, plainRange);
+      b.realToNormalized = LinearProjection(plainRange, normalRange);
     }
   }
   return b;
@@ -103,7 +109,8 @@ public:
     bool useListValues = pdesc->getBoolPropertyWithDefault("use_list_values_as_int", false);
     if(useListValues)
     {
-      auto listItems = textUtils::split(pdesc->getTextProperty("listitems"), '/');
+      auto listItemsText = pdesc->getTextProperty("listitems");
+      auto listItems = textUtils::split(TextView(listItemsText), '/');
       size_t itemIndex = projections[pname].normalizedToReal(newNormValue);
       newRealValue = textUtils::textToNaturalNumber(listItems[itemIndex]);
     }
@@ -124,7 +131,8 @@ public:
     bool useListValues = pdesc->getBoolPropertyWithDefault("use_list_values_as_int", false);
     if(useListValues)
     {
-      auto listItems = textUtils::split(pdesc->getTextProperty("listitems"), '/');
+      auto listItemsText = pdesc->getTextProperty("listitems");
+      auto listItems = textUtils::split(TextView(listItemsText), '/');
       
       // get item matching plain value
       for(int i=0; i<listItems.size(); ++i)
@@ -265,6 +273,19 @@ public:
     }
   }
   
+  // handles to the values of a parameter, which stay valid as the values change.
+  // Reading a value through a handle is a pointer dereference. Get any handles
+  // before processing starts: getting a handle may add a node to the tree.
+  Tree< Value >::Handle getRealValueHandle(Path pname)
+  {
+    return paramsReal_.getHandle(pname);
+  }
+
+  Tree< Value >::Handle getNormalizedValueHandle(Path pname)
+  {
+    return paramsNorm_.getHandle(pname);
+  }
+  
   const Tree<Value>& getNormalizedValues() const
   {
     return paramsNorm_;
@@ -4,6 +4,8 @@
 
 #include "MLPath.h"
 
+#include <stdexcept>
+
 #include "MLTextUtils.h"
 #include "utf.hpp"
 
@@ -17,6 +19,9 @@ Path::Path(const ml::Symbol sym) { addSymbol(sym); }
 
 Path::Path(const ml::TextFragment frag) { parsePathString(frag.getText()); }
 
+// the text may not be null terminated, so it is copied first.
+Path::Path(const ml::TextView text) : Path(TextFragment(text)) {}
+
 Path::Path(const ml::TextFragment frag, const char separator)
 {
   parsePathString(frag.getText(), separator);
@@ -238,4 +243,198 @@ Path substitute(Path p, Symbol fromSymbol, Path toPath)
   return r;
 }
 
+#pragma mark PathTable
+
+PathTable::Index::Index(size_t b)
+    : bits(b), mask((size_t(1) << b) - 1), slots(new std::atomic<PathNodeID>[size_t(1) << b])
+{
+  for (size_t i = 0; i <= mask; ++i)
+  {
+    slots[i].store(kNoNode, std::memory_order_relaxed);
+  }
+}
+
+PathTable::PathTable() : _chunks(new std::atomic<Node*>[kMaxChunks])
+{
+  for (size_t i = 0; i < kMaxChunks; ++i)
+  {
+    _chunks[i].store(nullptr, std::memory_order_relaxed);
+  }
+  clear();
+}
+
+PathTable::~PathTable()
+{
+  for (size_t i = 0; i < kMaxChunks; ++i)
+  {
+    delete[] _chunks[i].load(std::memory_order_relaxed);
+  }
+}
+
+void PathTable::clear()
+{
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  reset();
+}
+
+// remove all nodes but the root, and start over with a single empty index.
+void PathTable::reset()
+{
+  // keep the first chunk, so that a cleared table can be used without allocating.
+  for (size_t i = 1; i < kMaxChunks; ++i)
+  {
+    delete[] _chunks[i].exchange(nullptr);
+  }
+  if (!_chunks[0].load(std::memory_order_relaxed))
+  {
+    _chunks[0].store(new Node[kChunkSize], std::memory_order_release);
+  }
+  _chunks[0].load(std::memory_order_relaxed)[0] = Node();
+
+  _index = nullptr;
+  _indexes.clear();
+  _indexes.emplace_back(new Index(kInitialIndexBits));
+  _index.store(_indexes.back().get(), std::memory_order_release);
+  _size = 1;
+}
+
+// add a node to the table. The node must not already exist in the table, and
+// _insertMutex must be locked.
+PathNodeID PathTable::addNode(PathNodeID parent, Symbol symbol)
+{
+  size_t newID = _size.load(std::memory_order_relaxed);
+  size_t chunkIndex = newID >> kChunkBits;
+
+  // kNoNode is the root, so returning it would make the PathID being built name a
+  // different, shorter path, and messages would go to the wrong address.
+  if (chunkIndex >= kMaxChunks)
+  {
+    throw std::length_error("PathTable: too many path nodes");
+  }
+
+  Node* pChunk = _chunks[chunkIndex].load(std::memory_order_relaxed);
+  if (!pChunk)
+  {
+    pChunk = new Node[kChunkSize];
+    _chunks[chunkIndex].store(pChunk, std::memory_order_release);
+  }
+
+  // write the node, then publish it by adding its ID to the index.
+  Node& node = pChunk[newID & kChunkMask];
+  node.parent = parent;
+  node.depth = getNode(parent).depth + 1;
+  node.symbol = symbol;
+  _size.store(newID + 1, std::memory_order_release);
+
+  Index* pIndex = _index.load(std::memory_order_relaxed);
+  if ((newID + 1) * 2 > pIndex->mask + 1)
+  {
+    // build a new index with all the nodes, then replace the current one.
+    _indexes.emplace_back(new Index(pIndex->bits + 1));
+    pIndex = _indexes.back().get();
+    for (PathNodeID id = 1; id < newID; ++id)
+    {
+      insertInIndex(*pIndex, id);
+    }
+    _index.store(pIndex, std::memory_order_release);
+  }
+  insertInIndex(*pIndex, static_cast<PathNodeID>(newID));
+  return static_cast<PathNodeID>(newID);
+}
+
+void PathTable::insertInIndex(Index& index, PathNodeID id)
+{
+  const Node& node = getNode(id);
+  size_t slot = index.getHomeSlot(node.parent, node.symbol);
+  while (index.slots[slot].load(std::memory_order_relaxed) != kNoNode)
+  {
+    slot = (slot + 1) & index.mask;
+  }
+  index.slots[slot].store(id, std::memory_order_release);
+}
+
+PathNodeID PathTable::findInIndex(const Index& index, PathNodeID parent, Symbol symbol) const
+{
+  size_t slot = index.getHomeSlot(parent, symbol);
+  PathNodeID id;
+  while ((id = index.slots[slot].load(std::memory_order_acquire)) != kNoNode)
+  {
+    const Node& node = getNode(id);
+    if ((node.parent == parent) && (node.symbol == symbol)) break;
+    slot = (slot + 1) & index.mask;
+  }
+  return id;
+}
+
+PathNodeID PathTable::getChild(PathNodeID parent, Symbol symbol)
+{
+  // most nodes already exist, and are found without locking. If the index is
+  // replaced while we are searching, we may miss a node, but that is found again
+  // while locked.
+  PathNodeID r = findInIndex(*_index.load(std::memory_order_acquire), parent, symbol);
+  if (r != kNoNode) return r;
+
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  r = findInIndex(*_index.load(std::memory_order_relaxed), parent, symbol);
+  if (r != kNoNode) return r;
+  return addNode(parent, symbol);
+}
+
+PathNodeID PathTable::findChild(PathNodeID parent, Symbol symbol) const
+{
+  // a node added while we search may be missed, as in getChild(). But a node
+  // added before we started is in the index we search, unless that index has
+  // been replaced meanwhile, in which case we search the new one.
+  while (true)
+  {
+    const Index* pIndex = _index.load(std::memory_order_acquire);
+    PathNodeID r = findInIndex(*pIndex, parent, symbol);
+    if ((r != kNoNode) || (_index.load(std::memory_order_acquire) == pIndex)) return r;
+  }
+}
+
+#pragma mark PathID
+
+PathID::PathID(const Path& p)
+{
+  PathTable& table = thePathTable();
+  for (Symbol s : p)
+  {
+    _id = table.getChild(_id, s);
+  }
+}
+
+PathID PathID::find(const Path& p)
+{
+  const PathTable& table = thePathTable();
+  PathID r;
+  for (Symbol s : p)
+  {
+    r._id = table.findChild(r._id, s);
+    if (r._id == PathTable::kNoNode) break;
+  }
+  return r;
+}
+
+Path PathID::getPath() const
+{
+  // walk up the trie from the last Symbol to the first.
+  const PathTable& table = thePathTable();
+  Path r;
+  const PathTable::Node* pNode = &table.getNode(_id);
+  r.mSize = static_cast<unsigned char>(pNode->depth);
+  for (PathNodeID id = _id; id != PathTable::kNoNode; id = pNode->parent)
+  {
+    pNode = &table.getNode(id);
+    r._symbols[pNode->depth - 1] = pNode->symbol;
+  }
+  return r;
+}
+
+std::ostream& operator<<(std::ostream& out, const PathID p)
+{
+  out << p.getPath();
+  return out;
+}
+
 }  // namespace ml
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <numeric>
 
 #include "MLSymbol.h"
@@ -26,9 +28,12 @@ const int kPathMaxSymbols = 15;
 
 namespace ml
 {
+class PathID;
+
 class Path final
 {
   friend std::ostream& operator<<(std::ostream& out, const Path& r);
+  friend class PathID;
 
  public:
   explicit Path() = default;
@@ -36,6 +41,7 @@ class Path final
   Path(const char* str);
   Path(const Symbol sym);
   Path(const TextFragment frag);
+  Path(const TextView text);
 
   explicit Path(const TextFragment frag, const char separator);
   explicit Path(const Path& a, const Path& b);
@@ -210,5 +216,147 @@ inline Path addExtensionToPath(Path p, TextFragment ext)
   return Path(butLast(p), Path(nameWithExtension));
 }
 
+// ----------------------------------------------------------------
+// PathTable
+//
+// The PathTable interns Paths as nodes of a trie. Each node is a Symbol following
+// its parent node, and node 0 is the empty Path, so every Path has a unique node.
+// Like the SymbolTable, the PathTable can be read by any number of threads without
+// locking. Nodes are stored in fixed-size chunks that never move, and found through
+// an open-addressing hash index keyed by the parent and Symbol IDs, which is kept
+// at most half full. A new node is completely written before it is published in
+// the index. Adding a node takes a mutex, and only after a lock-free lookup has
+// failed to find it.
+//
+// When the index fills up, a new one of twice the size is built and replaces it.
+// Replaced indexes are kept until the table is cleared, because readers may still
+// be using them.
+
+using PathNodeID = uint32_t;
+
+class PathTable
+{
+  friend class PathID;
+
+ public:
+  PathTable();
+  ~PathTable();
+
+  // clear() must not be called while other threads are using the table.
+  void clear();
+  size_t getSize() const { return _size.load(std::memory_order_acquire); }
+
+ private:
+  static constexpr PathNodeID kNoNode{0};
+  static constexpr size_t kChunkBits{12};
+  static constexpr size_t kChunkSize{1 << kChunkBits};
+  static constexpr size_t kChunkMask{kChunkSize - 1};
+  static constexpr size_t kMaxChunks{1 << 14};
+  static constexpr size_t kInitialIndexBits{12};
+
+  struct Node
+  {
+    PathNodeID parent{0};
+    uint32_t depth{0};
+    Symbol symbol{};
+  };
+
+  struct Index
+  {
+    explicit Index(size_t b);
+
+    size_t getHomeSlot(PathNodeID parent, Symbol symbol) const
+    {
+      uint64_t h = (uint64_t(parent) << 32) ^ symbol.getID();
+      return (h * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+    }
+
+    const size_t bits;
+    const size_t mask;
+    std::unique_ptr<std::atomic<PathNodeID>[]> slots;
+  };
+
+  const Node& getNode(PathNodeID id) const
+  {
+    return _chunks[id >> kChunkBits].load(std::memory_order_acquire)[id & kChunkMask];
+  }
+
+  // return the node for the Symbol following the parent node, adding it if needed.
+  PathNodeID getChild(PathNodeID parent, Symbol symbol);
+
+  // return the node for the Symbol following the parent node, or kNoNode if there
+  // is none. Never locks or adds a node.
+  PathNodeID findChild(PathNodeID parent, Symbol symbol) const;
+
+  PathNodeID findInIndex(const Index& index, PathNodeID parent, Symbol symbol) const;
+
+  // these are called with _insertMutex locked.
+  void reset();
+  PathNodeID addNode(PathNodeID parent, Symbol symbol);
+  void insertInIndex(Index& index, PathNodeID id);
+
+  std::unique_ptr<std::atomic<Node*>[]> _chunks;
+  std::atomic<Index*> _index{nullptr};
+  std::vector<std::unique_ptr<Index> > _indexes;
+  std::atomic<size_t> _size{0};
+  std::mutex _insertMutex;
+};
+
+inline PathTable& thePathTable()
+{
+  static const std::unique_ptr<PathTable> t(new PathTable());
+  return *t;
+}
+
+// ----------------------------------------------------------------
+// PathID
+//
+// A PathID is an interned Path: a single integer, equal for equal Paths, that is
+// cheap to copy, compare and hash. The Path can be recovered with getPath().
+// Making a PathID from a Path that has not been seen before adds it to the
+// PathTable, which allocates memory, and throws std::length_error if the table is
+// full. To look up a Path that may not have been seen, without changing the table,
+// use PathID::find(). Copy numbers are not part of a PathID.
+
+class PathID
+{
+ public:
+  PathID() = default;
+  PathID(const Path& p);
+
+  // return the PathID of the Path if it is already in the PathTable, otherwise an
+  // empty PathID. This never locks or allocates.
+  static PathID find(const Path& p);
+
+  Path getPath() const;
+
+  int getSize() const { return static_cast<int>(thePathTable().getNode(_id).depth); }
+  PathNodeID getID() const { return _id; }
+
+  explicit operator bool() const { return _id != PathTable::kNoNode; }
+
+  // these are friends so that a Path on either side is converted to a PathID.
+  friend bool operator==(const PathID a, const PathID b) { return a._id == b._id; }
+  friend bool operator!=(const PathID a, const PathID b) { return a._id != b._id; }
+
+  // ordered by ID, which is the order of creation.
+  friend bool operator<(const PathID a, const PathID b) { return a._id < b._id; }
+
+ private:
+  PathNodeID _id{PathTable::kNoNode};
+};
+
+std::ostream& operator<<(std::ostream& out, const PathID p);
+
 
 }  // namespace ml
+
+// hashing function for ml::PathID use in unordered STL containers.
+namespace std
+{
+template <>
+struct hash<ml::PathID>
+{
+  std::size_t operator()(const ml::PathID& p) const { return p.getID(); }
+};
+}  // namespace std
@@ -0,0 +1,496 @@
+// madronalib: a C++ framework for DSP applications.
+// Copyright (c) 2020-2022 Madrona Labs LLC. http://www.madronalabs.com
+// Distributed under the MIT license: http://madrona-labs.mit-license.org/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "MLPath.h"
+#include "MLValue.h"
+
+// A PersistentTree is a map from Paths to values with the same lookups and
+// iteration order as Tree, made of nodes that never change once they are
+// created. Adding or erasing a value makes new copies of the nodes on the path to
+// it, and shares all the other nodes with the previous version. So copying a
+// PersistentTree is cheap, and a copy is a snapshot that later changes to the
+// original will not affect. The value class V must be copyable.
+//
+// A PublishedTree holds the current version of a PersistentTree for threads that
+// read it while another thread changes it. Readers take a Snapshot without
+// locking, allocating or freeing anything, so they are safe on the audio thread.
+// Writers make a new version and publish it atomically. Old versions are freed by
+// the writer once no reader can still be using them.
+
+namespace ml
+{
+template <class V, class C = std::less<Symbol> >
+class PersistentTree
+{
+ public:
+  class Node
+  {
+    friend class PersistentTree<V, C>;
+
+   public:
+    bool hasValue() const { return _value != V(); }
+    const V& getValue() const { return _value; }
+    bool isLeaf() const { return _children.empty(); }
+
+    // find a node at the specified path relative to this one, or return nullptr.
+    const Node* getConstNode(Path path) const
+    {
+      auto pNode = this;
+      for (Symbol key : path)
+      {
+        size_t i = pNode->lowerBound(key);
+        if (!pNode->hasChildAt(i, key)) return nullptr;
+        pNode = pNode->_children[i].get();
+      }
+      return pNode;
+    }
+
+   private:
+    size_t lowerBound(Symbol key) const
+    {
+      return std::lower_bound(_keys.begin(), _keys.end(), key, C()) - _keys.begin();
+    }
+
+    bool hasChildAt(size_t i, Symbol key) const
+    {
+      return (i < _keys.size()) && !C()(key, _keys[i]);
+    }
+
+    V _value{};
+    std::vector<Symbol> _keys;
+    std::vector<std::shared_ptr<const Node> > _children;
+  };
+
+  PersistentTree() = default;
+  PersistentTree(V val)
+  {
+    auto pRoot = std::make_shared<Node>();
+    pRoot->_value = std::move(val);
+    _root = std::move(pRoot);
+  }
+
+  void clear() { _root.reset(); }
+
+  void combine(const PersistentTree<V, C>& b)
+  {
+    for (auto it = b.begin(); it != b.end(); ++it)
+    {
+      add(it.getCurrentNodePath(), *it);
+    }
+  }
+
+  bool hasValue() const { return _root && _root->hasValue(); }
+  const V& getValue() const { return _root ? _root->_value : nullValue(); }
+  bool isLeaf() const { return !_root || _root->isLeaf(); }
+
+  // find a tree node at the specified path.
+  // if successful, return a pointer to the node. If unsuccessful, return
+  // nullptr. The node stays valid as long as any version of the tree that
+  // contains it.
+  const Node* getConstNode(Path path) const
+  {
+    return _root ? _root->getConstNode(path) : nullptr;
+  }
+  const Node* getConstNode(PathID id) const { return getConstNode(id.getPath()); }
+
+  // if the path exists, returns a const reference to the value in the tree at
+  // the path. Otherwise, reference to a null valued object is returned.
+  const V& operator[](Path p) const
+  {
+    auto pNode = getConstNode(p);
+    return pNode ? pNode->_value : nullValue();
+  }
+
+  const V& operator[](PathID id) const { return operator[](id.getPath()); }
+
+  // compare two PersistentTrees by value.
+  inline bool operator==(const PersistentTree<V, C>& b) const
+  {
+    if (_root == b._root) return true;
+    auto itA = begin();
+    auto itB = b.begin();
+    for (; (itA != end()) && (itB != b.end()); ++itA, ++itB)
+    {
+      if (itA.getCurrentNodeName() != itB.getCurrentNodeName()) return false;
+      if (*itA != *itB) return false;
+    }
+    return (itA == end()) && (itB == b.end());
+  }
+
+  inline bool operator!=(const PersistentTree<V, C>& b) const { return !(operator==(b)); }
+
+  // make this tree a new version in which getValue(path) will return V, adding
+  // any intermediate nodes necessary. Copies of the previous version are not
+  // changed.
+  void add(Path path, V val) { _root = withValue(_root.get(), path, 0, std::move(val)); }
+  void add(PathID id, V val) { add(id.getPath(), std::move(val)); }
+
+  // make this tree a new version without the node at the path and its children.
+  // Any nodes above it that are left with no value and no children are removed
+  // too. If there is no node at the path, the tree is not changed.
+  void erase(Path path)
+  {
+    if (!path)
+    {
+      clear();
+    }
+    else if (getConstNode(path))
+    {
+      _root = without(*_root, path, 0);
+    }
+  }
+  void erase(PathID id) { erase(id.getPath()); }
+
+  // NOTE like Tree's, this iterator is only for simple begin(), end() loops.
+  // It visits each node with a value, parents before children and siblings in
+  // the order of the comparator.
+
+  class const_iterator
+  {
+    struct Frame
+    {
+      const Node* pParent;
+      size_t childIndex;
+    };
+    std::vector<Frame> _stack;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = const V;
+    using difference_type = int;
+    using pointer = const V*;
+    using reference = const V&;
+
+    // null iterator that can be returned so begin() = end() when there is no root
+    const_iterator() {}
+    const_iterator(const Node* p, size_t childIndex) { _stack.push_back(Frame{p, childIndex}); }
+
+    bool operator==(const const_iterator& b) const
+    {
+      if (_stack.size() != b._stack.size()) return false;
+      if (_stack.empty()) return true;
+      return (_stack.back().pParent == b._stack.back().pParent) &&
+             (_stack.back().childIndex == b._stack.back().childIndex);
+    }
+
+    bool operator!=(const const_iterator& b) const { return !(*this == b); }
+
+    const V& operator*() const { return getCurrentNode()->_value; }
+
+    bool atEndOfMap() const
+    {
+      return _stack.empty() ||
+             (_stack.back().childIndex == _stack.back().pParent->_children.size());
+    }
+
+    // advance to the next node that has a value
+    const const_iterator& operator++()
+    {
+      do
+      {
+        Frame& current = _stack.back();
+        if (!atEndOfMap())
+        {
+          const Node* pChild = getCurrentNode();
+          if (!pChild->isLeaf())
+          {
+            // down
+            _stack.push_back(Frame{pChild, 0});
+          }
+          else
+          {
+            // across
+            current.childIndex++;
+          }
+        }
+        else
+        {
+          if (_stack.size() > 1)
+          {
+            // up
+            _stack.pop_back();
+            _stack.back().childIndex++;
+          }
+          else
+          {
+            break;
+          }
+        }
+      } while (!currentNodeHasValue());
+      return *this;
+    }
+
+    bool currentNodeHasValue() const { return !atEndOfMap() && getCurrentNode()->hasValue(); }
+
+    // return the last symbol of the current node path.
+    Symbol getCurrentNodeName() const
+    {
+      const Frame& f = _stack.back();
+      return f.pParent->_keys[f.childIndex];
+    }
+
+    // return entire path to the current node.
+    Path getCurrentNodePath() const
+    {
+      Path p;
+      for (const Frame& f : _stack)
+      {
+        p = Path{p, f.pParent->_keys[f.childIndex]};
+      }
+      return p;
+    }
+
+    size_t getCurrentDepth() const { return _stack.size() - 1; }
+
+   private:
+    const Node* getCurrentNode() const
+    {
+      const Frame& f = _stack.back();
+      return f.pParent->_children[f.childIndex].get();
+    }
+  };
+
+  inline const_iterator begin() const
+  {
+    if (!_root) return const_iterator();
+    auto it = const_iterator(_root.get(), 0);
+    while (!it.currentNodeHasValue() && !it.atEndOfMap())
+    {
+      ++it;
+    }
+    return it;
+  }
+
+  inline const_iterator end() const
+  {
+    if (!_root) return const_iterator();
+    return const_iterator(_root.get(), _root->_children.size());
+  }
+
+  inline void dump() const
+  {
+    for (auto it = begin(); it != end(); ++it)
+    {
+      std::cout << it.getCurrentNodePath() << " [" << *it << "] \n";
+    }
+  }
+
+  inline size_t size() const
+  {
+    size_t sum{hasValue()};
+    for (auto it = begin(); it != end(); ++it)
+    {
+      sum++;
+    }
+    return sum;
+  }
+
+ private:
+  static const V& nullValue()
+  {
+    static V null{};
+    return null;
+  }
+
+  // return a copy of the node, or a new node if pNode is null, with the value at
+  // the remainder of the path starting at depth set to val.
+  static std::shared_ptr<const Node> withValue(const Node* pNode, Path path, int depth, V&& val)
+  {
+    auto pCopy = pNode ? std::make_shared<Node>(*pNode) : std::make_shared<Node>();
+    if (depth == path.getSize())
+    {
+      pCopy->_value = std::move(val);
+    }
+    else
+    {
+      Symbol key = path.getElement(depth);
+      size_t i = pCopy->lowerBound(key);
+      if (pCopy->hasChildAt(i, key))
+      {
+        pCopy->_children[i] = withValue(pCopy->_children[i].get(), path, depth + 1, std::move(val));
+      }
+      else
+      {
+        pCopy->_keys.insert(pCopy->_keys.begin() + i, key);
+        pCopy->_children.insert(pCopy->_children.begin() + i,
+                                withValue(nullptr, path, depth + 1, std::move(val)));
+      }
+    }
+    return pCopy;
+  }
+
+  // return a copy of the node without the node at the remainder of the path
+  // starting at depth, which must exist, or null if the copy would be empty.
+  static std::shared_ptr<const Node> without(const Node& node, Path path, int depth)
+  {
+    Symbol key = path.getElement(depth);
+    size_t i = node.lowerBound(key);
+    auto pCopy = std::make_shared<Node>(node);
+    std::shared_ptr<const Node> newChild;
+    if (depth < path.getSize() - 1)
+    {
+      newChild = without(*node._children[i], path, depth + 1);
+    }
+    if (newChild)
+    {
+      pCopy->_children[i] = std::move(newChild);
+    }
+    else
+    {
+      pCopy->_keys.erase(pCopy->_keys.begin() + i);
+      pCopy->_children.erase(pCopy->_children.begin() + i);
+      if (pCopy->isLeaf() && !pCopy->hasValue()) return nullptr;
+    }
+    return pCopy;
+  }
+
+  std::shared_ptr<const Node> _root;
+};
+
+template <class V, class C = std::less<Symbol> >
+class PublishedTree
+{
+  using TreeT = PersistentTree<V, C>;
+
+ public:
+  // a Snapshot keeps the version of the tree that was current when it was taken
+  // from being freed until the Snapshot is destroyed. Snapshots should be short
+  // lived, for example the length of one audio buffer, because old versions are
+  // not freed while any Snapshot is alive.
+  class Snapshot
+  {
+    friend class PublishedTree<V, C>;
+
+   public:
+    Snapshot(Snapshot&& b) : _pCounter(b._pCounter), _pTree(b._pTree) { b._pCounter = nullptr; }
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot()
+    {
+      if (_pCounter) _pCounter->fetch_sub(1);
+    }
+
+    const TreeT& operator*() const { return *_pTree; }
+    const TreeT* operator->() const { return _pTree; }
+
+   private:
+    Snapshot(std::atomic<int>* pCounter, const TreeT* pTree) : _pCounter(pCounter), _pTree(pTree)
+    {
+    }
+
+    std::atomic<int>* _pCounter;
+    const TreeT* _pTree;
+  };
+
+  PublishedTree() : PublishedTree(TreeT()) {}
+  explicit PublishedTree(TreeT t) : _current(new TreeT(std::move(t)))
+  {
+    _pCurrent.store(_current.get());
+  }
+
+  PublishedTree(const PublishedTree&) = delete;
+  PublishedTree& operator=(const PublishedTree&) = delete;
+
+  // take a Snapshot of the current version. Lock-free.
+  Snapshot read() const
+  {
+    // readers count themselves in the counter for the current epoch. If the
+    // epoch changes before we are counted, the writer may not have seen us, so
+    // try again.
+    while (true)
+    {
+      uint64_t epoch = _epoch.load();
+      auto pCounter = &_readers[epoch & 1];
+      pCounter->fetch_add(1);
+      if (_epoch.load() == epoch) return Snapshot(pCounter, _pCurrent.load());
+      pCounter->fetch_sub(1);
+    }
+  }
+
+  // return a copy of the current version, for making a new one. Writers are
+  // serialized with a mutex, so this should not be called on the audio thread.
+  TreeT get() const
+  {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    return *_current;
+  }
+
+  // make the given tree the current version.
+  void publish(TreeT t)
+  {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    publishLocked(std::move(t));
+  }
+
+  // make a new version by calling f on a copy of the current one, then publish
+  // it. This makes read-modify-write updates from different writers atomic.
+  template <typename F>
+  void update(F f)
+  {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    TreeT t = *_current;
+    f(t);
+    publishLocked(std::move(t));
+  }
+
+  // free any old versions that no reader can be using. This is done after each
+  // publish, so it's only needed to free memory after the last one.
+  void collect()
+  {
+    std::unique_lock<std::mutex> lock(_writeMutex);
+    collectLocked();
+  }
+
+ private:
+  struct Retired
+  {
+    std::unique_ptr<TreeT> pTree;
+    uint64_t epoch;
+  };
+
+  void publishLocked(TreeT t)
+  {
+    std::unique_ptr<TreeT> pNew(new TreeT(std::move(t)));
+    _pCurrent.store(pNew.get());
+    _retired.push_back(Retired{std::move(_current), _epoch.load()});
+    _current = std::move(pNew);
+    collectLocked();
+  }
+
+  // The writer only advances the epoch once all the readers counted in the
+  // previous one are gone, so live readers always entered in the current or
+  // previous epoch. Once the readers of the previous epoch are gone, all live
+  // readers entered in the current one, after any version retired in an earlier
+  // epoch stopped being current, and those versions can be freed.
+  void collectLocked()
+  {
+    uint64_t epoch = _epoch.load();
+    if (_readers[(epoch + 1) & 1].load() != 0) return;
+    _retired.erase(std::remove_if(_retired.begin(), _retired.end(),
+                                  [&](const Retired& r) { return r.epoch < epoch; }),
+                   _retired.end());
+    _epoch.store(epoch + 1);
+  }
+
+  mutable std::mutex _writeMutex;
+  std::unique_ptr<TreeT> _current;
+  std::vector<Retired> _retired;
+
+  std::atomic<const TreeT*> _pCurrent{nullptr};
+  mutable std::atomic<uint64_t> _epoch{0};
+  mutable std::atomic<int> _readers[2]{};
+};
+
+}  // namespace ml
@@ -5,12 +5,19 @@
 // A very simple SPSC Queue.
 // based on
 // https://kjellkod.wordpress.com/2012/11/28/c-debt-paid-in-full-wait-free-lock-free-queue/
+//
+// The write and read indices are kept on separate cache lines so that the producer
+// and consumer threads don't invalidate each other's caches on every operation. Each
+// side also keeps a local copy of the other side's index, and only reloads it from
+// the shared atomic when the local copy says the queue is full (or empty).
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <iterator>
+#include <utility>
 #include <vector>
 
 namespace ml
@@ -18,6 +25,10 @@ namespace ml
 template <typename Element>
 class Queue final
 {
+  // We pad instead of using alignas() because Queues are often members of heap-allocated
+  // objects like Actors, and over-aligned new is disabled on some of our targets.
+  static constexpr size_t kCacheLineSize{64};
+
  public:
   Queue(size_t size) { resize(size); }
 
@@ -43,6 +54,8 @@ class Queue final
     _data.resize(powerOfTwoSize);
     _sizeMask = powerOfTwoSize - 1;
     clear();
+    _readIndexCache = _readIndex.load(std::memory_order_relaxed);
+    _writeIndexCache = _writeIndex.load(std::memory_order_relaxed);
   }
 
   size_t size() { return _data.size(); }
@@ -51,23 +64,86 @@ class Queue final
   {
     const auto currentWriteIndex = _writeIndex.load(std::memory_order_relaxed);
     const auto nextWriteIndex = increment(currentWriteIndex);
-    if (nextWriteIndex != _readIndex.load(std::memory_order_acquire))
+    if (nextWriteIndex == _readIndexCache)
+    {
+      _readIndexCache = _readIndex.load(std::memory_order_acquire);
+      if (nextWriteIndex == _readIndexCache) return false;
+    }
+    _data[currentWriteIndex] = item;
+    _writeIndex.store(nextWriteIndex, std::memory_order_release);
+    return true;
+  }
+
+  // move the item into the queue. If the queue is full, returns false and the item is
+  // left unchanged.
+  bool push(Element&& item)
+  {
+    const auto currentWriteIndex = _writeIndex.load(std::memory_order_relaxed);
+    const auto nextWriteIndex = increment(currentWriteIndex);
+    if (nextWriteIndex == _readIndexCache)
+    {
+      _readIndexCache = _readIndex.load(std::memory_order_acquire);
+      if (nextWriteIndex == _readIndexCache) return false;
+    }
+    _data[currentWriteIndex] = std::move(item);
+    _writeIndex.store(nextWriteIndex, std::memory_order_release);
+    return true;
+  }
+
+  // construct an Element from the arguments and move-assign it to the next free
+  // slot. Elements are stored in a preallocated array, so this is not construction
+  // in place. Returns false if the queue is full, in which case nothing is
+  // constructed.
+  template <typename... Args>
+  bool emplace(Args&&... args)
+  {
+    const auto currentWriteIndex = _writeIndex.load(std::memory_order_relaxed);
+    const auto nextWriteIndex = increment(currentWriteIndex);
+    if (nextWriteIndex == _readIndexCache)
+    {
+      _readIndexCache = _readIndex.load(std::memory_order_acquire);
+      if (nextWriteIndex == _readIndexCache) return false;
+    }
+    _data[currentWriteIndex] = Element(std::forward<Args>(args)...);
+    _writeIndex.store(nextWriteIndex, std::memory_order_release);
+    return true;
+  }
+
+  // push up to n elements from the input array, publishing them all to the reader
+  // at once. Returns the number of elements pushed, which will be less than n if
+  // the queue fills up.
+  size_t pushN(const Element* items, size_t n)
+  {
+    const auto currentWriteIndex = _writeIndex.load(std::memory_order_relaxed);
+    size_t free = freeSpace(currentWriteIndex, _readIndexCache);
+    if (free < n)
     {
-      _data[currentWriteIndex] = item;
-      _writeIndex.store(nextWriteIndex, std::memory_order_release);
-      return true;
+      _readIndexCache = _readIndex.load(std::memory_order_acquire);
+      free = freeSpace(currentWriteIndex, _readIndexCache);
     }
-    return false;
+    const size_t itemsToWrite = std::min(n, free);
+    if (!itemsToWrite) return 0;
+
+    // copy in up to two contiguous runs, splitting at the end of the buffer.
+    const size_t firstRun = std::min(itemsToWrite, _data.size() - currentWriteIndex);
+    std::copy(items, items + firstRun, _data.begin() + currentWriteIndex);
+    std::copy(items + firstRun, items + itemsToWrite, _data.begin());
+
+    _writeIndex.store((currentWriteIndex + itemsToWrite) & _sizeMask, std::memory_order_release);
+    return itemsToWrite;
   }
 
+  // move the next element, if any, into the given slot. Popped elements are moved out
+  // of the queue, so Elements may be move-only types.
   bool pop(Element& item)
   {
     const auto currentReadIndex = _readIndex.load(std::memory_order_relaxed);
-    if (currentReadIndex == _writeIndex.load(std::memory_order_acquire))
+    if (currentReadIndex == _writeIndexCache)
     {
-      return false;  // empty queue
+      _writeIndexCache = _writeIndex.load(std::memory_order_acquire);
+      if (currentReadIndex == _writeIndexCache) return false;  // empty queue
     }
-    item = _data[currentReadIndex];
+    item = std::move(_data[currentReadIndex]);
     _readIndex.store(increment(currentReadIndex), std::memory_order_release);
     return true;
   }
@@ -75,15 +151,42 @@ class Queue final
   Element pop()
   {
     const auto currentReadIndex = _readIndex.load(std::memory_order_relaxed);
-    if (currentReadIndex == _writeIndex.load(std::memory_order_acquire))
+    if (currentReadIndex == _writeIndexCache)
     {
-      return Element();  // empty queue, return null object
+      _writeIndexCache = _writeIndex.load(std::memory_order_acquire);
+      if (currentReadIndex == _writeIndexCache)
+      {
+        return Element();  // empty queue, return null object
+      }
     }
-    Element r = _data[currentReadIndex];
+    Element r = std::move(_data[currentReadIndex]);
     _readIndex.store(increment(currentReadIndex), std::memory_order_release);
     return r;
   }
 
+  // pop up to maxItems elements into the output array, releasing their slots to the
+  // writer all at once. Returns the number of elements popped.
+  size_t popN(Element* items, size_t maxItems)
+  {
+    const auto currentReadIndex = _readIndex.load(std::memory_order_relaxed);
+    size_t available = (_writeIndexCache - currentReadIndex) & _sizeMask;
+    if (available < maxItems)
+    {
+      _writeIndexCache = _writeIndex.load(std::memory_order_acquire);
+      available = (_writeIndexCache - currentReadIndex) & _sizeMask;
+    }
+    const size_t itemsToRead = std::min(maxItems, available);
+    if (!itemsToRead) return 0;
+
+    const size_t firstRun = std::min(itemsToRead, _data.size() - currentReadIndex);
+    auto readStart = _data.begin() + currentReadIndex;
+    std::move(readStart, readStart + firstRun, items);
+    std::move(_data.begin(), _data.begin() + (itemsToRead - firstRun), items + firstRun);
+
+    _readIndex.store((currentReadIndex + itemsToRead) & _sizeMask, std::memory_order_release);
+    return itemsToRead;
+  }
+
   void clear()
   {
     Element dummy;
@@ -105,6 +208,23 @@ class Queue final
     return _data[currentReadIndex];
   }
 
+  // return a pointer to the most recently pushed element for which the predicate
+  // is true, or nullptr if there is none. This is only safe when called by the
+  // producer while the consumer is kept from popping, for example by a mutex that
+  // the consumer also holds while it pops.
+  template <typename Predicate>
+  Element* findLast(Predicate p)
+  {
+    const auto currentReadIndex = _readIndex.load(std::memory_order_acquire);
+    auto i = _writeIndex.load(std::memory_order_relaxed);
+    while (i != currentReadIndex)
+    {
+      i = (i - 1) & _sizeMask;
+      if (p(_data[i])) return &_data[i];
+    }
+    return nullptr;
+  }
+
   bool wasEmpty() const { return (_writeIndex.load() == _readIndex.load()); }
 
   bool wasFull() const
@@ -116,9 +236,25 @@ class Queue final
  private:
   size_t increment(size_t idx) const { return (idx + 1) & _sizeMask; }
 
+  // number of elements that can be written starting at writeIdx without reaching readIdx.
+  size_t freeSpace(size_t writeIdx, size_t readIdx) const
+  {
+    return (readIdx - writeIdx - 1) & _sizeMask;
+  }
+
+  // shared, read-mostly data
   std::vector<Element> _data;
   size_t _sizeMask;
+  char _pad0[kCacheLineSize];
+
+  // written by the producer. _readIndexCache is only accessed by the producer.
   std::atomic<size_t> _writeIndex{0};
+  size_t _readIndexCache{0};
+  char _pad1[kCacheLineSize];
+
+  // written by the consumer. _writeIndexCache is only accessed by the consumer.
   std::atomic<size_t> _readIndex{0};
+  size_t _writeIndexCache{0};
+  char _pad2[kCacheLineSize];
 };
 };  // namespace ml
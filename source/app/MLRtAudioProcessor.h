@@ -212,11 +212,12 @@ struct RtAudioProcessor : public SignalProcessor, public Actor
   // default Actor implementation
   inline void onMessage(Message msg) override
   {
-    switch (hash(head(msg.address)))
+    Path address = msg.getAddressPath();
+    switch (hash(head(address)))
     {
       case (hash("set_param")):
       {
-        setParamFromNormalizedValue(tail(msg.address), msg.value.getFloatValue());
+        setParamFromNormalizedValue(tail(address), msg.value.getFloatValue());
         break;
       }
       case (hash("set_prop")):
@@ -154,7 +154,7 @@ inline std::unique_ptr<std::vector<uint8_t> > valueToBinary(Value v)
     }
     case Value::kBlobValue:
     {
-      char* blobData = static_cast<char*>(v.getBlobValue());
+      const char* blobData = static_cast<const char*>(v.getBlobValue());
       unsigned blobSize = v.getBlobSize();
       outputVector.resize(headerSize + blobSize);
       BinaryChunkHeader* header{reinterpret_cast<BinaryChunkHeader*>(outputVector.data())};
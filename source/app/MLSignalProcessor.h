@@ -6,6 +6,7 @@
 
 #include "MLActor.h"
 #include "MLDSPUtils.h"
+#include "MLParameterTable.h"
 #include "MLParameters.h"
 #include "MLPlatform.h"
 #include "madronalib.h"
@@ -171,16 +172,33 @@ class SignalProcessor
   void setParamFromNormalizedValue(Path pname, float val)
   {
     _params.setFromNormalizedValue(pname, val);
+    size_t id = _paramTable.getID(pname);
+    if (id != ParameterTable::kNoParameter)
+    {
+      _paramTable.setFromNormalizedValue(id, val);
+    }
+  }
+
+  // set a parameter by the ID it has in the ParameterTable, ignoring unknown IDs.
+  // This saves looking up the name in the table, but the ParameterTree is still
+  // updated by name, which is most of the cost.
+  void setParamFromNormalizedValue(size_t paramID, float val)
+  {
+    if (paramID >= _paramTable.size()) return;
+    _paramTable.setFromNormalizedValue(paramID, val);
+    _params.setFromNormalizedValue(_paramTable.getName(paramID), val);
   }
 
   inline void buildParams(const ParameterDescriptionList& paramList)
   {
     buildParameterTree(paramList, _params);
+    _paramTable.compile(paramList);
   };
   
   inline void setDefaultParams()
   {
     setDefaults(_params);
+    _paramTable.setDefaults();
   };
   
 
@@ -201,8 +219,8 @@ class SignalProcessor
   // buffer object to call processVector() from process() calls of arbitrary frame sizes
   VectorProcessBuffer processBuffer;
 
-  std::vector<ml::Path> _paramNamesByID;  // needed?
-  Tree<size_t> _paramIDsByName;
+  // the float parameter values, also stored by ID for fast access.
+  ParameterTable _paramTable;
 
   // single buffer for reading from signals
   std::vector<float> _readBuffer;
@@ -217,6 +235,23 @@ class SignalProcessor
   {
     return _params.getNormalizedFloatValue(pname);
   }
+
+  // versions taking the parameter's ID in the ParameterTable, which are the
+  // fastest: each is an array access.
+  inline size_t getParamID(Path pname) const
+  {
+    return _paramTable.getID(pname);
+  }
+
+  inline float getRealFloatParam(size_t paramID) const
+  {
+    return _paramTable.getRealFloatValue(paramID);
+  }
+
+  inline float getNormalizedFloatParam(size_t paramID) const
+  {
+    return _paramTable.getNormalizedFloatValue(paramID);
+  }
   
   Tree<std::unique_ptr<PublishedSignal> > _publishedSignals;
 
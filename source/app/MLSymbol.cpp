@@ -4,84 +4,278 @@
 
 #include "MLSymbol.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#include "MLPlatform.h"
+
+#if ML_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ml
 {
 #pragma mark SymbolTable
 
-SymbolTable::SymbolTable() { clear(); }
+SymbolTable::Index::Index(size_t b)
+    : bits(b), mask((size_t(1) << b) - 1), slots(new std::atomic<SymbolID>[size_t(1) << b])
+{
+  for (size_t i = 0; i <= mask; ++i)
+  {
+    slots[i].store(kNoSymbol, std::memory_order_relaxed);
+  }
+}
+
+SymbolTable::SymbolTable()
+    : _chunks(new std::atomic<Entry*>[kMaxChunks]),
+      _textBlocks(new std::atomic<const char*>[kMaxTextBlocks])
+{
+  for (size_t i = 0; i < kMaxChunks; ++i)
+  {
+    _chunks[i].store(nullptr, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < kMaxTextBlocks; ++i)
+  {
+    _textBlocks[i].store(nullptr, std::memory_order_relaxed);
+  }
+  clear();
+}
 
 SymbolTable::~SymbolTable()
 {
-  // TODO better protection on delete
-  // can this be avoided with more explicit setup / shutdown
-  // (RAII in main() )
-  // std::unique_lock<std::mutex> lock(mMutex);
+  for (size_t i = 0; i < kMaxChunks; ++i)
+  {
+    delete[] _chunks[i].load(std::memory_order_relaxed);
+  }
 }
 
 // clear all symbols from the table.
 void SymbolTable::clear()
 {
-  mSize = 0;
-  // std::unique_lock<std::mutex> lock(mMutex);
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  reset(kInitialIndexBits);
 
-  mSymbolTextsByID.clear();
-  mSymbolTextsByID.reserve(kDefaultSymbolTableSize);
+  // add null entry - why?
+  addEntry(HashedCharArray());
+}
 
-  for (int i = 0; i < kHashTableSize; ++i)
+// remove all entries and start over with a single empty index.
+void SymbolTable::reset(size_t indexBits)
+{
+  // keep the first chunk, so that a cleared table can be used without allocating.
+  for (size_t i = 1; i < kMaxChunks; ++i)
   {
-    clearEntry(mHashTable[i]);
+    delete[] _chunks[i].exchange(nullptr);
   }
 
-  // add null entry - why?
-  addEntry(HashedCharArray());
+  // keep the first block of the arena too, unless it is a mapped file.
+  for (size_t i = 0; i < _textBlockCount; ++i)
+  {
+    _textBlocks[i].store(nullptr);
+  }
+  _pMappedFile.reset();
+  _ownedTextBlocks.resize(std::min(_ownedTextBlocks.size(), size_t(1)));
+  _textBlockCount = 0;
+  if (!_ownedTextBlocks.empty())
+  {
+    addTextBlock(_ownedTextBlocks[0].get(), kTextBlockSize, 0);
+  }
+
+  _index = nullptr;
+  _previousIndex = nullptr;
+  _migrationPosition = 0;
+  _indexes.clear();
+  _indexes.emplace_back(new Index(indexBits));
+  _index.store(_indexes.back().get(), std::memory_order_release);
+  _size = 0;
 }
 
-// add an entry to the table. The entry must not already exist in the table.
-// this must be the only way of modifying the symbol table.
+// add an entry to the table. The entry must not already exist in the table, and
+// _insertMutex must be locked. This must be the only way of modifying the symbol
+// table.
 SymbolID SymbolTable::addEntry(const HashedCharArray& hsl)
 {
-  mSymbolTextsByID.emplace_back(TextFragment(hsl.pChars, static_cast<int>(hsl.len)));
+  return addEntry(hsl.pChars, hsl.len, hsl.hash);
+}
+
+SymbolID SymbolTable::addEntry(const char* pChars, size_t lengthBytes, uint64_t hash)
+{
+  size_t newID = _size.load(std::memory_order_relaxed);
+  size_t chunkIndex = newID >> kChunkBits;
+
+  // with kMaxChunks * kChunkSize IDs this should never happen. But if it does,
+  // returning a valid ID would silently merge new symbols with an existing one.
+  if (chunkIndex >= kMaxChunks)
+  {
+    throw std::length_error("SymbolTable: too many symbols");
+  }
+
+  Entry* pChunk = _chunks[chunkIndex].load(std::memory_order_relaxed);
+  if (!pChunk)
+  {
+    pChunk = new Entry[kChunkSize];
+    _chunks[chunkIndex].store(pChunk, std::memory_order_release);
+  }
+
+  // write the entry, then publish it by adding its ID to the index.
+  Entry& entry = pChunk[newID & kChunkMask];
+  if (!addText(pChars, lengthBytes, entry.textBlock, entry.textOffset))
+  {
+    throw std::length_error("SymbolTable: text arena is full");
+  }
+  entry.lengthInBytes = static_cast<uint32_t>(lengthBytes);
+  entry.hash = hash;
+  _size.store(newID + 1, std::memory_order_release);
 
-  size_t newID = mSize++;
-  mHashTable[hsl.hash].mIDVector.emplace_back(newID);
+  Index* pIndex = _index.load(std::memory_order_relaxed);
+  if ((newID + 1) * 2 > pIndex->mask + 1)
+  {
+    growIndex();
+    pIndex = _index.load(std::memory_order_relaxed);
+  }
+  insertInIndex(*pIndex, newID, hash);
+  migrateIndex(kMigrationSlotsPerInsert);
   return newID;
 }
 
-SymbolID SymbolTable::getSymbolID(const HashedCharArray& hsl)
+// copy the text into the arena, returning its location or nullptr if the arena is
+// full.
+const char* SymbolTable::addText(const char* pChars, size_t lengthBytes, uint32_t& block,
+                                 uint32_t& offset)
+{
+  size_t bytes = lengthBytes + 1;
+  if (!_textBlockCount || (_textBlockUsed + bytes > _textBlockCapacity))
+  {
+    if (_textBlockCount >= kMaxTextBlocks) return nullptr;
+    size_t capacity = std::max(bytes, kTextBlockSize);
+    _ownedTextBlocks.emplace_back(new char[capacity]);
+    addTextBlock(_ownedTextBlocks.back().get(), capacity, 0);
+  }
+
+  block = static_cast<uint32_t>(_textBlockCount - 1);
+  offset = static_cast<uint32_t>(_textBlockUsed);
+
+  // only blocks we own are ever written to.
+  char* pText = const_cast<char*>(_textBlocks[block].load(std::memory_order_relaxed)) + offset;
+  std::copy_n(pChars, lengthBytes, pText);
+  pText[lengthBytes] = 0;
+  _textBlockUsed += bytes;
+  return pText;
+}
+
+// make the given block the one that new texts are added to.
+void SymbolTable::addTextBlock(const char* pBlock, size_t capacity, size_t used)
 {
-  SymbolID r = 0;
+  _textBlocks[_textBlockCount].store(pBlock, std::memory_order_release);
+  _textBlockCount++;
+  _textBlockCapacity = capacity;
+  _textBlockUsed = used;
+}
+
+void SymbolTable::insertInIndex(Index& index, SymbolID symID, uint64_t hash)
+{
+  size_t slot = index.getHomeSlot(hash);
+  while (index.slots[slot].load(std::memory_order_relaxed) != kNoSymbol)
+  {
+    slot = (slot + 1) & index.mask;
+  }
+  index.slots[slot].store(symID, std::memory_order_release);
+}
 
-  // get the vector of symbol IDs matching this hash. It probably has one entry
-  // but may have more.
-  const std::vector<SymbolID>& bin = mHashTable[hsl.hash].mIDVector;
+// replace the current index with one twice the size. Only a few IDs are moved at a
+// time, so no single insert has to rehash the whole table.
+void SymbolTable::growIndex()
+{
+  // finish any previous move first, so that the old index holds every ID so far.
+  // With the load factor and number of slots moved per insert we use, this should
+  // not be needed.
+  if (_previousIndex)
   {
-    bool found = false;
+    migrateIndex(~size_t(0));
+  }
 
-    std::unique_lock<std::mutex> lock(mHashTable[hsl.hash].mMutex);
+  Index* pOld = _index.load(std::memory_order_relaxed);
+  _indexes.emplace_back(new Index(pOld->bits + 1));
+  _indexes.back()->pReplaced = pOld;
+  _previousIndex = pOld;
+  _index.store(_indexes.back().get(), std::memory_order_release);
+  _migrationPosition = 0;
+}
 
-    for (auto ID : bin)
+// move IDs from the previous index to the current one. The previous index is left
+// intact, because readers may still be searching it.
+void SymbolTable::migrateIndex(size_t slotsToMove)
+{
+  Index* pOld = _previousIndex;
+  if (!pOld) return;
+
+  Index& current = *_index.load(std::memory_order_relaxed);
+  size_t end = std::min(pOld->mask + 1, _migrationPosition + std::min(slotsToMove, pOld->mask + 1));
+  for (; _migrationPosition < end; ++_migrationPosition)
+  {
+    SymbolID id = pOld->slots[_migrationPosition].load(std::memory_order_relaxed);
+    if (id != kNoSymbol)
     {
-      // there should be few collisions, so probably the first ID in the hash
-      // bin will be the symbol we are looking for. Unfortunately to test for
-      // equality we may have to compare the entire string.
-      TextFragment* binFragment = &mSymbolTextsByID[ID];
-      if (compareSizedCharArrays(binFragment->getText(), binFragment->lengthInBytes(), hsl.pChars,
-                                 hsl.len))
+      insertInIndex(current, id, getEntry(id).hash);
+    }
+  }
+  if (_migrationPosition > pOld->mask)
+  {
+    _previousIndex = nullptr;
+  }
+}
+
+SymbolID SymbolTable::findInIndex(const Index& index, const HashedCharArray& hsl)
+{
+  // the index is at most half full, so probe sequences are short. Comparing hashes
+  // first means we almost never have to compare the text of a different symbol.
+  size_t slot = index.getHomeSlot(hsl.hash);
+  SymbolID id;
+  while ((id = index.slots[slot].load(std::memory_order_acquire)) != kNoSymbol)
+  {
+    if (getEntry(id).hash == hsl.hash)
+    {
+      TextView text = getSymbolTextByID(id);
+      if (compareSizedCharArrays(text.getText(), text.lengthInBytes(), hsl.pChars, hsl.len))
       {
-        r = ID;
-        found = true;
         break;
       }
     }
+    slot = (slot + 1) & index.mask;
+  }
+  return id;
+}
 
-    if (!found)
-    {
-      mSymbolTextsByID.emplace_back(TextFragment(hsl.pChars, static_cast<int>(hsl.len)));
-      r = mSize++;
-      mHashTable[hsl.hash].mIDVector.emplace_back(r);
-    }
+SymbolID SymbolTable::findEntry(const HashedCharArray& hsl)
+{
+  // while the index is growing, an ID may not have been moved to the current index
+  // yet, but it is always in the index that was replaced.
+  const Index* pCurrent = _index.load(std::memory_order_acquire);
+  SymbolID id = findInIndex(*pCurrent, hsl);
+  if ((id == kNoSymbol) && pCurrent->pReplaced)
+  {
+    id = findInIndex(*pCurrent->pReplaced, hsl);
   }
-  return r;
+  return id;
+}
+
+SymbolID SymbolTable::getSymbolID(const HashedCharArray& hsl)
+{
+  // most symbols already exist, and are found without locking.
+  SymbolID r = findEntry(hsl);
+  if (r != kNoSymbol) return r;
+
+  // look again while holding the lock, in case another thread has just added it.
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  r = findEntry(hsl);
+  if (r != kNoSymbol) return r;
+  return addEntry(hsl);
 }
 
 SymbolID SymbolTable::getSymbolID(const char* sym) { return getSymbolID(HashedCharArray(sym)); }
@@ -91,39 +285,27 @@ SymbolID SymbolTable::getSymbolID(const char* sym, size_t lengthBytes)
   return getSymbolID(HashedCharArray(sym, lengthBytes));
 }
 
-const TextFragment& SymbolTable::getSymbolTextByID(SymbolID symID)
-{
-  return mSymbolTextsByID[symID];
-}
-
 void SymbolTable::dump()
 {
+  size_t size = getSize();
   std::cout << "---------------------------------------------------------\n";
-  std::cout << mSymbolTextsByID.size() << " symbols:\n";
+  std::cout << size << " symbols:\n";
 
   // print symbols in order of creation.
-  for (int i = 0; i < mSymbolTextsByID.size(); ++i)
+  for (size_t i = 0; i < size; ++i)
   {
-    const TextFragment& sym = mSymbolTextsByID[i];
-    std::cout << "    ID " << i << " = " << sym << "\n";
+    std::cout << "    ID " << i << " = " << getSymbolTextByID(i) << "\n";
   }
-  // print nonzero entries in hash table
-  int hash = 0;
-  for (auto& tableEntry : mHashTable)
+
+  // print nonzero entries in the current index
+  Index& index = *_index.load(std::memory_order_acquire);
+  for (size_t slot = 0; slot <= index.mask; ++slot)
   {
-    auto idVec = tableEntry.mIDVector;
-    size_t idVecLen = idVec.size();
-    if (idVecLen > 0)
+    SymbolID id = index.slots[slot].load(std::memory_order_acquire);
+    if (id != kNoSymbol)
     {
-      std::cout << "#" << hash << " ";
-      for (auto id : idVec)
-      {
-        std::cout << id << " " << getSymbolTextByID(id) << " ";
-      }
-
-      std::cout << "\n";
+      std::cout << "#" << slot << " " << id << " " << getSymbolTextByID(id) << "\n";
     }
-    hash++;
   }
 }
 
@@ -132,11 +314,11 @@ int SymbolTable::audit()
   int i = 0;
   SymbolID i2{0};
   bool OK = true;
-  size_t size = mSymbolTextsByID.size();
+  size_t size = getSize();
 
   for (i = 0; i < size; ++i)
   {
-    const TextFragment& sym = getSymbolTextByID(i);
+    TextView sym = getSymbolTextByID(i);
     const char* symChars = sym.getText();
     Symbol symB(symChars);
 
@@ -154,13 +336,258 @@ int SymbolTable::audit()
   }
   if (!OK)
   {
-    const TextFragment& s = getSymbolTextByID(i);
+    TextView s = getSymbolTextByID(i);
     std::cout << "SymbolTable: error in symbol table, line " << i << ":\n";
     std::cout << "    ID " << i << " = " << s << ", ID B = " << i2 << "\n";
   }
   return OK;
 }
 
+#pragma mark symbol table images
+
+// A symbol table image is a header, followed by an entry for each symbol in order
+// of ID, followed by the null-terminated texts of all the symbols. The data are in
+// the byte order of the machine that saved the image.
+
+namespace
+{
+constexpr char kImageMagic[8]{'M', 'L', 'S', 'Y', 'M', 'T', 'A', 'B'};
+
+// change this when the format or the hash function changes.
+constexpr uint32_t kImageVersion{1};
+
+struct ImageHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrderMark;
+  uint64_t symbols;
+  uint64_t textBytes;
+};
+
+struct ImageEntry
+{
+  uint64_t hash;
+  uint32_t textOffset;
+  uint32_t lengthInBytes;
+};
+
+}  // namespace
+
+// a read-only view of a whole file mapped into memory.
+class SymbolTable::MappedFile
+{
+ public:
+  explicit MappedFile(const char* filePath)
+  {
+#if ML_WINDOWS
+    _file = CreateFileA(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size) || !size.QuadPart) return;
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping) return;
+    _pData = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_pData) _size = static_cast<size_t>(size.QuadPart);
+#else
+    _file = open(filePath, O_RDONLY);
+    if (_file < 0) return;
+    struct stat info;
+    if ((fstat(_file, &info) != 0) || (info.st_size <= 0)) return;
+    void* p = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, _file, 0);
+    if (p == MAP_FAILED) return;
+    _pData = static_cast<const uint8_t*>(p);
+    _size = static_cast<size_t>(info.st_size);
+#endif
+  }
+
+  ~MappedFile()
+  {
+#if ML_WINDOWS
+    if (_pData) UnmapViewOfFile(_pData);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+#else
+    if (_pData) munmap(const_cast<uint8_t*>(_pData), _size);
+    if (_file >= 0) close(_file);
+#endif
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* getData() const { return _pData; }
+  size_t getSize() const { return _size; }
+
+ private:
+#if ML_WINDOWS
+  HANDLE _file{INVALID_HANDLE_VALUE};
+  HANDLE _mapping{nullptr};
+#else
+  int _file{-1};
+#endif
+  const uint8_t* _pData{nullptr};
+  size_t _size{0};
+};
+
+std::vector<uint8_t> SymbolTable::saveImage()
+{
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  size_t size = getSize();
+
+  size_t textBytes{0};
+  for (size_t i = 0; i < size; ++i)
+  {
+    textBytes += getEntry(i).lengthInBytes + 1;
+  }
+
+  // offsets are stored in 32 bits.
+  if (textBytes > UINT32_MAX) return std::vector<uint8_t>();
+
+  ImageHeader header{};
+  std::copy(kImageMagic, kImageMagic + 8, header.magic);
+  header.version = kImageVersion;
+  header.byteOrderMark = 0x01020304;
+  header.symbols = size;
+  header.textBytes = textBytes;
+
+  size_t textStart = sizeof(ImageHeader) + size * sizeof(ImageEntry);
+  std::vector<uint8_t> image(textStart + textBytes);
+  std::copy_n(reinterpret_cast<const uint8_t*>(&header), sizeof(ImageHeader), image.data());
+
+  uint8_t* pEntries = image.data() + sizeof(ImageHeader);
+  uint8_t* pText = image.data() + textStart;
+  uint32_t offset{0};
+  for (size_t i = 0; i < size; ++i)
+  {
+    const Entry& entry = getEntry(i);
+    uint32_t len = entry.lengthInBytes;
+    ImageEntry imageEntry{entry.hash, offset, len};
+    std::copy_n(reinterpret_cast<const uint8_t*>(&imageEntry), sizeof(ImageEntry),
+                pEntries + i * sizeof(ImageEntry));
+    std::copy_n(getSymbolTextByID(i).getText(), len, pText + offset);
+    pText[offset + len] = 0;
+    offset += len + 1;
+  }
+  return image;
+}
+
+bool SymbolTable::saveImage(const char* filePath)
+{
+  auto image = saveImage();
+  if (image.empty()) return false;
+
+  FILE* pFile = fopen(filePath, "wb");
+  if (!pFile) return false;
+  bool OK = (fwrite(image.data(), 1, image.size(), pFile) == image.size());
+  OK = (fclose(pFile) == 0) && OK;
+  return OK;
+}
+
+bool SymbolTable::restoreImage(const uint8_t* pData, size_t sizeInBytes)
+{
+  return restoreImage(pData, sizeInBytes, nullptr);
+}
+
+bool SymbolTable::restoreImage(const char* filePath)
+{
+  std::unique_ptr<MappedFile> pFile(new MappedFile(filePath));
+  const uint8_t* pData = pFile->getData();
+  size_t size = pFile->getSize();
+  return restoreImage(pData, size, std::move(pFile));
+}
+
+// restore an image, using its text directly if it is in a mapped file and
+// otherwise copying the text into the arena.
+bool SymbolTable::restoreImage(const uint8_t* pData, size_t sizeInBytes,
+                               std::unique_ptr<MappedFile> pMappedFile)
+{
+  // validate everything before changing the table.
+  if (!pData || (sizeInBytes < sizeof(ImageHeader))) return false;
+  ImageHeader header;
+  std::copy_n(pData, sizeof(ImageHeader), reinterpret_cast<uint8_t*>(&header));
+  if (!std::equal(kImageMagic, kImageMagic + 8, header.magic)) return false;
+  if ((header.version != kImageVersion) || (header.byteOrderMark != 0x01020304)) return false;
+  if ((header.symbols < 1) || (header.symbols > kMaxChunks * kChunkSize)) return false;
+
+  size_t symbols = static_cast<size_t>(header.symbols);
+  size_t textStart = sizeof(ImageHeader) + symbols * sizeof(ImageEntry);
+  if ((header.textBytes > sizeInBytes) || (textStart + header.textBytes != sizeInBytes))
+  {
+    return false;
+  }
+
+  const uint8_t* pEntries = pData + sizeof(ImageHeader);
+  const char* pText = reinterpret_cast<const char*>(pData + textStart);
+  auto getImageEntry = [&](size_t i) {
+    ImageEntry e;
+    std::copy_n(pEntries + i * sizeof(ImageEntry), sizeof(ImageEntry),
+                reinterpret_cast<uint8_t*>(&e));
+    return e;
+  };
+  for (size_t i = 0; i < symbols; ++i)
+  {
+    ImageEntry e = getImageEntry(i);
+    if (uint64_t(e.textOffset) + e.lengthInBytes >= header.textBytes) return false;
+    if (pText[e.textOffset + e.lengthInBytes] != 0) return false;
+  }
+
+  // the first symbol must be the null symbol.
+  if (getImageEntry(0).lengthInBytes != 0) return false;
+
+  // the text must fit in one block of the arena.
+  if (header.textBytes > UINT32_MAX) return false;
+  size_t textBytes = static_cast<size_t>(header.textBytes);
+
+  // make an index big enough that it won't need to grow while restoring. The
+  // hashes are already computed, and the symbols are known to be unique, so no
+  // lookups are needed.
+  std::unique_lock<std::mutex> lock(_insertMutex);
+  size_t indexBits = kInitialIndexBits;
+  while ((size_t(1) << indexBits) < symbols * 2)
+  {
+    indexBits++;
+  }
+  reset(indexBits);
+
+  // the image's text becomes the current block of the arena. A mapped block is
+  // marked as full so that we never write to it.
+  if (pMappedFile)
+  {
+    _pMappedFile = std::move(pMappedFile);
+    addTextBlock(pText, textBytes, textBytes);
+  }
+  else
+  {
+    size_t capacity = std::max(textBytes, kTextBlockSize);
+    _ownedTextBlocks.emplace_back(new char[capacity]);
+    std::copy_n(pText, textBytes, _ownedTextBlocks.back().get());
+    addTextBlock(_ownedTextBlocks.back().get(), capacity, textBytes);
+  }
+
+  // add the entries directly, without copying their text.
+  size_t block = _textBlockCount - 1;
+  for (size_t i = 0; i < symbols; ++i)
+  {
+    ImageEntry e = getImageEntry(i);
+    Entry* pChunk = _chunks[i >> kChunkBits].load(std::memory_order_relaxed);
+    if (!pChunk)
+    {
+      pChunk = new Entry[kChunkSize];
+      _chunks[i >> kChunkBits].store(pChunk, std::memory_order_release);
+    }
+    Entry& entry = pChunk[i & kChunkMask];
+    entry.hash = e.hash;
+    entry.textBlock = static_cast<uint32_t>(block);
+    entry.textOffset = e.textOffset;
+    entry.lengthInBytes = e.lengthInBytes;
+    insertInIndex(*_index.load(std::memory_order_relaxed), i, e.hash);
+  }
+  _size.store(symbols, std::memory_order_release);
+  return true;
+}
+
 std::ostream& operator<<(std::ostream& out, const Symbol r)
 {
   out << r.getTextFragment();
@@ -21,74 +21,57 @@
 // already exists. This allows use in DSP code, assuming that the signal graph
 // or whatever has already been parsed.
 //
-// Symbols must not ever require any heap as long as they are smaller than a
-// certain size. Currently this relies on the "small string optimization"
-// implementation of TextFragment. Currently the size is 16 bytes.
+// The text of each Symbol is copied once into the SymbolTable's string arena,
+// which is allocated in large blocks, so creating a Symbol only allocates when a
+// new block is needed. Reading a Symbol's text returns a TextView into the arena,
+// which never allocates.
 
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "MLText.h"
 
 namespace ml
 {
-constexpr int kHashTableBits = 12;
-constexpr int kHashTableSize = (1 << kHashTableBits);
-constexpr int kHashTableMask = kHashTableSize - 1;
-
-// initial capacity of symbol table. if this number of symbols is exceeded, the
-// capacity of the table will have to be increased, which may result in a glitch
-// if called from the audio thread.
+// the symbol table stores its entries in chunks of this size. Each time this
+// number of symbols is exceeded, a new chunk is allocated, which may result in a
+// glitch if called from the audio thread.
 // TODO these constants that tune different parts of madronalib for space use
 // etc. should all be in one header.
 constexpr int kDefaultSymbolTableSize = 4096;
 
-// very simple hash function from Kernighan & Ritchie.
-// Constexpr version for hashing strings known at compile time.
-template <size_t N>
-constexpr uint32_t krHash2(const char* str)
-{
-  return (N > 1) ? ((krHash2<N - 1>(str + 1)) + *str) * 31u : 0;
-}
-
-template <>
-constexpr uint32_t krHash2<size_t(0)>(const char* str)
-{
-  return 0;
-}
-
-template <size_t N>
-constexpr uint32_t krHash1(const char* str)
-{
-  return krHash2<N>(str) & kHashTableMask;
-}
-
-// non-recursive hash producing equivalent results to krHash1.
-// Non-constexpr version for hashing strings known only at runtime.
-inline uint32_t krHash0(const char* str, const size_t len)
+// 64-bit FNV-1a hash. Being constexpr, it can hash strings known at compile time
+// as well as at runtime, with the same results.
+constexpr uint64_t fnvHash(const char* str, const size_t len)
 {
-  size_t i = len;
-  uint32_t accum = 0;
-  while (i > 0)
+  uint64_t accum = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < len; ++i)
   {
-    i--;
-    accum += str[i];
-    accum *= 31u;
+    accum ^= static_cast<uint8_t>(str[i]);
+    accum *= 0x100000001b3ull;
   }
-  return accum & kHashTableMask;
+  return accum;
 }
 
-inline uint32_t krHash0(const char* str) { return krHash0(str, strlen(str)); }
+constexpr uint64_t fnvHash(const char* str)
+{
+  return fnvHash(str, std::char_traits<char>::length(str));
+}
 
+// hash a string literal at compile time, not including the null terminator.
 template <size_t N>
-constexpr uint32_t hash(const char (&sym)[N])
+constexpr uint64_t hash(const char (&sym)[N])
 {
-  return krHash1<N>(sym);
+  return fnvHash(sym, N - 1);
 }
 
 class HashedCharArray
@@ -97,29 +80,55 @@ class HashedCharArray
   // template ctor from string literals allows hashing for code like
   // Proc::setParam("foo") to be done at compile time.
   template <size_t N>
-  constexpr HashedCharArray(const char (&sym)[N]) : len(N), hash(krHash1<N>(sym)), pChars(sym)
+  constexpr HashedCharArray(const char (&sym)[N])
+      : len(N - 1), hash(fnvHash(sym, N - 1)), pChars(sym)
   {
   }
 
-  // this non-constexpr ctor counts the string length at runtime.
-  HashedCharArray(const char* pC) : len(strlen(pC)), hash(krHash0(pC, len)), pChars(pC) {}
+  // this ctor counts the string length, at compile time if possible. It is chosen
+  // over the template ctor for string literals too.
+  constexpr HashedCharArray(const char* pC)
+      : len(std::char_traits<char>::length(pC)), hash(fnvHash(pC, len)), pChars(pC)
+  {
+  }
 
   // this non-constexpr ctor takes a string length parameter at runtime.
   HashedCharArray(const char* pC, size_t lengthBytes)
-      : len(lengthBytes), hash(krHash0(pC, len)), pChars(pC)
+      : len(lengthBytes), hash(fnvHash(pC, len)), pChars(pC)
   {
   }
 
   // default, null ctor
-  HashedCharArray() : len(0), hash(0), pChars(nullptr) {}
+  HashedCharArray() : len(0), hash(fnvHash(nullptr, 0)), pChars(nullptr) {}
 
   const size_t len;
-  const uint32_t hash;
+  const uint64_t hash;
   const char* pChars;
 };
 
 using SymbolID = size_t;
 
+// The SymbolTable can be read by any number of threads without locking. Symbol
+// entries are stored in fixed-size chunks that never move once allocated. Each
+// entry refers to the symbol's text by its offset and length in a string arena,
+// made of blocks that also never move. Entries are found through an
+// open-addressing hash index of symbol IDs, which is kept at most half full. A
+// new entry is completely written before its ID is published in the index, so
+// readers only ever see finished entries. Adding a symbol takes a single mutex,
+// and only after a lock-free lookup has failed to find it.
+//
+// When the index fills up, a new one of twice the size replaces it. The IDs in the
+// old index are moved over a few at a time by each following insert. A lookup that
+// misses in the current index also looks in the one it replaced, which is never
+// changed after being replaced, so existing symbols are always found without
+// locking, even while IDs are being moved. Replaced indexes are kept until the
+// table is cleared, because readers may still be using them.
+//
+// The whole table can be saved as a binary image and restored from one. Restoring
+// an image is much faster than creating its symbols one at a time, and restored
+// symbols have the same IDs as when the image was saved. When restored from a file,
+// the mapped file itself is used as the first block of the arena.
+
 class SymbolTable
 {
   friend class Symbol;
@@ -127,44 +136,136 @@ class SymbolTable
  public:
   SymbolTable();
   ~SymbolTable();
+
+  // clear() must not be called while other threads are using the table.
   void clear();
-  size_t getSize() { return mSymbolTextsByID.size(); }
+  size_t getSize() { return _size.load(std::memory_order_acquire); }
   void dump(void);
   int audit(void);
 
+  // write all the symbols to a binary image, in order of ID.
+  std::vector<uint8_t> saveImage();
+  bool saveImage(const char* filePath);
+
+  // replace the contents of the table with the symbols in an image. Like clear(),
+  // this must not be called while other threads are using the table, and any
+  // existing Symbols become invalid. Returns false, leaving the table unchanged,
+  // if the image is not valid.
+  bool restoreImage(const uint8_t* pData, size_t sizeInBytes);
+
+  // restore an image from a file by mapping it into memory. The file must not be
+  // modified until the table is cleared or another image is restored.
+  bool restoreImage(const char* filePath);
+
  protected:
   // look up a symbol by name and return its ID. Used in Symbol constructors.
   // if the symbol already exists, this routine must not allocate any heap
-  // memory.
+  // memory, and does not lock. Throws std::length_error if a new symbol is
+  // needed and the table or its text arena is full.
   SymbolID getSymbolID(const HashedCharArray& hsl);
   SymbolID getSymbolID(const char* sym);
   SymbolID getSymbolID(const char* sym, size_t lengthBytes);
 
-  const TextFragment& getSymbolTextByID(SymbolID symID);
+  TextView getSymbolTextByID(SymbolID symID)
+  {
+    const Entry& entry = getEntry(symID);
+    return TextView(_textBlocks[entry.textBlock].load(std::memory_order_acquire) +
+                        entry.textOffset,
+                    entry.lengthInBytes);
+  }
+
   SymbolID addEntry(const HashedCharArray& hsl);
+  SymbolID addEntry(const char* pChars, size_t lengthBytes, uint64_t hash);
 
  private:
-  // vector of text fragments in ID/creation order
-  std::vector<TextFragment> mSymbolTextsByID;
+  static constexpr SymbolID kNoSymbol{~SymbolID(0)};
+  static constexpr size_t kChunkBits{12};
+  static constexpr size_t kChunkSize{1 << kChunkBits};
+  static constexpr size_t kChunkMask{kChunkSize - 1};
+  static constexpr size_t kMaxChunks{1 << 14};
+  static_assert(kChunkSize == kDefaultSymbolTableSize, "symbol table chunk size mismatch");
+
+  static constexpr size_t kInitialIndexBits{13};
+
+  // the size of a block of the string arena. Texts longer than this get their
+  // own block.
+  static constexpr size_t kTextBlockSize{1 << 16};
+  static constexpr size_t kMaxTextBlocks{1 << 16};
+
+  // the number of slots of the old index moved to the new one by each insert. With
+  // at least 2, moving is done before the new index is half full.
+  static constexpr size_t kMigrationSlotsPerInsert{4};
 
-  // hash table containing indexes to strings for a given hash value.
-  struct TableEntry
+  struct Entry
   {
-    std::mutex mMutex;
-    std::vector<SymbolID> mIDVector;
+    uint64_t hash{0};
+    uint32_t textBlock{0};
+    uint32_t textOffset{0};
+    uint32_t lengthInBytes{0};
   };
 
-  void clearEntry(TableEntry& entry)
+  class MappedFile;
+
+  struct Index
   {
-    std::unique_lock<std::mutex> lock(entry.mMutex);
-    entry.mIDVector.clear();
-  }
+    explicit Index(size_t b);
+
+    size_t getHomeSlot(uint64_t hash) const
+    {
+      return (hash * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+    }
 
-  // since the maximum hash value is known, there will be no need to resize this
-  // array.
-  std::array<TableEntry, kHashTableSize> mHashTable;
+    const size_t bits;
+    const size_t mask;
+    std::unique_ptr<std::atomic<SymbolID>[]> slots;
 
-  size_t mSize{0};
+    // the index this one replaced, which holds every ID added before this one was
+    // published. Set before publishing and never changed.
+    const Index* pReplaced{nullptr};
+  };
+
+  Entry& getEntry(SymbolID symID)
+  {
+    return _chunks[symID >> kChunkBits].load(std::memory_order_acquire)[symID & kChunkMask];
+  }
+
+  // return the ID of the symbol if it is in the table, otherwise kNoSymbol.
+  SymbolID findEntry(const HashedCharArray& hsl);
+  SymbolID findInIndex(const Index& index, const HashedCharArray& hsl);
+
+  bool restoreImage(const uint8_t* pData, size_t sizeInBytes,
+                    std::unique_ptr<MappedFile> pMappedFile);
+
+  // these are called with _insertMutex locked.
+  void reset(size_t indexBits);
+  const char* addText(const char* pChars, size_t lengthBytes, uint32_t& block, uint32_t& offset);
+  void addTextBlock(const char* pBlock, size_t capacity, size_t used);
+  void insertInIndex(Index& index, SymbolID symID, uint64_t hash);
+  void growIndex();
+  void migrateIndex(size_t slotsToMove);
+
+  // chunks of entries in ID/creation order.
+  std::unique_ptr<std::atomic<Entry*>[]> _chunks;
+
+  // the string arena. Each text is null terminated.
+  std::unique_ptr<std::atomic<const char*>[]> _textBlocks;
+  std::vector<std::unique_ptr<char[]> > _ownedTextBlocks;
+  std::unique_ptr<MappedFile> _pMappedFile;
+  size_t _textBlockCount{0};
+  size_t _textBlockCapacity{0};
+  size_t _textBlockUsed{0};
+
+  // the current index, and the one whose IDs are still being moved into it, if any.
+  // _previousIndex is only used by writers.
+  std::atomic<Index*> _index{nullptr};
+  Index* _previousIndex{nullptr};
+  size_t _migrationPosition{0};
+
+  // all the indexes, including the replaced ones.
+  std::vector<std::unique_ptr<Index> > _indexes;
+
+  std::atomic<size_t> _size{0};
+  std::mutex _insertMutex;
 };
 
 inline SymbolTable& theSymbolTable()
@@ -178,8 +279,8 @@ inline SymbolTable& theSymbolTable()
 
 class Symbol
 {
-  // the ID equals the order in which the symbol was created.
-  // 2^31 unique symbols are possible. There is no checking for overflow.
+  // the ID equals the order in which the symbol was created. The SymbolTable
+  // holds up to 2^26 symbols, and throws std::length_error when it is full.
   SymbolID id;
 
   friend std::ostream& operator<<(std::ostream& out, const Symbol r);
@@ -189,6 +290,7 @@ class Symbol
   Symbol(const HashedCharArray& hsl) : id(theSymbolTable().getSymbolID(hsl)) {}
   Symbol(const char* pC) : id(theSymbolTable().getSymbolID(pC)) {}
   Symbol(const char* pC, size_t lengthBytes) : id(theSymbolTable().getSymbolID(pC, lengthBytes)) {}
+  Symbol(TextView v) : id(theSymbolTable().getSymbolID(v.getText(), v.lengthInBytes())) {}
   Symbol(TextFragment frag) : id(theSymbolTable().getSymbolID(frag.getText(), frag.lengthInBytes()))
   {
   }  // needed?
@@ -201,41 +303,17 @@ class Symbol
 
   explicit operator bool() const { return id != 0; }
 
-  friend uint32_t hash(Symbol s);
+  friend uint64_t hash(Symbol s);
 
-  // search hash table for our id to find our hash.
-  // for testing only!
-  inline int getHashFromTable() const
-  {
-    int hash = 0;
+  // look up our hash in the table.
+  inline uint64_t getHashFromTable() const { return theSymbolTable().getEntry(id).hash; }
 
-    for (auto& entry : theSymbolTable().mHashTable)
-    {
-      auto idVec = entry.mIDVector;
-      size_t idVecLen = idVec.size();
-      if (idVecLen > 0)
-      {
-        for (auto vid : idVec)
-        {
-          if (vid == id)
-          {
-            return hash;
-          }
-        }
-      }
-      hash++;
-    }
-    return 0;
-  }
-
-  // return the symbol's TextFragment in the table.
+  // return a view of the symbol's text in the table, which is valid until the
+  // table is cleared.
   // in order to show the strings in XCode's debugger, instead of the unhelpful
   // id, edit the summary format for Symbol within XCode to
-  // {$VAR.getTextFragment().text}:s
-  inline const TextFragment& getTextFragment() const
-  {
-    return theSymbolTable().getSymbolTextByID(id);
-  }
+  // {$VAR.getTextFragment()._pText}:s
+  inline TextView getTextFragment() const { return theSymbolTable().getSymbolTextByID(id); }
 
   inline const char* getUTF8Ptr() const { return theSymbolTable().getSymbolTextByID(id).getText(); }
 
@@ -252,7 +330,8 @@ class Symbol
   inline std::string toString() const { return std::string(getUTF8Ptr()); }
 };
 
-inline uint32_t hash(Symbol f) { return krHash0(f.getUTF8Ptr()); }
+// the hash of the Symbol's text, equal to hash() of the same text as a literal.
+inline uint64_t hash(Symbol f) { return f.getHashFromTable(); }
 
 inline Symbol operator+(Symbol f1, Symbol f2)
 {
@@ -4,6 +4,7 @@
 
 #include "MLText.h"
 
+#include <bitset>
 #include <cstring>
 #include <iostream>
 #include <vector>
@@ -11,57 +12,164 @@
 #include "MLMemoryUtils.h"
 #include "utf.hpp"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ML_TEXT_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ML_TEXT_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace ml
 {
-// Iterator::Impl
+// UTF-8 helpers
+//
+// These look at 16 bytes at a time using SSE2 or NEON where available. ASCII
+// text, which is most of the text we see, is handled entirely this way.
 
-class TextFragment::Iterator::Impl
+namespace
 {
-  friend class TextFragment::Iterator;
-  friend bool operator!=(Iterator lhs, Iterator rhs);
-  friend bool operator==(Iterator lhs, Iterator rhs);
-
-  utf::codepoint_iterator<const char*> _utf8Iter;
-
- public:
-  Impl(const char* pos) : _utf8Iter(utf::codepoint_iterator<const char*>(pos)) {}
-  Impl(const utf::codepoint_iterator<const char*>& utf_iter) : _utf8Iter(utf_iter) {}
-};
+constexpr size_t kBytesPerBlock{16};
 
-// Iterator
-
-TextFragment::Iterator::Iterator(const char* pos) { pImpl = std::unique_ptr<Impl>(new Impl(pos)); }
+#if ML_TEXT_SSE2
+// return a mask with a bit set for each byte in the block that is not ASCII.
+inline uint32_t nonASCIIMask(const char* p)
+{
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  return static_cast<uint32_t>(_mm_movemask_epi8(v));
+}
 
-TextFragment::Iterator::Iterator(const Iterator& it)  // = default;
+// return the number of bytes in the block that start a code point.
+inline size_t countLeadBytes(const char* p)
 {
-  pImpl = std::unique_ptr<Impl>(new Impl(it.pImpl->_utf8Iter));
+  // continuation bytes are 0x80 - 0xBF, which are -128 to -65 as signed chars.
+  __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  __m128i lead = _mm_cmpgt_epi8(v, _mm_set1_epi8(-65));
+  return std::bitset<kBytesPerBlock>(static_cast<uint32_t>(_mm_movemask_epi8(lead))).count();
+}
+#elif ML_TEXT_NEON
+inline uint32_t nonASCIIMask(const char* p)
+{
+  uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+  return vmaxvq_u8(v) >= 0x80 ? 1 : 0;
 }
 
-TextFragment::Iterator::~Iterator() = default;
+inline size_t countLeadBytes(const char* p)
+{
+  int8x16_t v = vld1q_s8(reinterpret_cast<const int8_t*>(p));
+  uint8x16_t lead = vshrq_n_u8(vcgtq_s8(v, vdupq_n_s8(-65)), 7);
+  return vaddvq_u8(lead);
+}
+#else
+inline uint32_t nonASCIIMask(const char* p)
+{
+  uint64_t a, b;
+  std::memcpy(&a, p, 8);
+  std::memcpy(&b, p + 8, 8);
+  return ((a | b) & 0x8080808080808080ull) ? 1 : 0;
+}
 
-CodePoint TextFragment::Iterator::operator*() { return pImpl->_utf8Iter.operator*(); }
+inline size_t countLeadBytes(const char* p)
+{
+  size_t n{0};
+  for (size_t i = 0; i < kBytesPerBlock; ++i)
+  {
+    n += (static_cast<signed char>(p[i]) > -65);
+  }
+  return n;
+}
+#endif
 
-TextFragment::Iterator& TextFragment::Iterator::operator++()
+// validate one multibyte sequence starting at p, returning its length or 0 if
+// it is not valid.
+size_t validateSequence(const unsigned char* p, const unsigned char* end)
 {
-  pImpl->_utf8Iter.operator++();
-  return *this;
+  unsigned char lead = p[0];
+  size_t len;
+  unsigned char min2{0x80}, max2{0xBF};
+  if (lead >= 0xC2 && lead <= 0xDF)
+  {
+    len = 2;
+  }
+  else if (lead >= 0xE0 && lead <= 0xEF)
+  {
+    len = 3;
+    if (lead == 0xE0) min2 = 0xA0;  // overlong
+    if (lead == 0xED) max2 = 0x9F;  // surrogates
+  }
+  else if (lead >= 0xF0 && lead <= 0xF4)
+  {
+    len = 4;
+    if (lead == 0xF0) min2 = 0x90;  // overlong
+    if (lead == 0xF4) max2 = 0x8F;  // above U+10FFFF
+  }
+  else
+  {
+    return 0;
+  }
+
+  if (end - p < static_cast<ptrdiff_t>(len)) return 0;
+  if (p[1] < min2 || p[1] > max2) return 0;
+  for (size_t i = 2; i < len; ++i)
+  {
+    if ((p[i] & 0xC0) != 0x80) return 0;
+  }
+  return len;
 }
+}  // namespace
 
-CodePoint TextFragment::Iterator::operator++(int i)
+bool isASCII(const char* pText, size_t lengthInBytes)
 {
-  CodePoint preIncrementValue = pImpl->_utf8Iter.operator*();
-  pImpl->_utf8Iter.operator++(i);
-  return preIncrementValue;
+  size_t i{0};
+  for (; i + kBytesPerBlock <= lengthInBytes; i += kBytesPerBlock)
+  {
+    if (nonASCIIMask(pText + i)) return false;
+  }
+  for (; i < lengthInBytes; ++i)
+  {
+    if (static_cast<unsigned char>(pText[i]) >= 0x80) return false;
+  }
+  return true;
 }
 
-bool operator!=(TextFragment::Iterator lhs, TextFragment::Iterator rhs)
+size_t countCodePoints(const char* pText, size_t lengthInBytes)
 {
-  return lhs.pImpl->_utf8Iter != rhs.pImpl->_utf8Iter;
+  size_t n{0};
+  size_t i{0};
+  for (; i + kBytesPerBlock <= lengthInBytes; i += kBytesPerBlock)
+  {
+    n += countLeadBytes(pText + i);
+  }
+  for (; i < lengthInBytes; ++i)
+  {
+    n += (static_cast<signed char>(pText[i]) > -65);
+  }
+  return n;
 }
 
-bool operator==(TextFragment::Iterator lhs, TextFragment::Iterator rhs)
+bool validateUTF8(const char* pText, size_t lengthInBytes)
 {
-  return !(lhs.pImpl->_utf8Iter != rhs.pImpl->_utf8Iter);
+  auto p = reinterpret_cast<const unsigned char*>(pText);
+  auto end = p + lengthInBytes;
+  while (p < end)
+  {
+    // skip over blocks of ASCII.
+    if ((end - p >= static_cast<ptrdiff_t>(kBytesPerBlock)) &&
+        !nonASCIIMask(reinterpret_cast<const char*>(p)))
+    {
+      p += kBytesPerBlock;
+      continue;
+    }
+    if (*p < 0x80)
+    {
+      p++;
+      continue;
+    }
+    size_t len = validateSequence(p, end);
+    if (!len) return false;
+    p += len;
+  }
+  return true;
 }
 
 // TextFragment
@@ -120,15 +228,7 @@ TextFragment::TextFragment(CodePoint c) noexcept
 
 size_t TextFragment::lengthInBytes() const { return _size; }
 
-size_t TextFragment::lengthInCodePoints() const
-{
-  utf::stringview<const char*> sv(_pText, _pText + _size);
-  return sv.codepoints();
-}
-
-TextFragment::Iterator TextFragment::begin() const { return TextFragment::Iterator(getText()); }
-
-TextFragment::Iterator TextFragment::end() const { return Iterator(getText() + lengthInBytes()); }
+size_t TextFragment::lengthInCodePoints() const { return countCodePoints(_pText, _size); }
 
 TextFragment::TextFragment(const TextFragment& a) noexcept
 {
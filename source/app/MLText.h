@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <iostream>
 #include <memory>
 #include <vector>
 
@@ -16,33 +18,154 @@ static constexpr int kShortFragmentSizeInChars = kShortFragmentSizeInCodePoints
 
 using CodePoint = char32_t;
 
-// TextFragment: a string class designed to avoid using the heap. Guaranteed not to allocate
-// heap if the length in bytes is below kShortFragmentSize.
+// ----------------------------------------------------------------
+// UTF-8 helpers
 
-class TextFragment
+// return the length in bytes of the UTF-8 sequence starting with the given byte.
+// An invalid first byte is treated as a sequence of length 1.
+inline size_t utf8SequenceLength(char c)
+{
+  auto u = static_cast<unsigned char>(c);
+  if (u < 0x80) return 1;
+  if ((u & 0xe0) == 0xc0) return 2;
+  if ((u & 0xf0) == 0xe0) return 3;
+  if ((u & 0xf8) == 0xf0) return 4;
+  return 1;
+}
+
+// decode the UTF-8 sequence starting at p. The sequence is not validated.
+inline CodePoint decodeUTF8(const char* p)
+{
+  auto u = static_cast<unsigned char>(p[0]);
+  if (u < 0x80) return u;
+  switch (utf8SequenceLength(p[0]))
+  {
+    case 2:
+      return ((u & 0x1f) << 6) | (p[1] & 0x3f);
+    case 3:
+      return ((u & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+    case 4:
+      return ((u & 0x07) << 18) | ((p[1] & 0x3f) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f);
+    default:
+      return u;
+  }
+}
+
+// return true if all the bytes of the text are ASCII.
+bool isASCII(const char* pText, size_t lengthInBytes);
+
+// count the code points in UTF-8 text, by counting the bytes that do not continue
+// a multibyte sequence. For valid UTF-8, this is the number of code points
+// visited by a TextFragment::Iterator.
+size_t countCodePoints(const char* pText, size_t lengthInBytes);
+
+// return true if the text is well-formed UTF-8, with no overlong encodings,
+// surrogates or code points above U+10FFFF.
+bool validateUTF8(const char* pText, size_t lengthInBytes);
+
+// an iterator over the code points of UTF-8 text. It is only a pair of pointers,
+// so it can be created and copied freely without allocating. Given the end of the
+// text, it never steps past it, even if the text ends with a truncated multibyte
+// sequence. Without one, the text must be null terminated. A sequence that is
+// truncated or has a missing continuation byte is visited as a single code point
+// with the value of its first byte.
+class CodePointIterator
+{
+  const char* _pos;
+  const char* _end;
+
+  // the length of the sequence at _pos, counting only the continuation bytes that
+  // are actually there.
+  size_t getSequenceLength() const
+  {
+    size_t expected = utf8SequenceLength(*_pos);
+    size_t n = 1;
+    while ((n < expected) && (!_end || (_pos + n < _end)) && ((_pos[n] & 0xc0) == 0x80))
+    {
+      n++;
+    }
+    return n;
+  }
+
+ public:
+  CodePointIterator(const char* pos, const char* end = nullptr) : _pos(pos), _end(end) {}
+
+  CodePoint operator*() const
+  {
+    auto u = static_cast<unsigned char>(*_pos);
+    if (u < 0x80) return u;
+    return (getSequenceLength() == utf8SequenceLength(*_pos)) ? decodeUTF8(_pos) : u;
+  }
+
+  CodePointIterator& operator++()
+  {
+    _pos += (static_cast<unsigned char>(*_pos) < 0x80) ? 1 : getSequenceLength();
+    return *this;
+  }
+
+  CodePoint operator++(int)
+  {
+    CodePoint preIncrementValue = **this;
+    ++*this;
+    return preIncrementValue;
+  }
+
+  // the position of the current code point in the text.
+  const char* getPosition() const { return _pos; }
+
+  friend bool operator!=(CodePointIterator lhs, CodePointIterator rhs)
+  {
+    return lhs._pos != rhs._pos;
+  }
+  friend bool operator==(CodePointIterator lhs, CodePointIterator rhs)
+  {
+    return lhs._pos == rhs._pos;
+  }
+};
+
+// TextView: a non-owning reference to UTF-8 text stored somewhere else, such as in
+// the symbol table. A TextView is only valid as long as the text it refers to. Its
+// text is not necessarily null terminated.
+
+class TextView
 {
  public:
-  class Iterator
+  constexpr TextView() noexcept = default;
+  constexpr TextView(const char* pChars, size_t len) noexcept : _pText(pChars), _size(len) {}
+
+  explicit operator bool() const { return _size > 0; }
+
+  inline const char* getText() const { return _pText; }
+  inline size_t lengthInBytes() const { return _size; }
+  size_t lengthInCodePoints() const { return countCodePoints(_pText, _size); }
+
+  CodePointIterator begin() const { return CodePointIterator(_pText, _pText + _size); }
+  CodePointIterator end() const { return CodePointIterator(_pText + _size, _pText + _size); }
+
+  inline bool beginsWith(TextView b) const
   {
-    class Impl;
-    std::unique_ptr<Impl> pImpl;
+    return (b._size <= _size) && std::equal(b._pText, b._pText + b._size, _pText);
+  }
 
-   public:
-    Iterator(const char* pos);
+  inline bool endsWith(TextView b) const
+  {
+    return (b._size <= _size) && std::equal(b._pText, b._pText + b._size, _pText + _size - b._size);
+  }
 
-    ~Iterator();  // defined in the implementation file, where impl is a
-                  // complete type
+ private:
+  const char* _pText{""};
 
-    Iterator(const Iterator&);
-    Iterator& operator=(const Iterator&) = delete;
+  // size of data in bytes, without null terminator
+  size_t _size{0};
+};
 
-    CodePoint operator*();
-    Iterator& operator++();
-    CodePoint operator++(int i);
+// TextFragment: a string class designed to avoid using the heap. Guaranteed not to allocate
+// heap if the length in bytes is below kShortFragmentSize.
 
-    friend bool operator!=(Iterator lhs, Iterator rhs);
-    friend bool operator==(Iterator lhs, Iterator rhs);
-  };
+class TextFragment
+{
+ public:
+  using Iterator = CodePointIterator;
 
   TextFragment() noexcept;
 
@@ -66,6 +189,9 @@ class TextFragment
   // if we know it already, as with static HashedCharArrays.
   TextFragment(const char* pChars, size_t len) noexcept;
 
+  // copy the text referred to by a TextView.
+  TextFragment(TextView v) noexcept : TextFragment(v.getText(), v.lengthInBytes()) {}
+
   // single code point ctor
   TextFragment(CodePoint c) noexcept;
 
@@ -101,12 +227,16 @@ class TextFragment
 
   explicit operator bool() const { return _size > 0; }
 
+  // a TextFragment can be viewed without copying. The view is valid until the
+  // TextFragment is changed or destroyed.
+  operator TextView() const { return TextView(_pText, _size); }
+
   size_t lengthInBytes() const;
 
   size_t lengthInCodePoints() const;
 
-  Iterator begin() const;
-  Iterator end() const;
+  Iterator begin() const { return Iterator(_pText, _pText + _size); }
+  Iterator end() const { return Iterator(_pText + _size, _pText + _size); }
 
   inline const char* getText() const { return _pText; }
 
@@ -193,6 +323,20 @@ inline bool operator==(const TextFragment a, const TextFragment b)
 
 inline bool operator!=(TextFragment a, TextFragment b) { return !(a == b); }
 
+inline bool operator==(TextView a, TextView b)
+{
+  return compareSizedCharArrays(a.getText(), a.lengthInBytes(), b.getText(), b.lengthInBytes());
+}
+
+inline bool operator!=(TextView a, TextView b) { return !(a == b); }
+
+// TextFragments and TextViews convert to each other, so comparing them needs
+// its own overloads.
+inline bool operator==(TextView a, const TextFragment& b) { return a == TextView(b); }
+inline bool operator==(const TextFragment& a, TextView b) { return TextView(a) == b; }
+inline bool operator!=(TextView a, const TextFragment& b) { return !(a == TextView(b)); }
+inline bool operator!=(const TextFragment& a, TextView b) { return !(TextView(a) == b); }
+
 inline std::ostream& operator<<(std::ostream& out, const TextFragment& r)
 {
   const char* c = r.getText();
@@ -200,6 +344,12 @@ inline std::ostream& operator<<(std::ostream& out, const TextFragment& r)
   return out;
 }
 
+inline std::ostream& operator<<(std::ostream& out, TextView v)
+{
+  out.write(v.getText(), v.lengthInBytes());
+  return out;
+}
+
 bool validateCodePoint(CodePoint c);
 
 std::vector<uint8_t> textToByteVector(TextFragment frag);
@@ -4,19 +4,72 @@
 
 #include "MLTextUtils.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <limits>
+#include <thread>
 
 #include "MLDSPScalarMath.h"
 #include "MLMemoryUtils.h"
 #include "aes256.h"
 #include "utf.hpp"
 
+// SIMD code for x86 is compiled for instruction sets beyond the baseline using
+// target attributes, and only called if the processor supports them.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ML_TEXT_X86 1
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define ML_TARGET(features)
+#else
+#include <cpuid.h>
+#define ML_TARGET(features) __attribute__((target(features)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ML_TEXT_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace ml
 {
 namespace textUtils
 {
 static const int npos = -1;
 
+#if ML_TEXT_X86
+namespace
+{
+// return the feature flags in ECX from CPUID leaf 1.
+uint32_t getCPUFeatures()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  return static_cast<uint32_t>(info[2]);
+#else
+  unsigned a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d)) return 0;
+  return c;
+#endif
+}
+
+bool hasSSSE3()
+{
+  static const bool b = getCPUFeatures() & (1u << 9);
+  return b;
+}
+
+bool hasAESNI()
+{
+  static const bool b = getCPUFeatures() & (1u << 25);
+  return b;
+}
+}  // namespace
+#endif
+
 bool isDigit(CodePoint c)
 {
   if (c >= '0' && c <= '9') return true;
@@ -50,34 +103,24 @@ bool isCJK(CodePoint ch)
          || (ch >= 0x31C0 && ch <= 0x4DFF);  // Other extensions
 }
 
-int digitsToNaturalNumber(const char32_t* p, size_t n)
+int textToNaturalNumber(TextView text)
 {
-  constexpr int kMaxDigits = 16;
-  if (n >= kMaxDigits) return -1;
-  
-  if (!p) return 0;
-  int v = 0;
-  int d;
-  char c;
+  constexpr size_t kMaxDigits = 16;
+  if (text.lengthInCodePoints() >= kMaxDigits) return -1;
 
-  for(int i=0; i<n; ++i)
+  // digits are ASCII, so any other byte ends the number.
+  const char* p = text.getText();
+  int v = 0;
+  for (size_t i = 0; i < text.lengthInBytes(); ++i)
   {
-    c = p[i];
-    if (c >= '0' && c <= '9')
-      d = (c - '0');
-    else
-      break;
-    v = (v * 10) + d;
+    char c = p[i];
+    if (c < '0' || c > '9') break;
+    v = (v * 10) + (c - '0');
   }
   return v;
 }
 
-int textToNaturalNumber(const TextFragment& frag)
-{
-  std::vector<CodePoint> vec = textToCodePoints(frag);
-  return digitsToNaturalNumber(vec.data(), vec.size());
-}
-
+int textToNaturalNumber(const TextFragment& frag) { return textToNaturalNumber(TextView(frag)); }
 
 TextFragment naturalNumberToText(int i)
 {
@@ -287,483 +330,1652 @@ TextFragment floatNumberToText(float f, int precision)
   return TextFragment(buf, writePtr - buf);
 }
 
-float textToFloatNumber(const char* input)
+// Shortest round-trip float to text conversion, and correctly rounded text to
+// float conversion, without allocating.
+//
+// Both directions have fast paths using double arithmetic, which are exact
+// whenever they are used. In the rare cases where the fast paths can't be sure
+// of the answer, the exact value is compared using a small fixed-size big
+// integer.
+
+namespace
 {
-  float sign{1}, intPart{0}, fracPart{0}, fracPlace{1}, expSign{1}, exp{0};
-  bool hasExp = false;
-  auto it = input;
-  constexpr char digits[]{"0123456789"};
-  std::vector<std::pair<const char*, std::function<void()> > > segments{
-      {"nan", [&]() { intPart = std::numeric_limits<float>::quiet_NaN(); }},
-      {"-", [&]() { sign = -sign; }},
-      {"inf", [&]() { intPart = std::numeric_limits<float>::infinity(); }},
-      {digits, [&]() { intPart = intPart * 10.f + (*it - '0'); }},
-      {".", [&]() {}},
-      {digits, [&]() { fracPart += (*it - '0') * (fracPlace *= 0.1f); }},
-      {"e+", [&]() { hasExp = true; }},
-      {"-", [&]() { expSign = -expSign; }},
-      {digits, [&]() { exp = exp * 10.f + (*it - '0'); }}};
-  for (auto segment : segments)
+// an unsigned integer of up to 640 bits, enough for exact comparisons of any
+// float with any decimal number in the range of floats.
+class BigUnsigned
+{
+ public:
+  explicit BigUnsigned(uint64_t v)
   {
-    const char* cBegin = segment.first;
-    const char* cEnd = cBegin + strlen(cBegin);
-    while (std::find(cBegin, cEnd, *it) != cEnd)
+    while (v)
     {
-      segment.second();
-      ++it;
+      _limbs[_size++] = static_cast<uint32_t>(v);
+      v >>= 32;
     }
   }
-  float base = sign * (intPart + fracPart);
-  return hasExp ? base * powf(10.f, exp * expSign) : base;
-}
-
-float textToFloatNumber(const TextFragment& frag) { return textToFloatNumber(frag.getText()); }
 
-int findFirst(const TextFragment& frag, const CodePoint b)
-{
-  int r = npos;
-  if (!frag) return r;
-  int i = 0;
-  for (const CodePoint c : frag)
+  void multiply(uint32_t m)
   {
-    if (!validateCodePoint(c)) return r;
-    if (c == b)
+    uint64_t carry{0};
+    for (int i = 0; i < _size; ++i)
     {
-      r = i;
-      break;
+      uint64_t t = uint64_t(_limbs[i]) * m + carry;
+      _limbs[i] = static_cast<uint32_t>(t);
+      carry = t >> 32;
     }
-    i++;
+    if (carry) _limbs[_size++] = static_cast<uint32_t>(carry);
   }
-  return r;
-}
 
-int findLast(const TextFragment& frag, const CodePoint b)
-{
-  int r = npos;
-  if (!frag) return r;
-  int i = 0;
-  for (const CodePoint c : frag)
+  void multiplyByPowerOfTen(int n)
   {
-    if (!validateCodePoint(c)) return r;
-    if (c == b)
+    for (; n >= 9; n -= 9)
     {
-      r = i;
+      multiply(1000000000u);
     }
-    i++;
+    static constexpr uint32_t kSmallPowers[9]{1,      10,      100,      1000,     10000,
+                                              100000, 1000000, 10000000, 100000000};
+    if (n > 0) multiply(kSmallPowers[n]);
   }
-  return r;
-}
 
-int findFirst(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
-{
-  int r = npos;
-  if (!frag) return r;
-  int i = 0;
-  for (const CodePoint c : frag)
+  void shiftLeft(int bits)
   {
-    if (!validateCodePoint(c)) return r;
-    if (matchFn(c))
+    if (!_size) return;
+    int limbShift = bits / 32;
+    int bitShift = bits % 32;
+    if (bitShift)
     {
-      r = i;
-      break;
+      uint32_t carry{0};
+      for (int i = 0; i < _size; ++i)
+      {
+        uint32_t next = _limbs[i] >> (32 - bitShift);
+        _limbs[i] = (_limbs[i] << bitShift) | carry;
+        carry = next;
+      }
+      if (carry) _limbs[_size++] = carry;
+    }
+    if (limbShift)
+    {
+      for (int i = _size - 1; i >= 0; --i)
+      {
+        _limbs[i + limbShift] = _limbs[i];
+      }
+      std::fill(_limbs, _limbs + limbShift, 0);
+      _size += limbShift;
     }
-    i++;
   }
-  return r;
-}
 
-// TODO dumb, have to call matchFn on each code point because we have no reverse
-// iterator
-int findLast(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
-{
-  int r = npos;
-  if (!frag) return r;
-  int i = 0;
-  for (const CodePoint c : frag)
+  // subtract b, which must not be greater than this.
+  void subtract(const BigUnsigned& b)
   {
-    if (!validateCodePoint(c)) return r;
-    if (matchFn(c))
+    int64_t borrow{0};
+    for (int i = 0; i < _size; ++i)
     {
-      r = i;
+      int64_t t = int64_t(_limbs[i]) - (i < b._size ? b._limbs[i] : 0) - borrow;
+      borrow = t < 0;
+      _limbs[i] = static_cast<uint32_t>(t + (borrow << 32));
     }
-    i++;
+    while (_size && !_limbs[_size - 1]) _size--;
   }
-  return r;
-}
-
-TextFragment subText(const TextFragment& frag, size_t start, size_t end)
-{
-  // this impl does an unneccesary copy, to keep TextFragment very simple for
-  // now.
-  if (!frag) return TextFragment();
-  if (start >= end) return TextFragment();
-
-  // temp buffer big enough to hold whole input fragment if needed.
-  // we won't know the output fragment size in bytes until iterating the code
-  // points.
-  size_t len = frag.lengthInBytes();
-  SmallStackBuffer<char, kShortFragmentSizeInChars> temp(len);
-  char* buf = temp.data();
-  char* pb = buf;
 
-  auto first = TextFragment::Iterator(frag.getText());
-  auto it = first;
-  for (int i = 0; i < start; ++i)
+  friend int compare(const BigUnsigned& a, const BigUnsigned& b)
   {
-    ++it;
+    if (a._size != b._size) return a._size < b._size ? -1 : 1;
+    for (int i = a._size - 1; i >= 0; --i)
+    {
+      if (a._limbs[i] != b._limbs[i]) return a._limbs[i] < b._limbs[i] ? -1 : 1;
+    }
+    return 0;
   }
 
-  for (int i = 0; i < end - start; ++i)
-  {
-    // write the codepoint as UTF-8 to the buffer
-    if (!validateCodePoint(*it)) return TextFragment();
-    pb = utf::internal::utf_traits<utf::utf8>::encode(*it, pb);
-    ++it;
-  }
+ private:
+  static constexpr int kMaxLimbs{20};
+  uint32_t _limbs[kMaxLimbs]{};
+  int _size{0};
+};
 
-  return TextFragment(buf, pb - buf);
+// compare a * 10^decimalExponent with b * 2^binaryExponent exactly.
+int compareDecimalWithBinary(uint64_t a, int decimalExponent, uint64_t b, int binaryExponent)
+{
+  BigUnsigned x(a), y(b);
+  if (decimalExponent >= 0)
+    x.multiplyByPowerOfTen(decimalExponent);
+  else
+    y.multiplyByPowerOfTen(-decimalExponent);
+  if (binaryExponent >= 0)
+    y.shiftLeft(binaryExponent);
+  else
+    x.shiftLeft(-binaryExponent);
+  return compare(x, y);
 }
 
-TextFragment map(const TextFragment& frag, std::function<CodePoint(CodePoint)> f)
+// powers of ten as doubles. Those from 1e-22 to 1e22 are exact.
+constexpr int kMinDoublePower{-66};
+constexpr int kMaxDoublePower{39};
+constexpr double kDoublePowersOfTen[kMaxDoublePower - kMinDoublePower + 1]{
+    1e-66, 1e-65, 1e-64, 1e-63, 1e-62, 1e-61, 1e-60, 1e-59, 1e-58, 1e-57, 1e-56, 1e-55,
+    1e-54, 1e-53, 1e-52, 1e-51, 1e-50, 1e-49, 1e-48, 1e-47, 1e-46, 1e-45, 1e-44, 1e-43,
+    1e-42, 1e-41, 1e-40, 1e-39, 1e-38, 1e-37, 1e-36, 1e-35, 1e-34, 1e-33, 1e-32, 1e-31,
+    1e-30, 1e-29, 1e-28, 1e-27, 1e-26, 1e-25, 1e-24, 1e-23, 1e-22, 1e-21, 1e-20, 1e-19,
+    1e-18, 1e-17, 1e-16, 1e-15, 1e-14, 1e-13, 1e-12, 1e-11, 1e-10, 1e-09, 1e-08, 1e-07,
+    1e-06, 1e-05, 1e-04, 1e-03, 1e-02, 1e-01, 1e+00, 1e+01, 1e+02, 1e+03, 1e+04, 1e+05,
+    1e+06, 1e+07, 1e+08, 1e+09, 1e+10, 1e+11, 1e+12, 1e+13, 1e+14, 1e+15, 1e+16, 1e+17,
+    1e+18, 1e+19, 1e+20, 1e+21, 1e+22, 1e+23, 1e+24, 1e+25, 1e+26, 1e+27, 1e+28, 1e+29,
+    1e+30, 1e+31, 1e+32, 1e+33, 1e+34, 1e+35, 1e+36, 1e+37, 1e+38, 1e+39};
+
+inline double doublePowerOfTen(int n) { return kDoublePowersOfTen[n - kMinDoublePower]; }
+
+inline uint32_t floatToBits(float f)
 {
-  if (!frag) return TextFragment();
-  std::vector<CodePoint> vec = textToCodePoints(frag);
-  std::transform(vec.begin(), vec.end(), vec.begin(), f);
-  return codePointsToText(vec);
+  uint32_t u;
+  std::memcpy(&u, &f, 4);
+  return u;
 }
 
-TextFragment reduce(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
+inline float bitsToFloat(uint32_t u)
 {
-  if (!frag) return TextFragment();
-  size_t len = frag.lengthInBytes();
-  SmallStackBuffer<char, kShortFragmentSizeInChars> temp(len);
-  char* buf = temp.data();
-  char* pb = buf;
+  float f;
+  std::memcpy(&f, &u, 4);
+  return f;
+}
 
-  for (const CodePoint c : frag)
+// the mantissa and exponent of a finite, non-negative float: f = mantissa * 2^exponent.
+inline void decomposeFloat(float f, uint32_t& mantissa, int& exponent)
+{
+  uint32_t bits = floatToBits(f);
+  uint32_t biasedExponent = (bits >> 23) & 0xff;
+  mantissa = bits & 0x7fffff;
+  if (biasedExponent)
   {
-    if (!validateCodePoint(c)) return TextFragment();
-    if (matchFn(c))
-    {
-      pb = utf::internal::utf_traits<utf::utf8>::encode(c, pb);
-    }
+    mantissa |= 0x800000;
+    exponent = static_cast<int>(biasedExponent) - 150;
+  }
+  else
+  {
+    exponent = -149;
   }
-
-  return TextFragment(buf, pb - buf);
 }
 
-TextFragment replace(const TextFragment& frag, CodePoint toFind, CodePoint toReplace)
+// given an approximation c of w * 10^q, return the correctly rounded float by
+// comparing the exact value with the midpoints between c and its neighbors.
+float refineFloat(uint64_t w, int q, float c)
 {
-  TextFragment r{};
-  for (const CodePoint c : frag)
+  uint32_t bits = floatToBits(c);
+  if (bits >= 0x7f800000) bits = 0x7f7fffff;
+  while (true)
   {
-    if (c == toFind)
+    uint32_t m;
+    int e;
+    decomposeFloat(bitsToFloat(bits), m, e);
+
+    // compare with the midpoint between c and the next float up.
+    int above = compareDecimalWithBinary(w, q, 2 * uint64_t(m) + 1, e - 1);
+    if ((above > 0) || ((above == 0) && (m & 1)))
     {
-      r = TextFragment(r, toReplace);
+      bits++;
+      if (bits == 0x7f800000) break;
+      continue;
     }
-    else
+
+    // compare with the midpoint between c and the next float down, which is
+    // closer when c is a power of two.
+    if (bits == 0) break;
+    bool isPowerOfTwo = (m == 0x800000) && (e > -149);
+    int below = isPowerOfTwo ? compareDecimalWithBinary(w, q, 4 * uint64_t(m) - 1, e - 2)
+                             : compareDecimalWithBinary(w, q, 2 * uint64_t(m) - 1, e - 1);
+    if ((below < 0) || ((below == 0) && (m & 1)))
     {
-      r = TextFragment(r, c);
+      bits--;
+      continue;
     }
+    break;
   }
-  return r;
+  return bitsToFloat(bits);
 }
 
-std::vector<TextFragment> split(TextFragment frag, CodePoint delimiter)
+// return the float nearest to w * 10^q.
+float decimalToFloat(uint64_t w, int q)
 {
-  std::vector<TextFragment> output;
-  int start = 0;
-  int end = 0;
-  int pieceLen = 0;
-  for (const CodePoint c : frag)
+  if (w == 0) return 0.f;
+
+  // Clinger's fast path: both w and 10^q are exact floats, so a single operation
+  // gives the correctly rounded result.
+  if ((w < (1u << 24)) && (q >= -10) && (q <= 10))
   {
-    if (!validateCodePoint(c)) return std::vector<TextFragment>();
-    pieceLen++;
-    end++;
-    if (c == delimiter)
-    {
-      if (pieceLen > 1)
-      {
-        output.push_back(subText(frag, start, end - 1));
-      }
-      start = end;
-      pieceLen = 0;
-    }
+    float fw = static_cast<float>(w);
+    float p = static_cast<float>(doublePowerOfTen(q < 0 ? -q : q));
+    return q < 0 ? fw / p : fw * p;
   }
-  if (pieceLen > 0)
+
+  // the number of digits in w, to check the range.
+  int digits{1};
+  for (uint64_t t = w; t >= 10; t /= 10)
   {
-    output.push_back(subText(frag, start, end));
+    digits++;
   }
-  return output;
-}
-
-TextFragment join(const std::vector<TextFragment>& vec)
-{
-  TextFragment sum;
-  size_t len = vec.size();
-  for (int i = 0; i < len; ++i)
+  int decimalExponent = q + digits - 1;
+  if (decimalExponent < -46) return 0.f;
+  if (decimalExponent > 38) return std::numeric_limits<float>::infinity();
+
+  // with w and 10^q exact doubles, the double result is correctly rounded. Then
+  // rounding to float is also correct, unless the double is exactly halfway
+  // between two floats, in which case the double rounding may be wrong.
+  if ((w < (uint64_t(1) << 53)) && (q >= -22) && (q <= 22))
   {
-    TextFragment frag = vec[i];
-    sum = TextFragment(sum, vec[i]);
+    double p = doublePowerOfTen(q < 0 ? -q : q);
+    double d = q < 0 ? static_cast<double>(w) / p : static_cast<double>(w) * p;
+    uint64_t dBits;
+    std::memcpy(&dBits, &d, 8);
+    constexpr uint64_t kLowBits{(uint64_t(1) << 29) - 1};
+    bool isHalfway = (dBits & kLowBits) == (uint64_t(1) << 28);
+    float f = static_cast<float>(d);
+    return isHalfway ? refineFloat(w, q, f) : f;
   }
-  return sum;
+
+  // otherwise, get close using doubles and then refine. Because of the range
+  // checks above, q is within the table.
+  return refineFloat(w, q, static_cast<float>(static_cast<double>(w) * doublePowerOfTen(q)));
 }
 
-TextFragment join(const std::vector<TextFragment>& vec, CodePoint delimiter)
+// get the decimal digits of the positive float f correctly rounded to
+// `precision` significant digits, returning them as an integer with exactly that
+// many digits. decimalExponent is an estimate of the exponent of the first digit,
+// which is corrected if needed.
+uint32_t getDigits(float f, int precision, int& decimalExponent)
 {
-  TextFragment delimFrag(delimiter);
-  TextFragment sum;
-  size_t len = vec.size();
-  for (int i = 0; i < len; ++i)
+  static constexpr uint32_t kPowers[10]{1,      10,      100,      1000,      10000,
+                                        100000, 1000000, 10000000, 100000000, 1000000000};
+  const uint64_t lowest = kPowers[precision - 1];
+  const uint64_t highest = kPowers[precision];
+  const double d = f;
+
+  while (true)
   {
-    TextFragment frag = vec[i];
-    sum = TextFragment(sum, vec[i]);
-    if ((i >= 0) && (i < len - 1))
+    // get f * 10^n, rounded and truncated.
+    int n = precision - 1 - decimalExponent;
+    double scaled = (n > kMaxDoublePower)
+                        ? d * doublePowerOfTen(kMaxDoublePower) * doublePowerOfTen(n - kMaxDoublePower)
+                        : d * doublePowerOfTen(n);
+    uint64_t truncated, rounded;
+
+    // the error in scaled is at most a few units in its last place, which only
+    // matters if it is very close to halfway between two integers.
+    double fraction = scaled - std::floor(scaled);
+    if (std::abs(fraction - 0.5) > scaled * 1e-14)
     {
-      sum = TextFragment(sum, delimFrag);
+      truncated = static_cast<uint64_t>(scaled);
+      rounded = truncated + (fraction > 0.5);
+    }
+    else
+    {
+      // find the exact integer part by binary long division, and round using
+      // the exact remainder.
+      uint32_t m;
+      int e;
+      decomposeFloat(f, m, e);
+      BigUnsigned numerator(m), denominator(1);
+      if (n >= 0)
+        numerator.multiplyByPowerOfTen(n);
+      else
+        denominator.multiplyByPowerOfTen(-n);
+      if (e >= 0)
+        numerator.shiftLeft(e);
+      else
+        denominator.shiftLeft(-e);
+
+      truncated = 0;
+      for (int bit = 35; bit >= 0; --bit)
+      {
+        BigUnsigned shifted(denominator);
+        shifted.shiftLeft(bit);
+        if (compare(numerator, shifted) >= 0)
+        {
+          numerator.subtract(shifted);
+          truncated |= uint64_t(1) << bit;
+        }
+      }
+      numerator.shiftLeft(1);
+      int c = compare(numerator, denominator);
+      rounded = truncated + ((c > 0) || ((c == 0) && (truncated & 1)));
+    }
+
+    if (truncated < lowest)
+    {
+      decimalExponent--;
+    }
+    else if (truncated >= highest)
+    {
+      decimalExponent++;
+    }
+    else if (rounded == highest)
+    {
+      // rounding carried into a new digit.
+      decimalExponent++;
+      return static_cast<uint32_t>(lowest);
+    }
+    else
+    {
+      return static_cast<uint32_t>(rounded);
     }
   }
-  return sum;
 }
 
-TextFragment stripExtension(const TextFragment& frag)
+// estimate the decimal exponent of a positive, finite float.
+int estimateDecimalExponent(float f)
 {
-  int dotLoc = findLast(frag, '.');
-  if (dotLoc >= 0)
+  uint32_t m;
+  int e;
+  decomposeFloat(f, m, e);
+  int bits{0};
+  for (uint32_t t = m; t; t >>= 1)
   {
-    return subText(frag, 0, dotLoc);
+    bits++;
   }
-  return frag;
+
+  // log10(2) = 0.30103
+  return static_cast<int>(std::floor((e + bits - 1) * 0.30103));
 }
 
-TextFragment getExtension(const TextFragment& frag)
+char* writeExponent(char* p, int exponent)
 {
-  int dotLoc = findLast(frag, '.');
-  if (dotLoc >= 0)
-  {
-    size_t len = frag.lengthInCodePoints();
-    return subText(frag, dotLoc + 1, len);
-  }
-  return frag;
+  *p++ = 'e';
+  *p++ = exponent < 0 ? '-' : '+';
+  if (exponent < 0) exponent = -exponent;
+  *p++ = static_cast<char>('0' + exponent / 10);
+  *p++ = static_cast<char>('0' + exponent % 10);
+  return p;
 }
+}  // namespace
 
-
-TextFragment getShortFileName(const TextFragment& frag)
+char* writeFloatNumber(float f, char* pDest)
 {
-  int slashLoc = findLast(frag, '/');
-  if (slashLoc >= 0)
+  char* p = pDest;
+  if (std::isnan(f))
   {
-    return subText(frag, slashLoc + 1, frag.lengthInCodePoints());
+    std::memcpy(p, "nan", 3);
+    return p + 3;
+  }
+  if (std::signbit(f))
+  {
+    *p++ = '-';
+    f = -f;
+  }
+  if (std::isinf(f))
+  {
+    std::memcpy(p, "inf", 3);
+    return p + 3;
+  }
+  if (f == 0.f)
+  {
+    *p++ = '0';
+    return p;
   }
-  return frag;
-}
 
-TextFragment getPath(const TextFragment& frag)
-{
-  int slashLoc = findLast(frag, '/');
-  if (slashLoc >= 0)
+  // find the fewest significant digits that read back as f.
+  int decimalExponent = estimateDecimalExponent(f);
+  uint32_t digits{0};
+  int precision;
+  for (precision = 1; precision <= 9; ++precision)
   {
-    return subText(frag, 0, slashLoc);
+    digits = getDigits(f, precision, decimalExponent);
+    if (decimalToFloat(digits, decimalExponent - precision + 1) == f) break;
   }
-  return frag;
-}
+  precision = std::min(precision, 9);
 
-// TODO extend to recognize Cyrillic and other scripts
-Symbol bestScriptForTextFragment(const TextFragment& frag)
-{
-  for (const CodePoint c : frag)
+  char digitChars[10];
+  for (int i = precision - 1; i >= 0; --i)
   {
-    if (!validateCodePoint(c)) return "unknown";
-    // if there are any CJK characters, return CJK
-    if (isCJK(c))
-    {
-      return "cjk";
-    }
-    else if (!isLatin(c))
+    digitChars[i] = static_cast<char>('0' + digits % 10);
+    digits /= 10;
+  }
+  while ((precision > 1) && (digitChars[precision - 1] == '0'))
+  {
+    precision--;
+  }
+
+  if ((decimalExponent < -5) || (decimalExponent >= 9))
+  {
+    *p++ = digitChars[0];
+    if (precision > 1)
     {
-      return "unknown";
+      *p++ = '.';
+      p = std::copy(digitChars + 1, digitChars + precision, p);
     }
+    return writeExponent(p, decimalExponent);
   }
-  return "latin";
-}
-
-static constexpr char base64table[]{
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/="};
 
-TextFragment base64Encode(const std::vector<uint8_t>& in)
-{
-  std::vector<char> out;
+  if (decimalExponent < 0)
+  {
+    *p++ = '0';
+    *p++ = '.';
+    p = std::fill_n(p, -decimalExponent - 1, '0');
+    return std::copy(digitChars, digitChars + precision, p);
+  }
 
-  int val = 0, valb = -6;
-  for (uint8_t c : in)
+  int integerDigits = decimalExponent + 1;
+  if (precision <= integerDigits)
   {
-    val = (val << 8) + c;
-    valb += 8;
-    while (valb >= 0)
-    {
-      out.push_back(base64table[(val >> valb) & 0x3F]);
-      valb -= 6;
-    }
+    p = std::copy(digitChars, digitChars + precision, p);
+    return std::fill_n(p, integerDigits - precision, '0');
   }
-  if (valb > -6) out.push_back(base64table[((val << 8) >> (valb + 8)) & 0x3F]);
-  while (out.size() % 4) out.push_back('=');
-  out.push_back(0);
-  return TextFragment(out.data());
+  p = std::copy(digitChars, digitChars + integerDigits, p);
+  *p++ = '.';
+  return std::copy(digitChars + integerDigits, digitChars + precision, p);
 }
 
-std::vector<uint8_t> base64Decode(const TextFragment& in)
+const char* readFloatNumber(const char* pText, const char* pEnd, float& f)
 {
-  // in every call we build a reverse lookup table.
-  // TODO this could probably be made once in a constexpr
-  std::vector<int> T(256, -1);
-  for (int i = 0; i < 64; i++) T[base64table[i]] = i;
+  const char* p = pText;
+  auto matches = [&](const char* word, size_t len) {
+    return (pEnd - p >= static_cast<ptrdiff_t>(len)) && !std::memcmp(p, word, len);
+  };
 
-  std::vector<uint8_t> out;
-  int val = 0, valb = -8;
-  for (uint8_t c : in)
+  bool negative{false};
+  if ((p < pEnd) && ((*p == '-') || (*p == '+')))
   {
-    if (T[c] == -1) break;
-    val = (val << 6) + T[c];
-    valb += 6;
-    if (valb >= 0)
-    {
-      out.push_back(char((val >> valb) & 0xFF));
-      valb -= 8;
-    }
+    negative = (*p == '-');
+    p++;
   }
-  return out;
+  if (matches("nan", 3))
+  {
+    f = std::numeric_limits<float>::quiet_NaN();
+    return p + 3;
+  }
+  if (matches("inf", 3))
+  {
+    f = negative ? -std::numeric_limits<float>::infinity()
+                 : std::numeric_limits<float>::infinity();
+    return p + 3;
+  }
+
+  // read up to 19 significant digits, which fit into a uint64_t.
+  constexpr int kMaxDigits{19};
+  uint64_t w{0};
+  int significantDigits{0};
+  int exponent{0};
+  bool anyDigits{false};
+  auto isDigitChar = [](char c) { return (c >= '0') && (c <= '9'); };
+  for (; (p < pEnd) && isDigitChar(*p); ++p)
+  {
+    anyDigits = true;
+    if (significantDigits < kMaxDigits)
+    {
+      w = w * 10 + (*p - '0');
+      if (w) significantDigits++;
+    }
+    else
+    {
+      exponent++;
+    }
+  }
+  if ((p < pEnd) && (*p == '.'))
+  {
+    p++;
+    for (; (p < pEnd) && isDigitChar(*p); ++p)
+    {
+      anyDigits = true;
+      if (significantDigits < kMaxDigits)
+      {
+        w = w * 10 + (*p - '0');
+        if (w) significantDigits++;
+        exponent--;
+      }
+    }
+  }
+  if (!anyDigits)
+  {
+    f = 0.f;
+    return pText;
+  }
+
+  if ((p < pEnd) && ((*p == 'e') || (*p == 'E')))
+  {
+    const char* pExp = p + 1;
+    bool negativeExp{false};
+    if ((pExp < pEnd) && ((*pExp == '-') || (*pExp == '+')))
+    {
+      negativeExp = (*pExp == '-');
+      pExp++;
+    }
+    if ((pExp < pEnd) && isDigitChar(*pExp))
+    {
+      int e{0};
+      for (; (pExp < pEnd) && isDigitChar(*pExp); ++pExp)
+      {
+        if (e < 10000) e = e * 10 + (*pExp - '0');
+      }
+      exponent += negativeExp ? -e : e;
+      p = pExp;
+    }
+  }
+
+  float r = decimalToFloat(w, exponent);
+  f = negative ? -r : r;
+  return p;
+}
+
+TextFragment floatNumberToText(float f)
+{
+  char buf[kMaxFloatTextLength];
+  return TextFragment(buf, writeFloatNumber(f, buf) - buf);
+}
+
+char* floatNumbersToText(const float* pSrc, size_t n, char* pDest, char separator)
+{
+  char* p = pDest;
+  for (size_t i = 0; i < n; ++i)
+  {
+    if (i) *p++ = separator;
+    p = writeFloatNumber(pSrc[i], p);
+  }
+  return p;
+}
+
+size_t textToFloatNumbers(TextView text, float* pDest, size_t maxFloats)
+{
+  const char* p = text.getText();
+  const char* pEnd = p + text.lengthInBytes();
+  size_t n{0};
+  while (n < maxFloats)
+  {
+    while ((p < pEnd) && ((*p == ' ') || (*p == ',') || ((*p >= '\t') && (*p <= '\r'))))
+    {
+      p++;
+    }
+    if (p == pEnd) break;
+    const char* pNext = readFloatNumber(p, pEnd, pDest[n]);
+    if (pNext == p) break;
+    p = pNext;
+    n++;
+  }
+  return n;
+}
+
+float textToFloatNumber(const char* input)
+{
+  float f{0};
+  if (input) readFloatNumber(input, input + strlen(input), f);
+  return f;
+}
+
+float textToFloatNumber(TextView text)
+{
+  float f{0};
+  readFloatNumber(text.getText(), text.getText() + text.lengthInBytes(), f);
+  return f;
+}
+
+float textToFloatNumber(const TextFragment& frag) { return textToFloatNumber(TextView(frag)); }
+
+int findFirst(const TextFragment& frag, const CodePoint b)
+{
+  return findFirst(TextView(frag), b);
+}
+
+int findFirst(TextView frag, const CodePoint b)
+{
+  int r = npos;
+  if (!frag) return r;
+
+  // in ASCII text, code point indices are byte indices.
+  const char* pText = frag.getText();
+  size_t len = frag.lengthInBytes();
+  if (ml::isASCII(pText, len))
+  {
+    if (b >= 0x80) return r;
+    auto pFound = static_cast<const char*>(memchr(pText, static_cast<int>(b), len));
+    return pFound ? static_cast<int>(pFound - pText) : r;
+  }
+
+  int i = 0;
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return r;
+    if (c == b)
+    {
+      r = i;
+      break;
+    }
+    i++;
+  }
+  return r;
+}
+
+int findLast(const TextFragment& frag, const CodePoint b)
+{
+  return findLast(TextView(frag), b);
+}
+
+int findLast(TextView frag, const CodePoint b)
+{
+  int r = npos;
+  if (!frag) return r;
+
+  const char* pText = frag.getText();
+  size_t len = frag.lengthInBytes();
+  if (ml::isASCII(pText, len))
+  {
+    if (b >= 0x80) return r;
+    for (size_t j = len; j > 0; --j)
+    {
+      if (static_cast<CodePoint>(pText[j - 1]) == b) return static_cast<int>(j - 1);
+    }
+    return r;
+  }
+
+  int i = 0;
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return r;
+    if (c == b)
+    {
+      r = i;
+    }
+    i++;
+  }
+  return r;
+}
+
+int findFirst(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
+{
+  int r = npos;
+  if (!frag) return r;
+  int i = 0;
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return r;
+    if (matchFn(c))
+    {
+      r = i;
+      break;
+    }
+    i++;
+  }
+  return r;
+}
+
+// TODO dumb, have to call matchFn on each code point because we have no reverse
+// iterator
+int findLast(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
+{
+  int r = npos;
+  if (!frag) return r;
+  int i = 0;
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return r;
+    if (matchFn(c))
+    {
+      r = i;
+    }
+    i++;
+  }
+  return r;
+}
+
+TextFragment subText(const TextFragment& frag, size_t start, size_t end)
+{
+  return TextFragment(subText(TextView(frag), start, end));
+}
+
+TextView subText(TextView frag, size_t start, size_t end)
+{
+  if (!frag) return TextView();
+  if (start >= end) return TextView();
+
+  const char* pText = frag.getText();
+  size_t len = frag.lengthInBytes();
+  if (ml::isASCII(pText, len))
+  {
+    end = std::min(end, len);
+    if (start >= end) return TextView();
+    return TextView(pText + start, end - start);
+  }
+
+  // find the start and end of the range in bytes, validating the code points in
+  // the range.
+  auto it = frag.begin();
+  auto textEnd = frag.end();
+  for (size_t i = 0; (i < start) && (it != textEnd); ++i)
+  {
+    ++it;
+  }
+  const char* pStart = it.getPosition();
+  for (size_t i = start; (i < end) && (it != textEnd); ++i)
+  {
+    if (!validateCodePoint(*it)) return TextView();
+    ++it;
+  }
+  return TextView(pStart, it.getPosition() - pStart);
+}
+
+TextFragment map(const TextFragment& frag, std::function<CodePoint(CodePoint)> f)
+{
+  if (!frag) return TextFragment();
+
+  // each code point needs at most 4 bytes.
+  SmallStackBuffer<char, kShortFragmentSizeInChars> temp(frag.lengthInCodePoints() * 4);
+  char* buf = temp.data();
+  char* pb = buf;
+  for (const CodePoint c : frag)
+  {
+    CodePoint d = f(c);
+    if (!validateCodePoint(d)) return TextFragment();
+    pb = utf::internal::utf_traits<utf::utf8>::encode(d, pb);
+  }
+  return TextFragment(buf, pb - buf);
+}
+
+TextFragment reduce(const TextFragment& frag, std::function<bool(CodePoint)> matchFn)
+{
+  if (!frag) return TextFragment();
+  size_t len = frag.lengthInBytes();
+  SmallStackBuffer<char, kShortFragmentSizeInChars> temp(len);
+  char* buf = temp.data();
+  char* pb = buf;
+
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return TextFragment();
+    if (matchFn(c))
+    {
+      pb = utf::internal::utf_traits<utf::utf8>::encode(c, pb);
+    }
+  }
+
+  return TextFragment(buf, pb - buf);
+}
+
+TextFragment replace(const TextFragment& frag, CodePoint toFind, CodePoint toReplace)
+{
+  TextFragment r{};
+  for (const CodePoint c : frag)
+  {
+    if (c == toFind)
+    {
+      r = TextFragment(r, toReplace);
+    }
+    else
+    {
+      r = TextFragment(r, c);
+    }
+  }
+  return r;
+}
+
+std::vector<TextFragment> split(TextFragment frag, CodePoint delimiter)
+{
+  auto views = split(TextView(frag), delimiter);
+  return std::vector<TextFragment>(views.begin(), views.end());
+}
+
+std::vector<TextView> split(TextView frag, CodePoint delimiter)
+{
+  std::vector<TextView> output;
+  const char* pText = frag.getText();
+  const char* pEnd = pText + frag.lengthInBytes();
+  const char* pPieceStart = pText;
+  auto addPiece = [&](const char* pPieceEnd) {
+    if (pPieceEnd > pPieceStart)
+    {
+      output.emplace_back(pPieceStart, pPieceEnd - pPieceStart);
+    }
+  };
+
+  if ((delimiter < 0x80) && ml::isASCII(pText, frag.lengthInBytes()))
+  {
+    // ASCII text needs no validation, and the delimiter can be found bytewise.
+    const char* p;
+    while ((p = static_cast<const char*>(
+                memchr(pPieceStart, static_cast<int>(delimiter), pEnd - pPieceStart))))
+    {
+      addPiece(p);
+      pPieceStart = p + 1;
+    }
+  }
+  else
+  {
+    for (auto it = frag.begin(); it.getPosition() < pEnd; ++it)
+    {
+      CodePoint c = *it;
+      if (!validateCodePoint(c)) return std::vector<TextView>();
+      if (c == delimiter)
+      {
+        addPiece(it.getPosition());
+        pPieceStart = it.getPosition() + utf8SequenceLength(*it.getPosition());
+      }
+    }
+  }
+  addPiece(pEnd);
+  return output;
+}
+
+TextFragment join(const std::vector<TextFragment>& vec)
+{
+  TextFragment sum;
+  size_t len = vec.size();
+  for (int i = 0; i < len; ++i)
+  {
+    TextFragment frag = vec[i];
+    sum = TextFragment(sum, vec[i]);
+  }
+  return sum;
+}
+
+TextFragment join(const std::vector<TextFragment>& vec, CodePoint delimiter)
+{
+  TextFragment delimFrag(delimiter);
+  TextFragment sum;
+  size_t len = vec.size();
+  for (int i = 0; i < len; ++i)
+  {
+    TextFragment frag = vec[i];
+    sum = TextFragment(sum, vec[i]);
+    if ((i >= 0) && (i < len - 1))
+    {
+      sum = TextFragment(sum, delimFrag);
+    }
+  }
+  return sum;
+}
+
+TextFragment stripExtension(const TextFragment& frag)
+{
+  return TextFragment(stripExtension(TextView(frag)));
+}
+
+TextView stripExtension(TextView frag)
+{
+  int dotLoc = findLast(frag, '.');
+  if (dotLoc >= 0)
+  {
+    return subText(frag, 0, dotLoc);
+  }
+  return frag;
+}
+
+TextFragment getExtension(const TextFragment& frag)
+{
+  return TextFragment(getExtension(TextView(frag)));
+}
+
+TextView getExtension(TextView frag)
+{
+  int dotLoc = findLast(frag, '.');
+  if (dotLoc >= 0)
+  {
+    size_t len = frag.lengthInCodePoints();
+    return subText(frag, dotLoc + 1, len);
+  }
+  return frag;
+}
+
+TextFragment getShortFileName(const TextFragment& frag)
+{
+  return TextFragment(getShortFileName(TextView(frag)));
+}
+
+TextView getShortFileName(TextView frag)
+{
+  int slashLoc = findLast(frag, '/');
+  if (slashLoc >= 0)
+  {
+    return subText(frag, slashLoc + 1, frag.lengthInCodePoints());
+  }
+  return frag;
+}
+
+TextFragment getPath(const TextFragment& frag) { return TextFragment(getPath(TextView(frag))); }
+
+TextView getPath(TextView frag)
+{
+  int slashLoc = findLast(frag, '/');
+  if (slashLoc >= 0)
+  {
+    return subText(frag, 0, slashLoc);
+  }
+  return frag;
+}
+
+// TODO extend to recognize Cyrillic and other scripts
+Symbol bestScriptForTextFragment(const TextFragment& frag)
+{
+  for (const CodePoint c : frag)
+  {
+    if (!validateCodePoint(c)) return "unknown";
+    // if there are any CJK characters, return CJK
+    if (isCJK(c))
+    {
+      return "cjk";
+    }
+    else if (!isLatin(c))
+    {
+      return "unknown";
+    }
+  }
+  return "latin";
+}
+
+// ----------------------------------------------------------------
+// base64
+
+namespace
+{
+constexpr char kBase64Chars[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+
+// values in the decoding table above 63.
+constexpr uint8_t kBase64Whitespace{0xFE};
+constexpr uint8_t kBase64Invalid{0xFF};
+
+struct Base64DecodingTable
+{
+  uint8_t values[256];
+  constexpr Base64DecodingTable() : values()
+  {
+    for (int i = 0; i < 256; ++i) values[i] = kBase64Invalid;
+    for (int i = 0; i < 64; ++i) values[static_cast<uint8_t>(kBase64Chars[i])] = i;
+    for (char c : {' ', '\t', '\n', '\r'}) values[static_cast<uint8_t>(c)] = kBase64Whitespace;
+  }
+};
+constexpr Base64DecodingTable kBase64Decoding;
+
+inline void encodeTriple(const uint8_t* pSrc, char* pDest)
+{
+  uint32_t v = (pSrc[0] << 16) | (pSrc[1] << 8) | pSrc[2];
+  pDest[0] = kBase64Chars[v >> 18];
+  pDest[1] = kBase64Chars[(v >> 12) & 0x3F];
+  pDest[2] = kBase64Chars[(v >> 6) & 0x3F];
+  pDest[3] = kBase64Chars[v & 0x3F];
+}
+
+#if ML_TEXT_X86
+// encode 12 bytes from each 16 loaded into 16 chars, using the method of
+// Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and Decoding Using
+// AVX2 Instructions".
+ML_TARGET("ssse3") size_t encodeBlocksSSSE3(const uint8_t* pSrc, size_t n, char* pDest)
+{
+  const __m128i reshuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 12, pDest += 16)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+    in = _mm_shuffle_epi8(in, reshuffle);
+
+    // move each group of 6 bits into its own byte.
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                                 _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                                 _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(t0, t1);
+
+    // get the offset from each index to its char by the range it is in.
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+    __m128i chars = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest), chars);
+  }
+  return i;
 }
 
-TextFragment stripWhitespaceAtEnds(const TextFragment& frag)
+// decode blocks of 16 valid chars into 12 bytes each, stopping at the first
+// block containing any other chars. Each block is written with a 16-byte store,
+// so we stop with at least 24 chars left to stay inside the output buffer.
+ML_TARGET("ssse3") size_t decodeBlocksSSSE3(const char* pSrc, size_t n, uint8_t* pDest)
 {
-  std::function<bool(CodePoint)> f([](CodePoint c) { return !isWhitespace(c); });
-  int first = findFirst(frag, f);
-  int last = findLast(frag, f);
-  if ((first == npos) || (last == npos)) return TextFragment();
-  return (subText(frag, first, last + 1));
+  const __m128i lowNibbleBits = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                              0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i highNibbleBits = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i offsets = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  size_t i = 0;
+  for (; i + 24 <= n; i += 16, pDest += 12)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+    __m128i highNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibbleMask);
+    __m128i lowNibbles = _mm_and_si128(in, nibbleMask);
+
+    // a char is valid if its bits in the two lookups have nothing in common.
+    __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lowNibbleBits, lowNibbles),
+                                    _mm_shuffle_epi8(highNibbleBits, highNibbles));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(invalid, _mm_setzero_si128())) != 0xFFFF) break;
+
+    // the offset from each char to its value depends on its high nibble, except
+    // for '/' which shares its high nibble with '+'.
+    __m128i isSlash = _mm_cmpeq_epi8(in, slash);
+    __m128i values =
+        _mm_add_epi8(in, _mm_shuffle_epi8(offsets, _mm_add_epi8(isSlash, highNibbles)));
+
+    // pack each 4 6-bit values into 3 bytes.
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest), _mm_shuffle_epi8(words, pack));
+  }
+  return i;
 }
 
-TextFragment stripAllWhitespace(const TextFragment& frag)
+#elif ML_TEXT_NEON
+// encode 48 bytes at a time into 64 chars, using a 64-entry table lookup.
+size_t encodeBlocksNEON(const uint8_t* pSrc, size_t n, char* pDest)
 {
-  std::function<bool(CodePoint)> f([](CodePoint c) { return !isWhitespace(c); });
-  return reduce(frag, f);
+  const uint8x16x4_t table = vld1q_u8_x4(reinterpret_cast<const uint8_t*>(kBase64Chars));
+  const uint8x16_t mask = vdupq_n_u8(0x3F);
+  size_t i = 0;
+  for (; i + 48 <= n; i += 48, pDest += 64)
+  {
+    uint8x16x3_t in = vld3q_u8(pSrc + i);
+    uint8x16x4_t indices;
+    indices.val[0] = vshrq_n_u8(in.val[0], 2);
+    indices.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+    indices.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+    indices.val[3] = vandq_u8(in.val[2], mask);
+    uint8x16x4_t chars;
+    for (int j = 0; j < 4; ++j)
+    {
+      chars.val[j] = vqtbl4q_u8(table, indices.val[j]);
+    }
+    vst4q_u8(reinterpret_cast<uint8_t*>(pDest), chars);
+  }
+  return i;
 }
 
-std::vector<uint8_t> AES256CBCEncode(const std::vector<uint8_t>& input,
-                                     const std::vector<uint8_t>& key,
-                                     const std::vector<uint8_t>& iv)
+// decode 64 valid chars at a time into 48 bytes, stopping at the first block
+// containing any other chars.
+size_t decodeBlocksNEON(const char* pSrc, size_t n, uint8_t* pDest)
 {
-  if (!(input.size() > 0) || !(key.size() == 32) || !(iv.size() == 32))
-    return std::vector<uint8_t>();
+  const uint8x16x4_t table0 = vld1q_u8_x4(kBase64Decoding.values);
+  const uint8x16x4_t table1 = vld1q_u8_x4(kBase64Decoding.values + 64);
+  const uint8x16_t offset = vdupq_n_u8(64);
+  const uint8x16_t highBit = vdupq_n_u8(0x80);
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64, pDest += 48)
+  {
+    uint8x16x4_t in = vld4q_u8(reinterpret_cast<const uint8_t*>(pSrc + i));
+    uint8x16x4_t values;
+    uint8x16_t invalid = vdupq_n_u8(0);
+    for (int j = 0; j < 4; ++j)
+    {
+      // chars from 128 up are out of range of both tables and get 0, so they
+      // are caught by checking their high bits as well as the values.
+      uint8x16_t v = vqtbx4q_u8(vqtbl4q_u8(table0, in.val[j]), table1,
+                                vsubq_u8(in.val[j], offset));
+      invalid = vorrq_u8(invalid, vorrq_u8(v, vandq_u8(in.val[j], highBit)));
+      values.val[j] = v;
+    }
+    if (vmaxvq_u8(invalid) > 0x3F) break;
 
-  aes256_context ctx;
-  aes256_init(&ctx, key.data());
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(values.val[0], 2), vshrq_n_u8(values.val[1], 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(values.val[1], 4), vshrq_n_u8(values.val[2], 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(values.val[2], 6), values.val[3]);
+    vst3q_u8(pDest, out);
+  }
+  return i;
+}
+#endif
 
-  const int blockSize = 16;
-  size_t inputSize = input.size();
-  size_t blocks = inputSize / blockSize + 1;
-  size_t paddedSize = blockSize * (blocks);
+// encode as many whole triples of bytes as possible, returning the number of
+// bytes encoded.
+size_t encodeBlocks(const uint8_t* pSrc, size_t n, char* pDest)
+{
+  size_t i = 0;
+#if ML_TEXT_X86
+  if (hasSSSE3()) i = encodeBlocksSSSE3(pSrc, n, pDest);
+#elif ML_TEXT_NEON
+  i = encodeBlocksNEON(pSrc, n, pDest);
+#endif
+  for (pDest += i / 3 * 4; i + 3 <= n; i += 3, pDest += 4)
+  {
+    encodeTriple(pSrc + i, pDest);
+  }
+  return i;
+}
 
-  // add PKCS padding
-  std::vector<uint8_t> plaintext = input;
-  plaintext.resize(paddedSize);
-  size_t padBytes = paddedSize - inputSize;
-  for (size_t i = inputSize; i < paddedSize; ++i)
+// decode as many groups of four valid chars as possible, returning the number
+// of chars decoded.
+size_t decodeBlocks(const char* pSrc, size_t n, uint8_t* pDest)
+{
+  size_t i = 0;
+#if ML_TEXT_X86
+  if (hasSSSE3()) i = decodeBlocksSSSE3(pSrc, n, pDest);
+#elif ML_TEXT_NEON
+  i = decodeBlocksNEON(pSrc, n, pDest);
+#endif
+  const uint8_t* pValues = kBase64Decoding.values;
+  for (pDest += i / 4 * 3; i + 4 <= n; i += 4, pDest += 3)
   {
-    plaintext[i] = padBytes;
+    uint32_t a = pValues[static_cast<uint8_t>(pSrc[i])];
+    uint32_t b = pValues[static_cast<uint8_t>(pSrc[i + 1])];
+    uint32_t c = pValues[static_cast<uint8_t>(pSrc[i + 2])];
+    uint32_t d = pValues[static_cast<uint8_t>(pSrc[i + 3])];
+    if ((a | b | c | d) > 0x3F) break;
+    uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+    pDest[0] = static_cast<uint8_t>(v >> 16);
+    pDest[1] = static_cast<uint8_t>(v >> 8);
+    pDest[2] = static_cast<uint8_t>(v);
   }
+  return i;
+}
+}  // namespace
 
-  std::vector<uint8_t> ciphertext(paddedSize);
-  uint8_t currentIV[blockSize];
-  uint8_t workVector[blockSize];
+char* Base64Encoder::write(const uint8_t* pSrc, size_t n, char* pDest)
+{
+  // complete a triple with bytes left over from the previous write.
+  while (_pendingBytes && n)
+  {
+    n--;
+    if (_pendingBytes < 2)
+    {
+      _pending[_pendingBytes++] = *pSrc++;
+    }
+    else
+    {
+      uint8_t triple[3]{_pending[0], _pending[1], *pSrc++};
+      encodeTriple(triple, pDest);
+      pDest += 4;
+      _pendingBytes = 0;
+    }
+  }
 
-  for (size_t i = 0; i < blockSize; ++i)
+  size_t encoded = encodeBlocks(pSrc, n, pDest);
+  pDest += encoded / 3 * 4;
+  for (size_t i = encoded; i < n; ++i)
   {
-    currentIV[i] = iv[i];
+    _pending[_pendingBytes++] = pSrc[i];
   }
+  return pDest;
+}
 
-  for (size_t b = 0; b < blocks; ++b)
+char* Base64Encoder::finish(char* pDest)
+{
+  if (!_pendingBytes) return pDest;
+  uint8_t triple[3]{_pending[0], _pendingBytes > 1 ? _pending[1] : static_cast<uint8_t>(0), 0};
+  encodeTriple(triple, pDest);
+  pDest[3] = '=';
+  if (_pendingBytes == 1) pDest[2] = '=';
+  _pendingBytes = 0;
+  return pDest + 4;
+}
+
+uint8_t* Base64Decoder::write(const char* pSrc, size_t n, uint8_t* pDest)
+{
+  const char* pEnd = pSrc + n;
+  while ((pSrc < pEnd) && !_done)
   {
-    // get plaintext XOR IV
-    for (size_t i = 0; i < blockSize; ++i)
+    if (!_pendingChars)
+    {
+      size_t decoded = decodeBlocks(pSrc, pEnd - pSrc, pDest);
+      pSrc += decoded;
+      pDest += decoded / 4 * 3;
+      if (pSrc == pEnd) break;
+    }
+
+    // handle whitespace, the end, or a group split across writes one char at a
+    // time.
+    uint8_t v = kBase64Decoding.values[static_cast<uint8_t>(*pSrc++)];
+    if (v < 64)
+    {
+      _pendingBits = (_pendingBits << 6) | v;
+      if (++_pendingChars == 4)
+      {
+        pDest[0] = static_cast<uint8_t>(_pendingBits >> 16);
+        pDest[1] = static_cast<uint8_t>(_pendingBits >> 8);
+        pDest[2] = static_cast<uint8_t>(_pendingBits);
+        pDest += 3;
+        _pendingBits = 0;
+        _pendingChars = 0;
+      }
+    }
+    else if (v == kBase64Invalid)
     {
-      workVector[i] = plaintext[b * blockSize + i] ^ currentIV[i];
+      pDest = finish(pDest);
+      _done = true;
     }
+  }
+  return pDest;
+}
+
+uint8_t* Base64Decoder::finish(uint8_t* pDest)
+{
+  // two chars make one byte and three make two. A single char is not enough for
+  // a byte and is ignored.
+  if (_pendingChars >= 2)
+  {
+    uint32_t bits = _pendingBits << (6 * (4 - _pendingChars));
+    *pDest++ = static_cast<uint8_t>(bits >> 16);
+    if (_pendingChars == 3) *pDest++ = static_cast<uint8_t>(bits >> 8);
+  }
+  _pendingBits = 0;
+  _pendingChars = 0;
+  return pDest;
+}
+
+char* base64Encode(const uint8_t* pSrc, size_t n, char* pDest)
+{
+  Base64Encoder encoder;
+  return encoder.finish(encoder.write(pSrc, n, pDest));
+}
+
+uint8_t* base64Decode(const char* pSrc, size_t n, uint8_t* pDest)
+{
+  Base64Decoder decoder;
+  return decoder.finish(decoder.write(pSrc, n, pDest));
+}
+
+TextFragment base64Encode(const std::vector<uint8_t>& in)
+{
+  SmallStackBuffer<char, kShortFragmentSizeInChars> buf(base64EncodedLength(in.size()));
+  char* pEnd = base64Encode(in.data(), in.size(), buf.data());
+  return TextFragment(buf.data(), pEnd - buf.data());
+}
+
+std::vector<uint8_t> base64Decode(const TextFragment& in)
+{
+  std::vector<uint8_t> out(base64MaxDecodedLength(in.lengthInBytes()));
+  uint8_t* pEnd = base64Decode(in.getText(), in.lengthInBytes(), out.data());
+  out.resize(pEnd - out.data());
+  return out;
+}
 
-    aes256_encrypt_ecb(&ctx, workVector);
+TextFragment stripWhitespaceAtEnds(const TextFragment& frag)
+{
+  return TextFragment(stripWhitespaceAtEnds(TextView(frag)));
+}
 
-    // write to ciphertext, get new IV
-    for (size_t i = 0; i < blockSize; ++i)
+TextView stripWhitespaceAtEnds(TextView frag)
+{
+  // find the first and last code points that are not whitespace.
+  const char* pEnd = frag.getText() + frag.lengthInBytes();
+  const char* pFirst{nullptr};
+  const char* pLastEnd{nullptr};
+  for (auto it = frag.begin(); it.getPosition() < pEnd; ++it)
+  {
+    CodePoint c = *it;
+    if (!validateCodePoint(c)) return TextView();
+    if (!isWhitespace(c))
     {
-      ciphertext[b * blockSize + i] = workVector[i];
-      currentIV[i] = workVector[i];
+      if (!pFirst) pFirst = it.getPosition();
+      pLastEnd = it.getPosition() + utf8SequenceLength(*it.getPosition());
     }
   }
+  if (!pFirst) return TextView();
+  return TextView(pFirst, std::min(pLastEnd, pEnd) - pFirst);
+}
 
-  aes256_done(&ctx);
-  return ciphertext;
+TextFragment stripAllWhitespace(const TextFragment& frag)
+{
+  std::function<bool(CodePoint)> f([](CodePoint c) { return !isWhitespace(c); });
+  return reduce(frag, f);
 }
 
-std::vector<uint8_t> AES256CBCDecode(const std::vector<uint8_t>& cipher,
-                                     const std::vector<uint8_t>& key,
-                                     const std::vector<uint8_t>& iv)
+// ----------------------------------------------------------------
+// AES256 CBC
+
+namespace
 {
-  if (!(cipher.size() > 0) || (key.size() < 32) || (iv.size() < 32)) return std::vector<uint8_t>();
+constexpr size_t kAESBlockSize{16};
+constexpr size_t kAES256Rounds{14};
+
+#if ML_TEXT_X86
+// AES-NI code following Shay Gueron, "Intel Advanced Encryption Standard (AES)
+// New Instructions Set".
 
-  aes256_context ctx;
-  aes256_init(&ctx, key.data());
+ML_TARGET("aes") inline __m128i expandKeyStep(__m128i a, __m128i b)
+{
+  a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+  a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+  a = _mm_xor_si128(a, _mm_slli_si128(a, 4));
+  return _mm_xor_si128(a, b);
+}
+
+template <int kRoundConstant>
+ML_TARGET("aes") inline void expandKeyPair(__m128i* pKeys)
+{
+  pKeys[0] = expandKeyStep(
+      pKeys[-2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(pKeys[-1], kRoundConstant), 0xff));
+  pKeys[1] =
+      expandKeyStep(pKeys[-1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(pKeys[0], 0), 0xaa));
+}
 
-  const int blockSize = 16;
-  size_t blocks = cipher.size() / blockSize;
+// write the round keys for encryption and decryption.
+ML_TARGET("aes") void expandKeyAESNI(const uint8_t* pKey, uint8_t* pEncrypt, uint8_t* pDecrypt)
+{
+  __m128i keys[kAES256Rounds + 2];
+  keys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pKey));
+  keys[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pKey + 16));
+  expandKeyPair<0x01>(keys + 2);
+  expandKeyPair<0x02>(keys + 4);
+  expandKeyPair<0x04>(keys + 6);
+  expandKeyPair<0x08>(keys + 8);
+  expandKeyPair<0x10>(keys + 10);
+  expandKeyPair<0x20>(keys + 12);
+  expandKeyPair<0x40>(keys + 14);
+
+  // the decryption keys are in reverse order, with the inner ones transformed
+  // for the equivalent inverse cipher.
+  auto pEncryptKeys = reinterpret_cast<__m128i*>(pEncrypt);
+  auto pDecryptKeys = reinterpret_cast<__m128i*>(pDecrypt);
+  for (size_t i = 0; i <= kAES256Rounds; ++i)
+  {
+    _mm_storeu_si128(pEncryptKeys + i, keys[i]);
+    __m128i k = keys[kAES256Rounds - i];
+    if ((i > 0) && (i < kAES256Rounds)) k = _mm_aesimc_si128(k);
+    _mm_storeu_si128(pDecryptKeys + i, k);
+  }
+}
 
-  std::vector<uint8_t> plaintext(blockSize * blocks);
+ML_TARGET("aes")
+void encryptBlocksAESNI(const uint8_t* pRoundKeys, uint8_t* pIV, const uint8_t* pSrc,
+                        size_t blocks, uint8_t* pDest)
+{
+  __m128i keys[kAES256Rounds + 1];
+  for (size_t i = 0; i <= kAES256Rounds; ++i)
+  {
+    keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRoundKeys) + i);
+  }
 
-  uint8_t currentIV[blockSize];
-  uint8_t nextIV[blockSize];
-  uint8_t workVector[blockSize];
+  // each block depends on the previous one, so they are encrypted one at a time.
+  __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIV));
+  for (size_t b = 0; b < blocks; ++b)
+  {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc) + b);
+    x = _mm_xor_si128(_mm_xor_si128(in, x), keys[0]);
+    for (size_t r = 1; r < kAES256Rounds; ++r)
+    {
+      x = _mm_aesenc_si128(x, keys[r]);
+    }
+    x = _mm_aesenclast_si128(x, keys[kAES256Rounds]);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest) + b, x);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(pIV), x);
+}
 
-  for (int i = 0; i < blockSize; ++i)
+ML_TARGET("aes")
+void decryptBlocksAESNI(const uint8_t* pRoundKeys, uint8_t* pIV, const uint8_t* pSrc,
+                        size_t blocks, uint8_t* pDest)
+{
+  __m128i keys[kAES256Rounds + 1];
+  for (size_t i = 0; i <= kAES256Rounds; ++i)
   {
-    currentIV[i] = iv[i];
+    keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRoundKeys) + i);
   }
 
-  for (int b = 0; b < blocks; ++b)
+  // blocks can be decrypted independently, so we decrypt four at a time to
+  // keep the AES unit busy.
+  constexpr size_t kWidth{4};
+  auto pIn = reinterpret_cast<const __m128i*>(pSrc);
+  auto pOut = reinterpret_cast<__m128i*>(pDest);
+  __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIV));
+  size_t b = 0;
+  for (; b + kWidth <= blocks; b += kWidth)
+  {
+    __m128i in[kWidth], x[kWidth];
+    for (size_t j = 0; j < kWidth; ++j)
+    {
+      in[j] = _mm_loadu_si128(pIn + b + j);
+      x[j] = _mm_xor_si128(in[j], keys[0]);
+    }
+    for (size_t r = 1; r < kAES256Rounds; ++r)
+    {
+      for (size_t j = 0; j < kWidth; ++j)
+      {
+        x[j] = _mm_aesdec_si128(x[j], keys[r]);
+      }
+    }
+    for (size_t j = 0; j < kWidth; ++j)
+    {
+      x[j] = _mm_aesdeclast_si128(x[j], keys[kAES256Rounds]);
+      _mm_storeu_si128(pOut + b + j, _mm_xor_si128(x[j], previous));
+      previous = in[j];
+    }
+  }
+  for (; b < blocks; ++b)
   {
-    // get next cipher block and use ciphertext as next IV
-    for (int i = 0; i < blockSize; ++i)
+    __m128i in = _mm_loadu_si128(pIn + b);
+    __m128i x = _mm_xor_si128(in, keys[0]);
+    for (size_t r = 1; r < kAES256Rounds; ++r)
     {
-      workVector[i] = cipher[b * blockSize + i];
-      nextIV[i] = workVector[i];
+      x = _mm_aesdec_si128(x, keys[r]);
     }
+    x = _mm_aesdeclast_si128(x, keys[kAES256Rounds]);
+    _mm_storeu_si128(pOut + b, _mm_xor_si128(x, previous));
+    previous = in;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(pIV), previous);
+}
+#endif
+
+// return the number of padding bytes at the end of the last block, or 0 if
+// the padding is not valid.
+size_t getPaddingLength(const uint8_t* pLastBlock)
+{
+  size_t padBytes = pLastBlock[kAESBlockSize - 1];
+  if ((padBytes < 1) || (padBytes > kAESBlockSize)) return 0;
+  return padBytes;
+}
+}  // namespace
 
-    aes256_decrypt_ecb(&ctx, workVector);
+// AES256Cipher holds the expanded key and the chaining value between blocks.
+// Whole blocks are encrypted or decrypted in CBC mode, with pSrc == pDest
+// allowed.
 
-    // write to plaintext, XOR work vector with IV
-    for (int i = 0; i < blockSize; ++i)
+class AES256Cipher
+{
+ public:
+  AES256Cipher(const uint8_t* pKey, const uint8_t* pIV)
+  {
+    std::copy(pIV, pIV + kAESBlockSize, _iv);
+#if ML_TEXT_X86
+    _hardware = hasAESNI();
+    if (_hardware)
     {
-      workVector[i] ^= currentIV[i];
-      plaintext[b * blockSize + i] = workVector[i];
-      currentIV[i] = nextIV[i];
+      expandKeyAESNI(pKey, _encryptKeys, _decryptKeys);
+      return;
     }
+#endif
+    aes256_init(&_context, pKey);
+  }
+
+  ~AES256Cipher()
+  {
+    // don't leave keys lying around in memory.
+    volatile uint8_t* p = reinterpret_cast<volatile uint8_t*>(this);
+    for (size_t i = 0; i < sizeof(AES256Cipher); ++i) p[i] = 0;
   }
 
-  aes256_done(&ctx);
+  void encryptBlocks(const uint8_t* pSrc, size_t blocks, uint8_t* pDest)
+  {
+#if ML_TEXT_X86
+    if (_hardware)
+    {
+      encryptBlocksAESNI(_encryptKeys, _iv, pSrc, blocks, pDest);
+      return;
+    }
+#endif
+    for (size_t b = 0; b < blocks; ++b)
+    {
+      for (size_t i = 0; i < kAESBlockSize; ++i)
+      {
+        _iv[i] ^= pSrc[i];
+      }
+      aes256_encrypt_ecb(&_context, _iv);
+      std::copy(_iv, _iv + kAESBlockSize, pDest);
+      pSrc += kAESBlockSize;
+      pDest += kAESBlockSize;
+    }
+  }
 
-  // remove PKCS padding
-  size_t paddedSize = plaintext.size();
-  if (paddedSize % blockSize == 0)
+  void decryptBlocks(const uint8_t* pSrc, size_t blocks, uint8_t* pDest)
   {
-    int padBytes = plaintext[paddedSize - 1];
-    if ((padBytes <= 16) && (padBytes < paddedSize))
+#if ML_TEXT_X86
+    if (_hardware)
     {
-      plaintext.resize(paddedSize - padBytes);
+      decryptBlocksAESNI(_decryptKeys, _iv, pSrc, blocks, pDest);
+      return;
+    }
+#endif
+    uint8_t work[kAESBlockSize], nextIV[kAESBlockSize];
+    for (size_t b = 0; b < blocks; ++b)
+    {
+      std::copy(pSrc, pSrc + kAESBlockSize, work);
+      std::copy(pSrc, pSrc + kAESBlockSize, nextIV);
+      aes256_decrypt_ecb(&_context, work);
+      for (size_t i = 0; i < kAESBlockSize; ++i)
+      {
+        pDest[i] = work[i] ^ _iv[i];
+      }
+      std::copy(nextIV, nextIV + kAESBlockSize, _iv);
+      pSrc += kAESBlockSize;
+      pDest += kAESBlockSize;
     }
   }
 
+ private:
+  uint8_t _iv[kAESBlockSize];
+  bool _hardware{false};
+  uint8_t _encryptKeys[(kAES256Rounds + 1) * kAESBlockSize];
+  uint8_t _decryptKeys[(kAES256Rounds + 1) * kAESBlockSize];
+  aes256_context _context;
+};
+
+size_t AES256CBCEncodeInPlace(uint8_t* pData, size_t n, const uint8_t* pKey, const uint8_t* pIV)
+{
+  // add PKCS padding
+  size_t paddedSize = AES256CBCEncodedLength(n);
+  std::fill(pData + n, pData + paddedSize, static_cast<uint8_t>(paddedSize - n));
+  AES256Cipher(pKey, pIV).encryptBlocks(pData, paddedSize / kAESBlockSize, pData);
+  return paddedSize;
+}
+
+size_t AES256CBCDecodeInPlace(uint8_t* pData, size_t n, const uint8_t* pKey, const uint8_t* pIV)
+{
+  if (!n || (n % kAESBlockSize)) return 0;
+  AES256Cipher(pKey, pIV).decryptBlocks(pData, n / kAESBlockSize, pData);
+  return n - getPaddingLength(pData + n - kAESBlockSize);
+}
+
+std::vector<uint8_t> AES256CBCEncode(const std::vector<uint8_t>& input,
+                                     const std::vector<uint8_t>& key,
+                                     const std::vector<uint8_t>& iv)
+{
+  if (!(input.size() > 0) || !(key.size() == 32) || !(iv.size() == 32))
+    return std::vector<uint8_t>();
+
+  std::vector<uint8_t> ciphertext(AES256CBCEncodedLength(input.size()));
+  std::copy(input.begin(), input.end(), ciphertext.begin());
+  AES256CBCEncodeInPlace(ciphertext.data(), input.size(), key.data(), iv.data());
+  return ciphertext;
+}
+
+std::vector<uint8_t> AES256CBCDecode(const std::vector<uint8_t>& cipher,
+                                     const std::vector<uint8_t>& key,
+                                     const std::vector<uint8_t>& iv)
+{
+  if (!(cipher.size() > 0) || (key.size() < 32) || (iv.size() < 32)) return std::vector<uint8_t>();
+
+  // any partial block at the end is ignored.
+  std::vector<uint8_t> plaintext(cipher.begin(),
+                                 cipher.begin() + cipher.size() / kAESBlockSize * kAESBlockSize);
+  plaintext.resize(
+      AES256CBCDecodeInPlace(plaintext.data(), plaintext.size(), key.data(), iv.data()));
   return plaintext;
 }
 
+AES256CBCEncoder::AES256CBCEncoder(const uint8_t* pKey, const uint8_t* pIV)
+    : _pCipher(std::make_unique<AES256Cipher>(pKey, pIV))
+{
+}
+
+AES256CBCEncoder::~AES256CBCEncoder() = default;
+
+uint8_t* AES256CBCEncoder::write(const uint8_t* pSrc, size_t n, uint8_t* pDest)
+{
+  // complete a block with bytes left over from the previous write.
+  if (_pendingBytes)
+  {
+    size_t bytes = std::min(n, kAESBlockSize - _pendingBytes);
+    std::copy(pSrc, pSrc + bytes, _pending + _pendingBytes);
+    _pendingBytes += bytes;
+    pSrc += bytes;
+    n -= bytes;
+    if (_pendingBytes < kAESBlockSize) return pDest;
+    _pCipher->encryptBlocks(_pending, 1, pDest);
+    pDest += kAESBlockSize;
+    _pendingBytes = 0;
+  }
+
+  size_t blocks = n / kAESBlockSize;
+  _pCipher->encryptBlocks(pSrc, blocks, pDest);
+  _pendingBytes = n - blocks * kAESBlockSize;
+  std::copy(pSrc + blocks * kAESBlockSize, pSrc + n, _pending);
+  return pDest + blocks * kAESBlockSize;
+}
+
+uint8_t* AES256CBCEncoder::finish(uint8_t* pDest)
+{
+  // add PKCS padding
+  std::fill(_pending + _pendingBytes, _pending + kAESBlockSize,
+            static_cast<uint8_t>(kAESBlockSize - _pendingBytes));
+  _pCipher->encryptBlocks(_pending, 1, pDest);
+  _pendingBytes = 0;
+  return pDest + kAESBlockSize;
+}
+
+AES256CBCDecoder::AES256CBCDecoder(const uint8_t* pKey, const uint8_t* pIV)
+    : _pCipher(std::make_unique<AES256Cipher>(pKey, pIV))
+{
+}
+
+AES256CBCDecoder::~AES256CBCDecoder() = default;
+
+uint8_t* AES256CBCDecoder::write(const uint8_t* pSrc, size_t n, uint8_t* pDest)
+{
+  // complete a block with bytes left over from the previous write, and decrypt
+  // it if there is more input after it.
+  if (_pendingBytes)
+  {
+    size_t bytes = std::min(n, kAESBlockSize - _pendingBytes);
+    std::copy(pSrc, pSrc + bytes, _pending + _pendingBytes);
+    _pendingBytes += bytes;
+    pSrc += bytes;
+    n -= bytes;
+    if ((_pendingBytes < kAESBlockSize) || !n) return pDest;
+    _pCipher->decryptBlocks(_pending, 1, pDest);
+    pDest += kAESBlockSize;
+    _pendingBytes = 0;
+  }
+
+  // decrypt all whole blocks but the last.
+  size_t blocks = n / kAESBlockSize;
+  if (blocks && (n % kAESBlockSize == 0)) blocks--;
+  _pCipher->decryptBlocks(pSrc, blocks, pDest);
+  _pendingBytes = n - blocks * kAESBlockSize;
+  std::copy(pSrc + blocks * kAESBlockSize, pSrc + n, _pending);
+  return pDest + blocks * kAESBlockSize;
+}
+
+uint8_t* AES256CBCDecoder::finish(uint8_t* pDest)
+{
+  if (_pendingBytes != kAESBlockSize) return pDest;
+  _pCipher->decryptBlocks(_pending, 1, _pending);
+  size_t bytes = kAESBlockSize - getPaddingLength(_pending);
+  std::copy(_pending, _pending + bytes, pDest);
+  _pendingBytes = 0;
+  return pDest + bytes;
+}
+
 bool collate(const TextFragment& a, const TextFragment& b)
+{
+  return collate(TextView(a), TextView(b));
+}
+
+bool collate(TextView a, TextView b)
 {
   auto ia = a.begin();
   auto ib = b.begin();
@@ -828,6 +2040,177 @@ bool collate(const TextFragment& a, const TextFragment& b)
   return false;
 }
 
+namespace
+{
+// Collation keys encode each code point so that the keys compare in the same
+// order as collate(). Latin code points take two bytes: the first orders by
+// lower case, as a char like collate() does, with the upper case letters
+// removed so that the values fit below 230. The second puts lower case before upper case. Other
+// code points take three bytes, starting with a value from 230.
+constexpr int kNonLatinKeyStart{230};
+
+uint8_t* writeCodePointKey(CodePoint c, uint8_t* pDest)
+{
+  if (isLatin(c))
+  {
+    bool isUpper = (c >= 'A') && (c <= 'Z');
+    int lower = static_cast<char>(isUpper ? c + ('a' - 'A') : c);
+    int primary = lower - std::numeric_limits<char>::min() - ((lower > 'Z') ? 26 : 0);
+    pDest[0] = static_cast<uint8_t>(primary);
+    pDest[1] = static_cast<uint8_t>(isUpper);
+    return pDest + 2;
+  }
+  uint32_t v = std::min(static_cast<uint32_t>(c), uint32_t(0x10FFFF)) - 0x100;
+  pDest[0] = static_cast<uint8_t>(kNonLatinKeyStart + (v >> 16));
+  pDest[1] = static_cast<uint8_t>(v >> 8);
+  pDest[2] = static_cast<uint8_t>(v);
+  return pDest + 3;
+}
+
+// for sorting, each key is represented by its first 8 bytes as a big-endian
+// integer, padded with zeros, and the position of the whole key.
+struct CollationEntry
+{
+  uint64_t prefix;
+  size_t offset;
+  uint32_t length;
+  uint32_t index;
+};
+
+struct CollationEntryLess
+{
+  const uint8_t* pKeys;
+
+  bool operator()(const CollationEntry& a, const CollationEntry& b) const
+  {
+    if (a.prefix != b.prefix) return a.prefix < b.prefix;
+    uint32_t length = std::min(a.length, b.length);
+    if (length > 8)
+    {
+      int c = std::memcmp(pKeys + a.offset + 8, pKeys + b.offset + 8, length - 8);
+      if (c) return c < 0;
+    }
+    if (a.length != b.length) return a.length < b.length;
+    return a.index < b.index;
+  }
+};
+
+// call f(i) for i in [0, n), using the calling thread for i = 0.
+template <typename F>
+void runInThreads(size_t n, F f)
+{
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < n; ++i)
+  {
+    threads.emplace_back(f, i);
+  }
+  f(0);
+  for (auto& t : threads)
+  {
+    t.join();
+  }
+}
+
+template <typename T>
+void applyOrder(std::vector<T>& v, const std::vector<size_t>& order)
+{
+  std::vector<T> sorted;
+  sorted.reserve(v.size());
+  for (size_t i : order)
+  {
+    sorted.push_back(std::move(v[i]));
+  }
+  v = std::move(sorted);
+}
+}  // namespace
+
+uint8_t* writeCollationKey(TextView text, uint8_t* pDest)
+{
+  for (CodePoint c : text)
+  {
+    pDest = writeCodePointKey(c, pDest);
+  }
+  return pDest;
+}
+
+std::vector<size_t> getCollationOrder(const std::vector<TextView>& texts, size_t maxThreads)
+{
+  // below this many texts per thread, starting threads costs more than it saves.
+  constexpr size_t kMinTextsPerThread{4096};
+  const size_t n = texts.size();
+  const size_t threads = std::max(size_t(1), std::min(maxThreads, n / kMinTextsPerThread));
+
+  // reserve space for the longest possible key of each text.
+  std::vector<CollationEntry> entries(n);
+  size_t keyBytes{0};
+  for (size_t i = 0; i < n; ++i)
+  {
+    entries[i].offset = keyBytes;
+    keyBytes += maxCollationKeyLength(texts[i].lengthInBytes());
+  }
+  std::vector<uint8_t> keys(keyBytes);
+  CollationEntryLess less{keys.data()};
+
+  // make the keys and sort each thread's part of the entries.
+  std::vector<size_t> partStarts(threads + 1);
+  for (size_t t = 0; t <= threads; ++t)
+  {
+    partStarts[t] = n * t / threads;
+  }
+  runInThreads(threads, [&](size_t t) {
+    for (size_t i = partStarts[t]; i < partStarts[t + 1]; ++i)
+    {
+      CollationEntry& e = entries[i];
+      uint8_t* pKey = keys.data() + e.offset;
+      e.length = static_cast<uint32_t>(writeCollationKey(texts[i], pKey) - pKey);
+      e.index = static_cast<uint32_t>(i);
+      e.prefix = 0;
+      for (size_t j = 0; j < 8; ++j)
+      {
+        e.prefix = (e.prefix << 8) | ((j < e.length) ? pKey[j] : 0);
+      }
+    }
+    std::sort(entries.begin() + partStarts[t], entries.begin() + partStarts[t + 1], less);
+  });
+
+  // merge pairs of sorted parts until there is one.
+  for (size_t width = 1; width < threads; width *= 2)
+  {
+    size_t merges = (threads + 2 * width - 1) / (2 * width);
+    runInThreads(merges, [&](size_t m) {
+      size_t first = m * 2 * width;
+      size_t middle = std::min(first + width, threads);
+      size_t last = std::min(first + 2 * width, threads);
+      std::inplace_merge(entries.begin() + partStarts[first], entries.begin() + partStarts[middle],
+                         entries.begin() + partStarts[last], less);
+    });
+  }
+
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    order[i] = entries[i].index;
+  }
+  return order;
+}
+
+void sortByCollation(std::vector<TextFragment>& v, size_t maxThreads)
+{
+  std::vector<TextView> texts(v.begin(), v.end());
+  applyOrder(v, getCollationOrder(texts, maxThreads));
+}
+
+void sortByCollation(std::vector<Symbol>& v, size_t maxThreads)
+{
+  std::vector<TextView> texts;
+  texts.reserve(v.size());
+  for (const Symbol& s : v)
+  {
+    texts.push_back(s.getTextFragment());
+  }
+  applyOrder(v, getCollationOrder(texts, maxThreads));
+}
+
 #pragma mark Symbol utilities
 
 Symbol addFinalNumber(Symbol sym, int n)
@@ -838,7 +2221,7 @@ Symbol addFinalNumber(Symbol sym, int n)
 
 Symbol stripFinalNumber(Symbol sym)
 {
-  const TextFragment& frag = sym.getTextFragment();
+  TextView frag = sym.getTextFragment();
   size_t points = frag.lengthInCodePoints();
 
   // TODO make more readble using random access fragment class
@@ -872,8 +2255,7 @@ Symbol stripFinalNumber(Symbol sym)
     }
   }
 
-  ml::TextFragment subFrag(textUtils::subText(frag, 0, firstDigitPos));
-  return subFrag.getText();
+  return Symbol(textUtils::subText(frag, 0, firstDigitPos));
 }
 
 // if the symbol's text ends in an integer, return that number.
@@ -881,7 +2263,7 @@ Symbol stripFinalNumber(Symbol sym)
 
 int getFinalNumber(Symbol sym)
 {
-  const TextFragment& frag = sym.getTextFragment();
+  TextView frag = sym.getTextFragment();
   auto it = frag.begin();
   
   for(;it != frag.end(); it++)
@@ -911,7 +2293,7 @@ int getFinalNumber(Symbol sym)
 
 Symbol stripFinalCharacter(Symbol sym)
 {
-  TextFragment frag = sym.getTextFragment();
+  TextView frag = sym.getTextFragment();
   size_t len = frag.lengthInCodePoints();
   return Symbol(subText(frag, 0, len - 1));
 }
@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -27,8 +28,36 @@ bool isCJK(CodePoint c);
 TextFragment naturalNumberToText(int i);
 int textToNaturalNumber(const TextFragment& frag);
 
-TextFragment floatNumberToText(float f, int precision = 5);
+// the longest text written by writeFloatNumber().
+constexpr size_t kMaxFloatTextLength = 16;
+
+// write the shortest text that reads back as exactly f, without a null
+// terminator, and return the end of the text. Decimal notation is used for
+// exponents from -5 to 8, and scientific notation otherwise.
+char* writeFloatNumber(float f, char* pDest);
+
+// read a float from the text from pText up to pEnd, correctly rounded for up to
+// 19 significant digits. Returns the end of the number, or pText if there is no
+// number.
+const char* readFloatNumber(const char* pText, const char* pEnd, float& f);
+
+// return the shortest text that reads back as exactly f.
+TextFragment floatNumberToText(float f);
+
+// return text for f with the given number of digits after the decimal point, or
+// in scientific notation for large and small numbers.
+TextFragment floatNumberToText(float f, int precision);
+
 float textToFloatNumber(const TextFragment& frag);
+float textToFloatNumber(TextView text);
+
+// write n floats as text, separated by the separator, and return the end of the
+// text. pDest must have room for n * (kMaxFloatTextLength + 1) chars.
+char* floatNumbersToText(const float* pSrc, size_t n, char* pDest, char separator = ' ');
+
+// read up to maxFloats floats separated by whitespace or commas, returning the
+// number read.
+size_t textToFloatNumbers(TextView text, float* pDest, size_t maxFloats);
 
 int findFirst(const TextFragment& frag, const CodePoint c);
 int findLast(const TextFragment& frag, const CodePoint c);
@@ -82,9 +111,86 @@ Symbol bestScriptForTextFragment(const TextFragment& frag);
 TextFragment stripWhitespaceAtEnds(const TextFragment& frag);
 TextFragment stripAllWhitespace(const TextFragment& frag);
 
+// ----------------------------------------------------------------
+// TextView utilities
+// These work like the TextFragment utilities above, but return views of the
+// input text instead of new TextFragments, so they don't allocate, except for the
+// vector returned by split(). The results are only valid as long as the input.
+
+int textToNaturalNumber(TextView text);
+int findFirst(TextView text, CodePoint c);
+int findLast(TextView text, CodePoint c);
+TextView subText(TextView text, size_t start, size_t end);
+std::vector<TextView> split(TextView text, CodePoint delimiter = '\n');
+TextView stripExtension(TextView text);
+TextView getExtension(TextView text);
+TextView getShortFileName(TextView text);
+TextView getPath(TextView text);
+TextView stripWhitespaceAtEnds(TextView text);
+
 TextFragment base64Encode(const std::vector<uint8_t>& b);
 std::vector<uint8_t> base64Decode(const TextFragment& b);
 
+// the number of chars needed to encode the given number of bytes, including
+// padding.
+constexpr size_t base64EncodedLength(size_t bytes) { return (bytes + 2) / 3 * 4; }
+
+// an upper bound on the number of bytes decoded from the given number of chars.
+constexpr size_t base64MaxDecodedLength(size_t chars) { return (chars + 3) / 4 * 3; }
+
+// encode n bytes to pDest, which must have room for base64EncodedLength(n)
+// chars, and return the end of the text. No null terminator is written.
+char* base64Encode(const uint8_t* pSrc, size_t n, char* pDest);
+
+// decode n chars to pDest, which must have room for base64MaxDecodedLength(n)
+// bytes, and return the end of the output. Whitespace is skipped, and decoding
+// stops at padding or any other character that is not base64.
+uint8_t* base64Decode(const char* pSrc, size_t n, uint8_t* pDest);
+
+// Base64Encoder and Base64Decoder convert data that arrives in chunks, such as
+// from a file, without having to gather it all first.
+
+class Base64Encoder
+{
+ public:
+  // encode n more bytes, returning the end of the output. pDest must have room
+  // for base64EncodedLength(n) chars.
+  char* write(const uint8_t* pSrc, size_t n, char* pDest);
+
+  // encode any bytes left over from previous writes with padding, returning the
+  // end of the output. pDest must have room for 4 chars.
+  char* finish(char* pDest);
+
+ private:
+  uint8_t _pending[2];
+  size_t _pendingBytes{0};
+};
+
+class Base64Decoder
+{
+ public:
+  // decode n more chars, returning the end of the output. pDest must have room
+  // for base64MaxDecodedLength(n) bytes.
+  uint8_t* write(const char* pSrc, size_t n, uint8_t* pDest);
+
+  // decode any chars left over from previous writes, returning the end of the
+  // output. pDest must have room for 2 bytes.
+  uint8_t* finish(uint8_t* pDest);
+
+  // true if padding or another character that is not base64 has been read.
+  // Any input after that is ignored.
+  bool isDone() const { return _done; }
+
+ private:
+  uint32_t _pendingBits{0};
+  size_t _pendingChars{0};
+  bool _done{false};
+};
+
+// AES256 in CBC mode with PKCS#7 padding. Keys are 32 bytes, and the first 16
+// bytes of the IV are used. AES-NI instructions are used if the processor has
+// them.
+
 std::vector<uint8_t> AES256CBCEncode(const std::vector<uint8_t>& plaintext,
                                      const std::vector<uint8_t>& key,
                                      const std::vector<uint8_t>& iv);
@@ -92,9 +198,89 @@ std::vector<uint8_t> AES256CBCDecode(const std::vector<uint8_t>& ciphertext,
                                      const std::vector<uint8_t>& key,
                                      const std::vector<uint8_t>& iv);
 
+// the size of the ciphertext for the given size of plaintext, including padding.
+constexpr size_t AES256CBCEncodedLength(size_t bytes) { return (bytes / 16 + 1) * 16; }
+
+// encrypt n bytes in place, returning the size of the ciphertext. The buffer
+// must have room for AES256CBCEncodedLength(n) bytes.
+size_t AES256CBCEncodeInPlace(uint8_t* pData, size_t n, const uint8_t* pKey, const uint8_t* pIV);
+
+// decrypt n bytes in place, returning the size of the plaintext, or 0 if n is
+// not a whole number of blocks.
+size_t AES256CBCDecodeInPlace(uint8_t* pData, size_t n, const uint8_t* pKey, const uint8_t* pIV);
+
+class AES256Cipher;
+
+// AES256CBCEncoder and AES256CBCDecoder process data that arrives in chunks of
+// any size, such as from a file. The source and destination of a write must
+// not overlap.
+
+class AES256CBCEncoder
+{
+ public:
+  AES256CBCEncoder(const uint8_t* pKey, const uint8_t* pIV);
+  ~AES256CBCEncoder();
+
+  // encrypt n more bytes, returning the end of the output. Blocks are written
+  // as soon as they are complete, so pDest must have room for n + 15 bytes.
+  uint8_t* write(const uint8_t* pSrc, size_t n, uint8_t* pDest);
+
+  // write the last block with padding, returning the end of the output. pDest
+  // must have room for 16 bytes.
+  uint8_t* finish(uint8_t* pDest);
+
+ private:
+  std::unique_ptr<AES256Cipher> _pCipher;
+  uint8_t _pending[16];
+  size_t _pendingBytes{0};
+};
+
+class AES256CBCDecoder
+{
+ public:
+  AES256CBCDecoder(const uint8_t* pKey, const uint8_t* pIV);
+  ~AES256CBCDecoder();
+
+  // decrypt n more bytes, returning the end of the output. The last block read
+  // is held back until we know whether it has the padding, so pDest must have
+  // room for n + 15 bytes.
+  uint8_t* write(const uint8_t* pSrc, size_t n, uint8_t* pDest);
+
+  // write the last block without its padding, returning the end of the output.
+  // pDest must have room for 16 bytes. If the ciphertext was not a whole
+  // number of blocks, nothing is written.
+  uint8_t* finish(uint8_t* pDest);
+
+ private:
+  std::unique_ptr<AES256Cipher> _pCipher;
+  uint8_t _pending[16];
+  size_t _pendingBytes{0};
+};
+
 // perform case-insensitive compare of fragments and return (a < b).
 // TODO collate other languages better using miniutf library.
 bool collate(const TextFragment& a, const TextFragment& b);
+bool collate(TextView a, TextView b);
+
+// the longest collation key for a text of the given length.
+constexpr size_t maxCollationKeyLength(size_t bytes) { return bytes * 3; }
+
+// write a sort key for the text to pDest, which must have room for
+// maxCollationKeyLength(text.lengthInBytes()) bytes, and return the end of the
+// key. Comparing keys bytewise, with a key less than any longer key it is a
+// prefix of, gives the same order as collate().
+uint8_t* writeCollationKey(TextView text, uint8_t* pDest);
+
+// return the indices of the texts in the order given by collate(). The sort key
+// of each text is made only once, so this is much faster than sorting with
+// collate() when there are many texts. Large inputs are split between up to
+// maxThreads threads.
+std::vector<size_t> getCollationOrder(const std::vector<TextView>& texts, size_t maxThreads = 1);
+
+// sort fragments or symbols into the order given by collate() using
+// getCollationOrder().
+void sortByCollation(std::vector<TextFragment>& v, size_t maxThreads = 1);
+void sortByCollation(std::vector<Symbol>& v, size_t maxThreads = 1);
 
 // ----------------------------------------------------------------
 // Symbol utilities
@@ -110,7 +296,7 @@ struct SymbolCollator
 {
   bool operator()(const Symbol& a, const Symbol& b) const
   {
-    return collate(a.getTextFragment(), b.getTextFragment());
+    return collate(TextView(a.getTextFragment()), TextView(b.getTextFragment()));
   }
 };
 
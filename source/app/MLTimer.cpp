@@ -4,6 +4,7 @@
 
 #include "MLTimer.h"
 
+#include <algorithm>
 #include <chrono>
 #include <functional>
 
@@ -12,7 +13,7 @@ using namespace std::chrono;
 
 // Timers
 
-const int ml::Timers::kMillisecondsResolution = 16;
+ml::Timers::Timers() : _epoch(steady_clock::now()) {}
 
 #if ML_MAC
 
@@ -34,7 +35,7 @@ void ml::Timers::start(bool runInMainThread)
     {
       CFRunLoopTimerContext timerContext = {};
       timerContext.info = this;
-      float intervalInSeconds = ml::Timers::kMillisecondsResolution * 0.001f;
+      double intervalInSeconds = duration_cast<duration<double> >(getResolution()).count();
       pTimersRef =
           CFRunLoopTimerCreate(kCFAllocatorDefault, CFAbsoluteTimeGetCurrent() + intervalInSeconds,
                                intervalInSeconds, 0, 0, macTimersCallback, &timerContext);
@@ -66,18 +67,7 @@ void ml::Timers::stop()
   }
   else
   {
-    // signal thread to exit
-    _running = false;
-    runThread.join();
-  }
-}
-
-void ml::Timers::run(void)
-{
-  while (_running)
-  {
-    std::this_thread::sleep_for(milliseconds(Timers::kMillisecondsResolution));
-    tick();
+    stopRunThread();
   }
 }
 
@@ -103,7 +93,9 @@ void ml::Timers::start(bool runInMainThread)
   {
     if (_inMainThread)
     {
-      _mainTimerID = SetTimer(0, 1, ml::Timers::kMillisecondsResolution, winTimersCallback);
+      UINT intervalInMs = static_cast<UINT>(
+          std::max(ceil<milliseconds>(getResolution()), milliseconds(USER_TIMER_MINIMUM)).count());
+      _mainTimerID = SetTimer(0, 1, intervalInMs, winTimersCallback);
       if (_mainTimerID)
       {
         _running = true;
@@ -130,24 +122,11 @@ void ml::Timers::stop()
     }
     else
     {
-      // signal thread to exit
-      _running = false;
-
-      // wait for exit
-      runThread.join();
+      stopRunThread();
     }
   }
 }
 
-void ml::Timers::run(void)
-{
-  while (_running)
-  {
-    std::this_thread::sleep_for(milliseconds(Timers::kMillisecondsResolution));
-    tick();
-  }
-}
-
 #elif ML_LINUX
 
 void ml::Timers::start(bool runInMainThread)
@@ -159,101 +138,352 @@ void ml::Timers::start(bool runInMainThread)
   }
 }
 
+void ml::Timers::stop(void)
+{
+  if (_running)
+  {
+    stopRunThread();
+  }
+}
+
+#endif
+
+void ml::Timers::stopRunThread()
+{
+  // signal thread to exit
+  _running = false;
+  {
+    std::unique_lock<std::mutex> lock(_wakeMutex);
+  }
+  _wakeCondition.notify_all();
+
+  // wait for exit
+  runThread.join();
+}
+
 void ml::Timers::run(void)
 {
   while (_running)
   {
-    std::this_thread::sleep_for(milliseconds(Timers::kMillisecondsResolution));
-    tick();
+    uint64_t wakeTick;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      advance(steady_clock::now(), lock);
+      wakeTick = getNextEventTick();
+      _wakeTick = wakeTick;
+    }
+
+    // sleep until the next tick with something to do, or indefinitely if there
+    // are no active timers. Scheduling an earlier timer wakes us.
+    std::unique_lock<std::mutex> lock(_wakeMutex);
+    auto wakePredicate = [&]() { return !_running || _wakeRequested; };
+    if (wakeTick != UINT64_MAX)
+    {
+      auto wakeTime = _epoch + _resolution * static_cast<nanoseconds::rep>(wakeTick);
+      _wakeCondition.wait_until(lock, wakeTime, wakePredicate);
+    }
+    else
+    {
+      _wakeCondition.wait(lock, wakePredicate);
+    }
+    _wakeRequested = false;
   }
 }
 
-void ml::Timers::stop(void)
+void ml::Timers::tick(void)
 {
-  if (_running)
+  std::unique_lock<std::mutex> lock(_mutex);
+  advance(steady_clock::now(), lock);
+}
+
+void ml::Timers::setResolution(microseconds r)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  // take all the active timers out of the wheel, then reschedule them
+  // at the new resolution.
+  Timer* pActive{nullptr};
+  for (auto& level : _wheel)
   {
-    _running = false;
-    runThread.join();
+    for (auto& slot : level)
+    {
+      while (Timer* t = slot)
+      {
+        unschedule(t);
+        t->_pNext = pActive;
+        pActive = t;
+      }
+    }
+  }
+
+  _resolution = std::max(nanoseconds(r), nanoseconds(1));
+  _currentTick = getTick(steady_clock::now(), false);
+
+  while (Timer* t = pActive)
+  {
+    pActive = t->_pNext;
+    schedule(t);
   }
 }
 
-#endif
+microseconds ml::Timers::getResolution()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  return duration_cast<microseconds>(_resolution);
+}
 
-void ml::Timers::tick(void)
+uint64_t ml::Timers::getTick(time_point<steady_clock> t, bool roundUp)
+{
+  if (t <= _epoch) return 0;
+  auto ns = duration_cast<nanoseconds>(t - _epoch).count();
+  auto r = _resolution.count();
+  return static_cast<uint64_t>(roundUp ? (ns + r - 1) / r : ns / r);
+}
+
+uint64_t ml::Timers::getNextEventTick()
+{
+  // find the first tick at which each level has something to do: calling the timers
+  // in an occupied slot at level 0, or cascading an occupied slot at a higher level.
+  // Level 0 holds timers expiring in the next kWheelSize - 1 ticks, higher levels
+  // may hold timers in their current slot to be cascaded a whole turn later.
+  uint64_t next{UINT64_MAX};
+  for (size_t level = 0; level < kWheelLevels; ++level)
+  {
+    uint64_t position = _currentTick >> (kWheelBits * level);
+    size_t maxSteps = level ? kWheelSize : kWheelSize - 1;
+    for (size_t step = 1; step <= maxSteps; ++step)
+    {
+      if (_wheel[level][(position + step) & kWheelMask])
+      {
+        next = std::min(next, (position + step) << (kWheelBits * level));
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+void ml::Timers::resyncIfIdle()
 {
-  static time_point<system_clock> previousStatsTime = system_clock::now();
-  time_point<system_clock> now = system_clock::now();
+  // if the wheel is empty, it may not have been advanced for a while.
+  // bring it up to date so that the next timer scheduled doesn't have to
+  // wait for the wheel to catch up.
+  if ((_activeCount == 0) && !_advancing)
+  {
+    _currentTick = std::max(_currentTick, getTick(steady_clock::now(), false));
+  }
+}
 
-  std::unique_lock<std::mutex> lock(mSetMutex);
+void ml::Timers::schedule(Timer* t)
+{
+  // a timer can't expire in the tick being processed.
+  t->_expiryTick = std::max(getTick(t->_nextCall, true), _currentTick + 1);
+
+  // find the level where the time remaining fits, and the slot where the
+  // expiry tick will be reached at that level. Timers beyond the range of the
+  // wheel are put in the last slot of the top level and rescheduled from there.
+  uint64_t delta = t->_expiryTick - _currentTick;
+  uint64_t expiry = t->_expiryTick;
+  size_t level = 0;
+  while ((delta >> (kWheelBits * (level + 1))) && (level < kWheelLevels - 1))
+  {
+    level++;
+  }
+  if (delta >> (kWheelBits * kWheelLevels))
+  {
+    expiry = _currentTick + (uint64_t(1) << (kWheelBits * kWheelLevels)) - 1;
+  }
+  link(t, &_wheel[level][(expiry >> (kWheelBits * level)) & kWheelMask]);
+
+  // wake the run thread if it is sleeping past the new timer's expiry. Timers
+  // scheduled while advancing are seen when the run thread looks for its next tick.
+  if (!_advancing && (t->_expiryTick < _wakeTick))
+  {
+    _wakeTick = t->_expiryTick;
+    {
+      std::unique_lock<std::mutex> lock(_wakeMutex);
+      _wakeRequested = true;
+    }
+    _wakeCondition.notify_one();
+  }
+}
+
+void ml::Timers::link(Timer* t, Slot* pSlot)
+{
+  // link at the head of the slot.
+  t->_pSlot = pSlot;
+  t->_pPrev = nullptr;
+  t->_pNext = *pSlot;
+  if (t->_pNext) t->_pNext->_pPrev = t;
+  *pSlot = t;
+  _activeCount++;
+}
+
+void ml::Timers::unschedule(Timer* t)
+{
+  if (!t->_pSlot) return;
+  if (t->_pPrev)
+  {
+    t->_pPrev->_pNext = t->_pNext;
+  }
+  else
+  {
+    *t->_pSlot = t->_pNext;
+  }
+  if (t->_pNext)
+  {
+    t->_pNext->_pPrev = t->_pPrev;
+  }
+  t->_pNext = t->_pPrev = nullptr;
+  t->_pSlot = nullptr;
+  _activeCount--;
+}
+
+void ml::Timers::cascade(size_t level)
+{
+  // move the timers in the current slot of the given level down to lower levels.
+  // rescheduling never puts a timer back in the slot being emptied.
+  Slot& slot = _wheel[level][(_currentTick >> (kWheelBits * level)) & kWheelMask];
+  while (Timer* t = slot)
+  {
+    unschedule(t);
+    schedule(t);
+  }
+}
 
-  // MLTEST
-#ifdef DEBUG_TIMERS
-  if (now - previousStatsTime > milliseconds(1000))
+void ml::Timers::waitForCallback(Timer* t, std::unique_lock<std::mutex>& lock)
+{
+  // a callback can change its own timer without waiting.
+  while ((_pCurrentTimer == t) && (std::this_thread::get_id() != _callbackThread))
   {
-    // dump stats
-    std::cout << "timers: " << _timerPtrs.size() << " timers. \n ";
-    previousStatsTime = now;
+    _callbackDone.wait(lock);
+  }
+}
+
+void ml::Timers::advance(time_point<steady_clock> now, std::unique_lock<std::mutex>& lock)
+{
+  // only one thread advances the wheel at a time.
+  if (_advancing) return;
+  uint64_t nowTick = getTick(now, false);
+  _advancing = true;
+  _callbackThread = std::this_thread::get_id();
 
-    // dump timer info
-    for (auto t : _timerPtrs)
+  while (_currentTick < nowTick)
+  {
+    // with no active timers, we can skip directly to the present.
+    if (_activeCount == 0)
     {
-      size_t n = t->_testID;
-      auto age = duration_cast<milliseconds>(now - t->_creationTime).count();
-      auto per = t->_period.count();
+      _currentTick = nowTick;
+      break;
+    }
+
+    _currentTick++;
 
-      // current period exipred
-      auto cur = duration_cast<milliseconds>(now - t->_previousCall).count();
+    // when the lower levels wrap around, cascade the current slots of the
+    // higher levels, starting at the top.
+    size_t levelsToCascade = 0;
+    while ((levelsToCascade < kWheelLevels - 1) &&
+           ((_currentTick >> (kWheelBits * (levelsToCascade + 1))) << (kWheelBits * (levelsToCascade + 1))) ==
+               _currentTick)
+    {
+      levelsToCascade++;
+    }
+    for (size_t level = levelsToCascade; level > 0; --level)
+    {
+      cascade(level);
+    }
 
-      std::cout << "    t" << n << ": age=" << age << " per=" << per << " cur=" << cur << "\n";
+    Slot& slot = _wheel[0][_currentTick & kWheelMask];
+    while (Timer* t = slot)
+    {
+      unschedule(t);
+      link(t, &_expired);
     }
+    callExpiredTimers(now, lock);
   }
-#endif
 
-  for (auto t : _timerPtrs)
+  _advancing = false;
+}
+
+void ml::Timers::callExpiredTimers(time_point<steady_clock> now, std::unique_lock<std::mutex>& lock)
+{
+  // call expired timers one at a time, with the mutex unlocked. Each timer is
+  // unlinked before its callback is called, and stopping or destroying a timer
+  // removes it from the expired list, so callbacks and other threads are free to
+  // stop or reschedule any timer.
+  while (Timer* t = _expired)
   {
-    std::unique_lock<std::mutex> lock(t->_counterMutex);
-    if (t->_counter != 0)
+    unschedule(t);
+    if (t->_counter == 0) continue;
+
+    _pCurrentTimer = t;
+    lock.unlock();
+    t->_func();
+    lock.lock();
+
+    // the callback may have destroyed the timer, or started it again.
+    if (_pCurrentTimer && !t->_pSlot && (t->_counter != 0))
     {
-      if (t->_additionalTime > milliseconds(0))
+      if (t->_counter > 0)
       {
-        t->_previousCall = now + t->_additionalTime - t->_period;
-        t->_additionalTime = milliseconds(0);
+        t->_counter--;
       }
-      else if (now - t->_previousCall >= t->_period)
+      if (t->_counter != 0)
       {
-        t->_func();
-        if (t->_counter > 0)
-        {
-          t->_counter--;
-        }
-        t->_previousCall = now;
+        t->_nextCall = now + t->_period;
+        schedule(t);
       }
     }
+    _pCurrentTimer = nullptr;
+    _callbackDone.notify_all();
   }
 }
 
 // Timer
 
-ml::Timer::Timer() noexcept
-{
-  std::unique_lock<std::mutex> lock(_timers->mSetMutex);
-  _previousCall = _creationTime = system_clock::now();
+ml::Timer::Timer() noexcept {}
 
-  _testID = _timers->getSize();  // MLTEST
+ml::Timer::~Timer()
+{
+  std::unique_lock<std::mutex> lock(_timers->_mutex);
+  _counter = 0;
+  _timers->waitForCallback(this, lock);
+  _timers->unschedule(this);
+  if (_timers->_pCurrentTimer == this)
+  {
+    // we are being destroyed by our own callback.
+    _timers->_pCurrentTimer = nullptr;
+  }
+}
 
-  _timers->insert(this);
+void ml::Timer::set(std::function<void(void)> f, const microseconds period, int counter)
+{
+  std::unique_lock<std::mutex> lock(_timers->_mutex);
+  _timers->waitForCallback(this, lock);
+  _timers->unschedule(this);
+  _counter = counter;
+  _func = f;
+  _period = period;
+  _nextCall = steady_clock::now() + _period;
+  _timers->resyncIfIdle();
+  _timers->schedule(this);
 }
 
-ml::Timer::~Timer()
+void ml::Timer::postpone(const microseconds timeToAdd)
 {
-  std::unique_lock<std::mutex> lock(_timers->mSetMutex);
-  _timers->erase(this);
+  std::unique_lock<std::mutex> lock(_timers->_mutex);
+  if (_pSlot)
+  {
+    _timers->unschedule(this);
+    _nextCall = steady_clock::now() + timeToAdd;
+    _timers->schedule(this);
+  }
 }
 
 void ml::Timer::stop()
 {
-  // More lightweight ways of handling a race on _counter are possible, but as
-  // stopping a timer is an infrequent operation we use the mutex for brevity.
-  std::unique_lock<std::mutex> lock(_counterMutex);
+  std::unique_lock<std::mutex> lock(_timers->_mutex);
   _counter = 0;
+  _timers->waitForCallback(this, lock);
+  _timers->unschedule(this);
 }
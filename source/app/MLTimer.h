@@ -4,11 +4,13 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <mutex>
-#include <set>
 #include <thread>
 
 #include "MLPlatform.h"
@@ -18,11 +20,19 @@ using namespace std::chrono;
 
 namespace ml
 {
-// A simple, low-resolution timer for doing applicaton and UI tasks.
+// A timer for doing applicaton and UI tasks.
 // Any callbacks are called synchronously from a single thread, so
 // callbacks should not take too much time. To trigger an action
 // that might take longer, send a message from the callback and
 // then receive it and do the action in a private thread.
+//
+// Active timers are kept in a hierarchical timing wheel, so starting and
+// stopping a timer take constant time and the cost of each tick does not
+// depend on the number of active timers. The run thread sleeps until the next
+// tick at which a timer expires. Callbacks are called without any lock held,
+// and may start, stop, create or destroy timers, including their own. Stopping,
+// restarting or destroying a Timer from another thread waits for any callback
+// of that Timer in progress to finish.
 
 class Timer;
 
@@ -31,9 +41,9 @@ class Timers
   friend class Timer;
 
  public:
-  static const int kMillisecondsResolution;
+  static constexpr microseconds kDefaultResolution{1000};
 
-  Timers() {}
+  Timers();
   ~Timers()
   {
     if (_running) stop();
@@ -46,22 +56,70 @@ class Timers
   void start(bool runInMainThread = false);
   void stop();
 
-  void insert(Timer* t) { _timerPtrs.insert(t); }
-  void erase(Timer* t) { _timerPtrs.erase(t); }
+  // Set the interval between ticks. Timer periods are rounded up to a whole
+  // number of ticks. In the main thread, the resolution may be limited further
+  // by the operating system. Call before start() for the main thread timer to
+  // use the new resolution.
+  void setResolution(microseconds r);
+  microseconds getResolution();
 
+  // call any timers that have expired, and advance the wheel to the current time.
   void tick(void);
   void run(void);
 
-  // MLTEST
-  size_t getSize() { return _timerPtrs.size(); }
+  // return the number of active timers.
+  size_t getSize() { return _activeCount; }
 
  private:
-  std::mutex mSetMutex;
+  static constexpr size_t kWheelBits{8};
+  static constexpr size_t kWheelSize{1 << kWheelBits};
+  static constexpr size_t kWheelMask{kWheelSize - 1};
+  static constexpr size_t kWheelLevels{4};
+
+  using Slot = Timer*;
+
+  void stopRunThread();
+
+  // all these are called with _mutex locked.
+  uint64_t getTick(time_point<steady_clock> t, bool roundUp);
+  uint64_t getNextEventTick();
+  void resyncIfIdle();
+  void link(Timer* t, Slot* pSlot);
+  void schedule(Timer* t);
+  void unschedule(Timer* t);
+  void cascade(size_t level);
+  void waitForCallback(Timer* t, std::unique_lock<std::mutex>& lock);
+
+  // these unlock the mutex while calling callbacks.
+  void advance(time_point<steady_clock> now, std::unique_lock<std::mutex>& lock);
+  void callExpiredTimers(time_point<steady_clock> now, std::unique_lock<std::mutex>& lock);
+
+  std::mutex _mutex;
+
+  std::array<std::array<Slot, kWheelSize>, kWheelLevels> _wheel{};
+  time_point<steady_clock> _epoch{};
+  nanoseconds _resolution{kDefaultResolution};
+  uint64_t _currentTick{0};
+  std::atomic<size_t> _activeCount{0};
+  bool _advancing{false};
+
+  // timers that have expired in the tick being processed, waiting to be called.
+  Slot _expired{nullptr};
+
+  // the timer whose callback is running, and the thread running it.
+  Timer* _pCurrentTimer{nullptr};
+  std::thread::id _callbackThread;
+  std::condition_variable _callbackDone;
+
+  // the tick the run thread is sleeping until. Scheduling an earlier timer wakes it.
+  uint64_t _wakeTick{0};
+  bool _wakeRequested{false};
+  std::mutex _wakeMutex;
+  std::condition_variable _wakeCondition;
 
   void* pTimersRef{nullptr};
-  bool _running{false};
+  std::atomic<bool> _running{false};
   bool _inMainThread{false};
-  std::set<Timer*> _timerPtrs;
   std::thread runThread;
 
 #if ML_WINDOWS
@@ -84,52 +142,38 @@ class Timer
   Timer& operator=(Timer&&) = delete;       // Move assign
 
   // call the function once after the specified interval.
-  void callOnce(std::function<void(void)> f, const milliseconds period)
-  {
-    _counter = 1;
-    _func = f;
-    _period = period;
-    _previousCall = system_clock::now();
-  }
+  void callOnce(std::function<void(void)> f, const microseconds period) { set(f, period, 1); }
 
-  // extend the timeout of the current period for the given number of
-  // milliseconds after the next tick.
-  void postpone(const milliseconds timeToAdd) { _additionalTime = timeToAdd; }
+  // extend the timeout of the current period for the given time, starting now.
+  void postpone(const microseconds timeToAdd);
 
   // call the function n times, waiting the specified interval before each.
-  void callNTimes(std::function<void(void)> f, const milliseconds period, int n)
+  void callNTimes(std::function<void(void)> f, const microseconds period, int n)
   {
-    _counter = n;
-    _func = f;
-    _period = period;
-    _previousCall = system_clock::now();
+    set(f, period, n);
   }
 
   // start calling the function periodically. the wait period happens before the
   // first call.
-  void start(std::function<void(void)> f, const milliseconds period)
-  {
-    _counter = -1;
-    _func = f;
-    _period = period;
-    _previousCall = system_clock::now();
-  }
+  void start(std::function<void(void)> f, const microseconds period) { set(f, period, -1); }
 
   bool isActive() { return _counter != 0; }
 
   void stop();
 
-  int _testID{};  // MLTEST
-
  private:
-  std::mutex _counterMutex;
+  void set(std::function<void(void)> f, const microseconds period, int counter);
 
   SharedResourcePointer<Timers> _timers;
-  int _counter{0};
+  std::atomic<int> _counter{0};
   std::function<void(void)> _func;
-  milliseconds _period{};
-  milliseconds _additionalTime{};
-  time_point<system_clock> _previousCall{};
-  time_point<system_clock> _creationTime{};
+  microseconds _period{};
+  time_point<steady_clock> _nextCall{};
+
+  // links in the timing wheel, owned by Timers.
+  Timer* _pNext{nullptr};
+  Timer* _pPrev{nullptr};
+  Timers::Slot* _pSlot{nullptr};
+  uint64_t _expiryTick{0};
 };
 }  // namespace ml
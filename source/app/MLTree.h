@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -18,6 +19,11 @@
 // Tree<int> weird to use, because 0 indicates a null value. However, we are
 // typically interested in more complex value types like Values or Widgets.
 // Heavyweight objects in a Tree should be held by unique_ptrs.
+//
+// The nodes of a Tree stay at the same addresses as other nodes are added or
+// erased, so a node found once can be used as a handle to its value until the
+// node itself is erased. A Tree can also remember the nodes found by PathID
+// lookups, so that looking up the same PathID again is an array access.
 
 namespace ml
 {
@@ -29,6 +35,26 @@ class Tree
   mapT mChildren{};
   V _value{};
 
+  // nodes found by PathID lookups, indexed by PathID. A copy of a Tree starts
+  // with an empty cache, because the cached nodes belong to the original.
+  struct LookupCache
+  {
+    std::unique_ptr<std::vector<Tree<V, C>*> > pNodes;
+
+    LookupCache() = default;
+    LookupCache(const LookupCache& b) { reset(b.pNodes != nullptr); }
+    LookupCache& operator=(const LookupCache& b)
+    {
+      reset(b.pNodes != nullptr);
+      return *this;
+    }
+    LookupCache(LookupCache&&) = default;
+    LookupCache& operator=(LookupCache&&) = default;
+
+    void reset(bool enabled) { pNodes.reset(enabled ? new std::vector<Tree<V, C>*> : nullptr); }
+  };
+  mutable LookupCache _cache;
+
  public:
   Tree<V, C>() = default;
   Tree<V, C>(V val) : _value(std::move(val)) {}
@@ -37,6 +63,7 @@ class Tree
   {
     mChildren.clear();
     _value = V();
+    clearCache();
   }
 
   void combine(const Tree<V, C>& b)
@@ -80,6 +107,77 @@ class Tree
     return const_cast<Tree<V, C>*>(const_cast<const Tree<V, C>*>(this)->getConstNode(path));
   }
 
+  // PathID versions of getConstNode() and getNode(). If caching is on, the
+  // nodes found are remembered.
+  const Tree<V, C>* getConstNode(PathID id) const
+  {
+    auto pNodes = _cache.pNodes.get();
+    if (!pNodes || !id) return getConstNode(id.getPath());
+
+    size_t i = id.getID();
+    if ((i < pNodes->size()) && (*pNodes)[i]) return (*pNodes)[i];
+    auto pNode = getNode(id.getPath());
+    if (pNode)
+    {
+      if (i >= pNodes->size()) pNodes->resize(i + 1);
+      (*pNodes)[i] = pNode;
+    }
+    return pNode;
+  }
+
+  Tree<V, C>* getNode(PathID id) const
+  {
+    return const_cast<Tree<V, C>*>(const_cast<const Tree<V, C>*>(this)->getConstNode(id));
+  }
+
+  // turn caching of PathID lookups on or off. The cache is cleared by erase()
+  // and clear() on this Tree, so nodes should not be erased through other nodes
+  // of a caching Tree. A caching Tree changes when PathIDs are looked up, so it
+  // must not be read from more than one thread at a time.
+  void setCaching(bool b) { _cache.reset(b); }
+  bool getCaching() const { return _cache.pNodes != nullptr; }
+  void clearCache()
+  {
+    if (_cache.pNodes) _cache.pNodes->clear();
+  }
+
+  // A Handle refers to a node of a Tree, resolved once from a Path. Reading or
+  // writing the value through a Handle is a pointer dereference. A Handle stays
+  // valid until its node is erased or the Tree is cleared or destroyed.
+  class Handle
+  {
+    friend class Tree<V, C>;
+
+   public:
+    Handle() = default;
+
+    explicit operator bool() const { return _pNode != nullptr; }
+    V& operator*() const { return _pNode->_value; }
+    V* operator->() const { return &_pNode->_value; }
+    Tree<V, C>* getNode() const { return _pNode; }
+
+    bool operator==(const Handle& b) const { return _pNode == b._pNode; }
+    bool operator!=(const Handle& b) const { return _pNode != b._pNode; }
+
+   private:
+    explicit Handle(Tree<V, C>* p) : _pNode(p) {}
+    Tree<V, C>* _pNode{nullptr};
+  };
+
+  // return a Handle to the node at the path. Like operator[], if the node does
+  // not exist, a node with a default value is added.
+  Handle getHandle(Path p)
+  {
+    auto pNode = getNode(p);
+    return Handle(pNode ? pNode : add(p, V()));
+  }
+
+  Handle getHandle(PathID id)
+  {
+    auto pNode = getNode(id);
+    return Handle(pNode ? pNode : add(id.getPath(), V()));
+  }
+
   // if the path exists, returns a reference to the value in the tree at the
   // path. else, add a new default object of our value type V.
   V& operator[](Path p)
@@ -111,6 +209,14 @@ class Tree
     }
   }
 
+  V& operator[](PathID id) { return *getHandle(id); }
+  const V& operator[](PathID id) const
+  {
+    static V nullValue{};
+    auto pNode = getConstNode(id);
+    return pNode ? pNode->_value : nullValue;
+  }
+
   // compare two Trees by value.
   inline bool operator==(const Tree<V, C>& b) const
   {
@@ -192,11 +298,26 @@ class Tree
     return pNode;
   }
 
+  Tree<V, C>* add(PathID id, V val) { return add(id.getPath(), std::move(val)); }
+
+  // remove the node at the path, along with all of its children. Any nodes above
+  // it that are left with no value and no children are removed too. Pointers to
+  // the removed nodes become invalid.
   void erase(Path p)
   {
-    // TODO
+    if (!p)
+    {
+      clear();
+    }
+    else
+    {
+      eraseAtDepth(p, 0);
+      clearCache();
+    }
   }
 
+  void erase(PathID id) { erase(id.getPath()); }
+
   // NOTE this iterator does not work with STL algorithms in general, only for
   // simple begin(), end() loops. This is enough to support the range-based for
   // syntax. post-increment(operator++(int)) is not defined. Instead use
@@ -355,6 +476,21 @@ class Tree
     }
     return sum;
   }
+
+ private:
+  // erase the node at the remainder of the path starting at depth, and return
+  // true if this node was left empty by doing so.
+  bool eraseAtDepth(Path p, int depth)
+  {
+    auto it = mChildren.find(p.getElement(depth));
+    if (it == mChildren.end()) return false;
+    if ((depth == p.getSize() - 1) || it->second.eraseAtDepth(p, depth + 1))
+    {
+      mChildren.erase(it);
+      return isLeaf() && !hasValue();
+    }
+    return false;
+  }
 };
 
 // utilities
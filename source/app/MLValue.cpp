@@ -4,198 +4,234 @@
 
 #include "MLValue.h"
 
+#include <new>
+
 #include "MLTextUtils.h"
 
 namespace ml
 {
 const Matrix Value::nullMatrix{};
 
-Value::Value() : mType(kUndefinedValue), mFloatVal(0) {}
+Value::Value() : _floatVal(0) {}
+
+void Value::dispose() noexcept
+{
+  if (hasHeapBytes())
+  {
+    _heapBytes.~shared_ptr();
+  }
+  else if (mType == kMatrixValue)
+  {
+    _matrixPtr.~shared_ptr();
+  }
+  mType = kUndefinedValue;
+  _sizeInBytes = 0;
+  _floatVal = 0;
+}
 
-void Value::copyBlob(const void* inputData, size_t size)
+void Value::setBytes(Type t, const void* pData, size_t size)
 {
-  // if we have external data, free it
-  if(pBlobData != _localBlobData)
+  auto pCharData = static_cast<const uint8_t*>(pData);
+
+  // if we are the only owner of heap data of the same size, modify it in place.
+  if (hasHeapBytes() && (_sizeInBytes == size) && (_heapBytes.use_count() == 1))
   {
-    free(pBlobData);
-    pBlobData = _localBlobData;
+    std::copy(pCharData, pCharData + size, _heapBytes.get());
+    mType = t;
+    return;
   }
 
+  dispose();
   if (size <= kLocalDataBytes)
   {
-    auto pCharData = (uint8_t*)inputData;
-    std::copy(pCharData, pCharData + size, _localBlobData);
-    _blobSizeInBytes = size;
+    std::copy(pCharData, pCharData + size, _localData);
+    _sizeInBytes = static_cast<uint32_t>(size);
+    mType = t;
   }
   else
   {
-    pBlobData = (uint8_t*)malloc(size);
-    if(pBlobData)
+    uint8_t* pNewData = new (std::nothrow) uint8_t[size];
+    if (pNewData)
     {
-      auto pCharData = (uint8_t*)(inputData);
-      std::copy(pCharData, pCharData + size, pBlobData);
-      _blobSizeInBytes = size;
+      std::copy(pCharData, pCharData + size, pNewData);
+      new (&_heapBytes) std::shared_ptr<uint8_t[]>(pNewData);
+      _sizeInBytes = static_cast<uint32_t>(size);
+      mType = t;
     }
     else
     {
-      // TODO throw?
-      _blobSizeInBytes = 0;
+      // TODO throw? for now, an allocation failure leaves an empty value of the given type.
+      mType = t;
     }
   }
 }
 
-Value::Value(const Value& other) : mType(other.getType()), mFloatVal(0)
+void Value::detach()
+{
+  if (hasHeapBytes() && (_heapBytes.use_count() > 1))
+  {
+    uint8_t* pNewData = new uint8_t[_sizeInBytes];
+    std::copy(_heapBytes.get(), _heapBytes.get() + _sizeInBytes, pNewData);
+    _heapBytes.reset(pNewData);
+  }
+}
+
+void Value::setMatrix(const Matrix& m)
+{
+  // if we are the only owner of the matrix, Matrix handles copy-in-place when possible.
+  if ((mType == kMatrixValue) && (_matrixPtr.use_count() == 1))
+  {
+    *_matrixPtr = m;
+    return;
+  }
+
+  dispose();
+  new (&_matrixPtr) std::shared_ptr<Matrix>(std::make_shared<Matrix>(m));
+  mType = kMatrixValue;
+}
+
+void Value::copyFrom(const Value& other)
 {
-  switch (mType)
+  switch (other.mType)
   {
     case kUndefinedValue:
+      dispose();
       break;
     case kFloatValue:
-      mFloatVal = other.getFloatValue();
+      setValue(other._floatVal);
       break;
     case kTextValue:
-      mTextVal = other.getTextValue();
-      break;
     case kBlobValue:
-      copyBlob(other.pBlobData, other._blobSizeInBytes);
+      if (other.hasHeapBytes())
+      {
+        // share the other Value's heap data.
+        dispose();
+        new (&_heapBytes) std::shared_ptr<uint8_t[]>(other._heapBytes);
+        _sizeInBytes = other._sizeInBytes;
+        mType = other.mType;
+      }
+      else
+      {
+        setBytes(other.mType, other._localData, other._sizeInBytes);
+      }
       break;
     case kMatrixValue:
-      mMatrixVal = other.getMatrixValue();
+      dispose();
+      new (&_matrixPtr) std::shared_ptr<Matrix>(other._matrixPtr);
+      mType = kMatrixValue;
       break;
     case kUnsignedLongValue:
-      mUnsignedLongVal = other.getUnsignedLongValue();
+      setValue(other._unsignedLongVal);
       break;
     case kIntervalValue:
-      mIntervalVal = other.getIntervalValue();
+      setValue(other._intervalVal);
       break;
   }
 }
 
+void Value::moveFrom(Value& other) noexcept
+{
+  if (other.hasHeapBytes())
+  {
+    new (&_heapBytes) std::shared_ptr<uint8_t[]>(std::move(other._heapBytes));
+  }
+  else if (other.mType == kMatrixValue)
+  {
+    new (&_matrixPtr) std::shared_ptr<Matrix>(std::move(other._matrixPtr));
+  }
+  else
+  {
+    std::copy(other._localData, other._localData + kLocalDataBytes, _localData);
+  }
+  mType = other.mType;
+  _sizeInBytes = other._sizeInBytes;
+
+  // leave the other Value undefined.
+  other.dispose();
+}
+
+Value::Value(const Value& other) : _floatVal(0) { copyFrom(other); }
+
 Value& Value::operator=(const Value& other)
 {
-  mType = other.getType();
-  switch (mType)
+  if (this != &other)
   {
-    case kUndefinedValue:
-      break;
-    case kFloatValue:
-      mFloatVal = other.getFloatValue();
-      break;
-    case kTextValue:
-      mTextVal = other.getTextValue();
-      break;
-    case kBlobValue:
-      copyBlob(other.pBlobData, other._blobSizeInBytes);
-      break;
-    case kMatrixValue:
-      // Matrix handles copy-in-place when possible
-      mMatrixVal = other.getMatrixValue();
-      break;
-    case kUnsignedLongValue:
-      mUnsignedLongVal = other.getUnsignedLongValue();
-      break;
-    case kIntervalValue:
-      mIntervalVal = other.getIntervalValue();
-      break;
+    copyFrom(other);
   }
+  return *this;
+}
 
+Value::Value(Value&& other) noexcept : _floatVal(0) { moveFrom(other); }
+
+Value& Value::operator=(Value&& other) noexcept
+{
+  if (this != &other)
+  {
+    dispose();
+    moveFrom(other);
+  }
   return *this;
 }
 
-Value::Value(float v) : mType(kFloatValue) { mFloatVal = v; }
+Value::Value(float v) : mType(kFloatValue), _floatVal(v) {}
 
-Value::Value(int v) : mType(kFloatValue) { mFloatVal = v; }
+Value::Value(int v) : mType(kFloatValue), _floatVal(v) {}
 
-Value::Value(bool v) : mType(kFloatValue) { mFloatVal = v; }
+Value::Value(bool v) : mType(kFloatValue), _floatVal(v) {}
 
-Value::Value(unsigned long v) : mType(kUnsignedLongValue) { mUnsignedLongVal = v; }
+Value::Value(unsigned long v) : mType(kUnsignedLongValue), _unsignedLongVal(v) {}
 
-Value::Value(uint32_t v) : mType(kUnsignedLongValue) { mUnsignedLongVal = v; }
+Value::Value(uint32_t v) : mType(kUnsignedLongValue), _unsignedLongVal(v) {}
 
-Value::Value(long v) : mType(kFloatValue) { mFloatVal = v; }
+Value::Value(long v) : mType(kFloatValue), _floatVal(v) {}
 
-Value::Value(double v) : mType(kFloatValue) { mFloatVal = v; }
+Value::Value(double v) : mType(kFloatValue), _floatVal(v) {}
 
-Value::Value(const ml::Text& t) : mType(kTextValue) { mTextVal = t; }
+Value::Value(const ml::Text& t) : _floatVal(0) { setValue(t); }
 
-Value::Value(const char* t) : mType(kTextValue) { mTextVal = ml::Text(t); }
+Value::Value(const char* t) : _floatVal(0) { setValue(t); }
 
-Value::Value(const ml::Matrix& s) : mType(kMatrixValue) { mMatrixVal = s; }
+Value::Value(const ml::Matrix& s) : _floatVal(0) { setMatrix(s); }
 
-Value::Value(Interval i) : mType(kIntervalValue) { mIntervalVal = i; }
+Value::Value(Interval i) : mType(kIntervalValue), _intervalVal(i) {}
 
-Value::Value(const void* pData, size_t n) : mType(kBlobValue)
-{
-  copyBlob(pData, n);
-}
+Value::Value(const void* pData, size_t n) : _floatVal(0) { setBytes(kBlobValue, pData, n); }
 
-Value::~Value()
-{
-  // if we have external data, free it
-  if(pBlobData != _localBlobData)
-  {
-    free(pBlobData);
-  }
-}
+Value::~Value() { dispose(); }
 
 void Value::setValue(const float& v)
 {
+  dispose();
   mType = kFloatValue;
-  mFloatVal = v;
+  _floatVal = v;
 }
 
-void Value::setValue(const int& v)
-{
-  mType = kFloatValue;
-  mFloatVal = v;
-}
+void Value::setValue(const int& v) { setValue(static_cast<float>(v)); }
 
-void Value::setValue(const bool& v)
-{
-  mType = kFloatValue;
-  mFloatVal = v;
-}
+void Value::setValue(const bool& v) { setValue(static_cast<float>(v)); }
 
 void Value::setValue(const uint32_t& v)
 {
+  dispose();
   mType = kUnsignedLongValue;
-  mUnsignedLongVal = v;
+  _unsignedLongVal = v;
 }
 
-void Value::setValue(const long& v)
-{
-  mType = kFloatValue;
-  mFloatVal = v;
-}
+void Value::setValue(const long& v) { setValue(static_cast<float>(v)); }
 
-void Value::setValue(const double& v)
-{
-  mType = kFloatValue;
-  mFloatVal = v;
-}
+void Value::setValue(const double& v) { setValue(static_cast<float>(v)); }
 
-void Value::setValue(const ml::Text& v)
-{
-  mType = kTextValue;
-  mTextVal = v;
-}
+void Value::setValue(const ml::Text& v) { setBytes(kTextValue, v.getText(), v.lengthInBytes()); }
 
-void Value::setValue(const char* const v)
-{
-  mType = kTextValue;
-  mTextVal = v;
-}
+void Value::setValue(const char* const v) { setValue(ml::Text(v)); }
 
-void Value::setValue(const Matrix& v)
-{
-  mType = kMatrixValue;
-  mMatrixVal = v;
-}
+void Value::setValue(const Matrix& v) { setMatrix(v); }
 
 void Value::setValue(const Interval v)
 {
+  dispose();
   mType = kIntervalValue;
-  mIntervalVal = v;
+  _intervalVal = v;
 }
 
 void Value::setValue(const Value& v) { *this = v; }
@@ -214,7 +250,7 @@ bool Value::operator==(const Value& b) const
         r = (getFloatValue() == b.getFloatValue());
         break;
       case kTextValue:
-        r = (getTextValue() == b.getTextValue());
+        r = compareSizedCharArrays(getChars(), _sizeInBytes, b.getChars(), b._sizeInBytes);
         break;
       case kMatrixValue:
         r = (getMatrixValue() == b.getMatrixValue());
@@ -6,6 +6,7 @@
 
 #include <list>
 #include <map>
+#include <memory>
 #include <string>
 
 #include "MLMatrix.h"
@@ -16,7 +17,14 @@
 
 // Value: a small unit of typed data designed for being constructed on the stack and
 // transferred in messages. Values have the following types: undefined, float,
-// text, blob, untisnged longm, and matrix. (Matrix soon to be deprecated)
+// text, blob, unsigned long, interval and matrix. (Matrix soon to be deprecated)
+//
+// All the types share one small local buffer. Text and blob data that fit into the
+// buffer are stored there, so Values containing short texts never allocate. Larger
+// text and blob payloads and all matrices are stored on the heap and shared
+// between copies of a Value: copying a Value holding a large payload just adds a
+// reference. A shared payload is never modified, only replaced, so this acts as
+// copy-on-write. getMutableBlobValue() copies a shared blob before returning it.
 
 // TODO: instead of using Matrix directly here as a type, make a blob type
 // and utilities (in Matrix) for conversion.
@@ -28,7 +36,8 @@ class Value
 {
  public:
 
-  static constexpr size_t kLocalDataBytes{256};
+  // text or blob data up to this size is stored in the Value itself.
+  static constexpr size_t kLocalDataBytes{48};
   
   enum Type
   {
@@ -46,6 +55,8 @@ class Value
   Value();
   Value(const Value& other);
   Value& operator=(const Value& other);
+  Value(Value&& other) noexcept;
+  Value& operator=(Value&& other) noexcept;
   Value(float v);
   Value(int v);
   Value(bool v);
@@ -59,22 +70,18 @@ class Value
   Value(Interval i);
 
   // binary blob constructor.
-  // if data size > kBlobSizeBytes, this will allocate heap.
+  // if data size > kLocalDataBytes, this will allocate heap.
   explicit Value(const void* pData, size_t n);
 
   // matrix type constructor via initializer_list
-  Value(std::initializer_list<float> values)
+  Value(std::initializer_list<float> values) : Value()
   {
     auto size = values.size();
-    if (size == 0)
-    {
-      *this = Value();
-    }
-    else if (size == 1)
+    if (size == 1)
     {
       *this = Value(*values.begin());
     }
-    else
+    else if (size > 1)
     {
       *this = Value(Matrix(values));
     }
@@ -82,69 +89,88 @@ class Value
 
   ~Value();
 
-  inline const float getFloatValue() const { return mFloatVal; }
+  inline const float getFloatValue() const { return (mType == kFloatValue) ? _floatVal : 0.f; }
 
   inline const float getFloatValueWithDefault(float d) const
   {
-    return (mType == kFloatValue) ? mFloatVal : d;
+    return (mType == kFloatValue) ? _floatVal : d;
   }
 
-  inline const float getBoolValue() const { return static_cast<bool>(mFloatVal); }
+  inline const float getBoolValue() const { return static_cast<bool>(getFloatValue()); }
 
   inline const bool getBoolValueWithDefault(bool b) const
   {
-    return (mType == kFloatValue) ? static_cast<bool>(mFloatVal) : b;
+    return (mType == kFloatValue) ? static_cast<bool>(_floatVal) : b;
   }
 
-  inline const float getIntValue() const { return static_cast<int>(mFloatVal); }
+  inline const float getIntValue() const { return static_cast<int>(getFloatValue()); }
 
   inline const int getIntValueWithDefault(int d) const
   {
-    return (mType == kFloatValue) ? static_cast<int>(mFloatVal) : d;
+    return (mType == kFloatValue) ? static_cast<int>(_floatVal) : d;
   }
 
-  inline const uint32_t getUnsignedLongValue() const { return mUnsignedLongVal; }
+  inline const uint32_t getUnsignedLongValue() const
+  {
+    return (mType == kUnsignedLongValue) ? _unsignedLongVal : 0;
+  }
 
   inline const uint32_t getUnsignedLongValueWithDefault(uint32_t d) const
   {
-    return (mType == kUnsignedLongValue) ? mUnsignedLongVal : d;
+    return (mType == kUnsignedLongValue) ? _unsignedLongVal : d;
   }
 
   inline const ml::Text getTextValue() const
   {
-    return (mType == kTextValue) ? (mTextVal) : ml::Text();
+    return (mType == kTextValue) ? ml::Text(getChars(), _sizeInBytes) : ml::Text();
   }
 
   inline const ml::Text getTextValueWithDefault(Text d) const
   {
-    return (mType == kTextValue) ? (mTextVal) : d;
+    return (mType == kTextValue) ? ml::Text(getChars(), _sizeInBytes) : d;
   }
 
   inline const Matrix& getMatrixValue() const
   {
-    return (mType == kMatrixValue) ? (mMatrixVal) : nullMatrix;
+    return (mType == kMatrixValue) ? (*_matrixPtr) : nullMatrix;
   }
 
   inline const Matrix getMatrixValueWithDefault(Matrix d) const
   {
-    return (mType == kMatrixValue) ? (mMatrixVal) : d;
+    return (mType == kMatrixValue) ? (*_matrixPtr) : d;
   }
 
   inline const Interval getIntervalValue() const
   {
-    return (mType == kIntervalValue) ? (mIntervalVal) : Interval();
+    return (mType == kIntervalValue) ? (_intervalVal) : Interval();
   }
   
   inline const Interval getIntervalValueWithDefault(Interval d) const
   {
-    return (mType == kIntervalValue) ? (mIntervalVal) : d;
+    return (mType == kIntervalValue) ? (_intervalVal) : d;
   }
   
-  inline void* getBlobValue() const
+  // the blob data may be shared with copies of this Value, so it is read-only.
+  inline const void* getBlobValue() const
+  {
+    if (mType == kBlobValue)
+    {
+      return getBytes();
+    }
+    else
+    {
+      return nullptr;
+    }
+  }
+
+  // get writable blob data, first making a copy of the data if it is shared with
+  // other Values.
+  inline void* getMutableBlobValue()
   {
     if (mType == kBlobValue)
     {
-      return (void*)(pBlobData);
+      detach();
+      return const_cast<uint8_t*>(getBytes());
     }
     else
     {
@@ -156,7 +182,7 @@ class Value
   {
     if (mType == kBlobValue)
     {
-      return _blobSizeInBytes;
+      return _sizeInBytes;
     }
     else
     {
@@ -201,21 +227,43 @@ class Value
   bool operator<<(const Value& b) const;
 
  private:
-  void copyBlob(const void* inputData, size_t size);
+  // text and blob values store their bytes locally or in a shared heap buffer.
+  inline bool hasHeapBytes() const
+  {
+    return ((mType == kTextValue) || (mType == kBlobValue)) && (_sizeInBytes > kLocalDataBytes);
+  }
+
+  inline const uint8_t* getBytes() const
+  {
+    return hasHeapBytes() ? _heapBytes.get() : _localData;
+  }
 
-  uint8_t _localBlobData[kLocalDataBytes];
-  size_t _blobSizeInBytes;
-  uint8_t *pBlobData{_localBlobData};
+  inline const char* getChars() const { return reinterpret_cast<const char*>(getBytes()); }
+
+  void setBytes(Type t, const void* pData, size_t size);
+  void setMatrix(const Matrix& m);
+  void copyFrom(const Value& other);
+  void moveFrom(Value& other) noexcept;
+
+  // make sure that any heap bytes are owned by this Value only.
+  void detach();
+
+  // release any heap payload and become undefined.
+  void dispose() noexcept;
 
-  // TODO reduce storage requirements and reduce copying!
-  // this is a minimal-code start.
-  // everything will share space.
   Type mType{kUndefinedValue};
-  float mFloatVal{};
-  ml::Text mTextVal{};
-  Matrix mMatrixVal{};
-  uint32_t mUnsignedLongVal{};
-  Interval mIntervalVal{};
+  uint32_t _sizeInBytes{0};
+
+  // storage shared by all types. Only the member matching mType is valid.
+  union
+  {
+    float _floatVal;
+    uint32_t _unsignedLongVal;
+    Interval _intervalVal;
+    uint8_t _localData[kLocalDataBytes];
+    std::shared_ptr<uint8_t[]> _heapBytes;
+    std::shared_ptr<Matrix> _matrixPtr;
+  };
 };
 
 // NamedValue for initializer lists